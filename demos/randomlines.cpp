@@ -11,15 +11,20 @@ using namespace pixel;
 
 class RandomLines: public Application {
 
+	vi2d points[100];
+	Pixel pixels[50];
+
 public:
 	inline bool OnUpdate(float et) override {
 		
 		for(uint8_t i = 0; i < 50; i++) {
-			DrawLine(vu2d(rand() % pScreenSize.x, rand() % pScreenSize.y),
-					 vu2d(rand() % pScreenSize.x, rand() % pScreenSize.y),
-					 RandPixel());
+			points[2 * i + 0] = vi2d(rand() % pScreenSize.x, rand() % pScreenSize.y);
+			points[2 * i + 1] = vi2d(rand() % pScreenSize.x, rand() % pScreenSize.y);
+			pixels[i] = RandPixel();
 		}
 
+		DrawLines(points, pixels, 100);
+
 		if(KeyboardKey(Key::ESCAPE).pressed) {
 			Close();
 		}
@@ -0,0 +1,112 @@
+/*
+
+	Viewer for the framebuffer stream of another pixel
+	application, started there with StartStream("pixel").
+	Connects to the pipe, applies the changed tiles of
+	every frame it receives and shows the result.
+
+*/
+
+#include <pixel.hpp>
+using namespace pixel;
+
+class StreamViewer : public Application {
+
+public:
+	StreamViewer(HANDLE pipe, const StreamHeader& header, std::vector<uint8_t>&& payload) : pPipe(pipe), pHeader(header), pPayload(std::move(payload)) {}
+
+	~StreamViewer() {
+		delete pFrame;
+	}
+
+	bool OnCreate() override {
+		pFrame = new Sprite(vu2d(pHeader.width, pHeader.height));
+
+		// The first frame was already read to learn the size
+		return ApplyStreamFrame(pHeader, pPayload.data(), pFrame);
+	}
+
+	bool OnUpdate(float et) override {
+		DWORD available = 0;
+
+		while(PeekNamedPipe(pPipe, NULL, 0, NULL, &available, NULL) && available >= sizeof(StreamHeader)) {
+			if(!ReadFrame(pPipe, pHeader, pPayload)) return false;
+			if(!ApplyStreamFrame(pHeader, pPayload.data(), pFrame)) return false;
+
+			pBytes += sizeof(StreamHeader) + pHeader.payload;
+			pFrames++;
+		}
+
+		pTime += et;
+
+		if(pTime >= 1.0f) {
+			SetName("Stream viewer - " + std::to_string(pFrames) + " fps, " + std::to_string(pBytes / 1024) + " KiB/s");
+
+			pTime = 0.0f;
+			pFrames = 0;
+			pBytes = 0;
+		}
+
+		BlitSprite(vi2d(0, 0), pFrame);
+
+		if(KeyboardKey(Key::ESCAPE).pressed) {
+			Close();
+		}
+
+		return true;
+	}
+
+	static bool ReadFrame(HANDLE pipe, StreamHeader& header, std::vector<uint8_t>& payload) {
+		if(!ReadExact(pipe, &header, sizeof(StreamHeader)) || header.magic != StreamMagic) return false;
+
+		payload.resize(header.payload);
+		return ReadExact(pipe, payload.data(), header.payload);
+	}
+
+	static bool ReadExact(HANDLE pipe, void* data, size_t size) {
+		uint8_t* out = (uint8_t*) data;
+
+		while(size) {
+			DWORD read = 0;
+			if(!ReadFile(pipe, out, (DWORD) size, &read, NULL) || read == 0) return false;
+
+			out += read;
+			size -= read;
+		}
+
+		return true;
+	}
+
+private:
+	HANDLE pPipe;
+	StreamHeader pHeader;
+	std::vector<uint8_t> pPayload;
+	Sprite* pFrame = nullptr;
+
+	float pTime = 0.0f;
+	uint32_t pFrames = 0;
+	size_t pBytes = 0;
+};
+
+int main() {
+	HANDLE pipe = CreateFileA("\\\\.\\pipe\\pixel", GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+
+	if(pipe == INVALID_HANDLE_VALUE) {
+		printf("No stream to connect to.\n");
+		return 1;
+	}
+
+	StreamHeader header;
+	std::vector<uint8_t> payload;
+
+	if(!StreamViewer::ReadFrame(pipe, header, payload)) {
+		printf("Invalid stream.\n");
+		return 1;
+	}
+
+	StreamViewer viewer(pipe, header, std::move(payload));
+	viewer.Launch(vu2d(header.width, header.height), 1, vu2d(100, 100), "Stream viewer");
+
+	CloseHandle(pipe);
+	return 0;
+}
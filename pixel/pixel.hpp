@@ -71,6 +71,25 @@
 #include <vector>
 #include <memory>
 #include <thread>
+#include <charconv>
+#include <cstddef>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+#include <unordered_map>
+#include <bit>
+#include <fstream>
+
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+	#define PIXEL_SSE2
+	#include <emmintrin.h>
+#endif
+
+#ifdef __AVX2__
+	#define PIXEL_AVX2
+	#include <immintrin.h>
+#endif
 
 #include <Windows.h>
 #include <gdiplus.h>
@@ -85,9 +104,57 @@ static struct GdipStart {
 
 #include <gl/GL.h>
 
+#ifndef GL_UNSIGNED_SHORT_5_6_5
+	#define GL_UNSIGNED_SHORT_5_6_5 0x8363
+#endif
+
+#ifndef GL_CLAMP_TO_EDGE
+	#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
 typedef BOOL(WINAPI wglSwapInterval_t) (int interval);
 static wglSwapInterval_t* wglSwapInterval = nullptr;
 
+/*
+	Defining PIXEL_TRACK_ALLOCATIONS before including this file replaces the
+	global allocation operators with counting ones. The engine thread compares
+	the count between frames and reports any frame past the warm-up period that
+	touched the heap, see Application::Stats().
+*/
+
+#ifdef PIXEL_TRACK_ALLOCATIONS
+namespace pixel {
+	inline thread_local uint64_t allocationCount = 0;
+}
+
+void* operator new(size_t size) {
+	pixel::allocationCount++;
+
+	if(void* p = malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	free(p);
+}
+#endif
+
 /*
 ___________________________
 		
@@ -116,85 +183,108 @@ namespace pixel {
 	};
 
 	enum class DrawingMode: uint8_t {
-		NO_ALPHA, FULL_ALPHA, MASK
+		NO_ALPHA, FULL_ALPHA, MASK, LINEAR_ALPHA
+	};
+
+	enum class PixelFormat: uint8_t {
+		RGBA32, INDEXED8, RGB565
+	};
+
+	enum class SpriteFilter: uint8_t {
+		NEAREST, BILINEAR, TRILINEAR
+	};
+
+	enum class LineJoin: uint8_t {
+		MITER, BEVEL, ROUND
+	};
+
+	enum class ImageFormat: uint8_t {
+		QOI, BMP, PNG
+	};
+
+	enum class CaptureFormat: uint8_t {
+		Y4M, RAW, IMAGES
+	};
+
+	enum class ReplaySpeed: uint8_t {
+		RECORDED, UNLIMITED
 	};
 
 	template<class T> struct v2d {
 		T x = 0; T y = 0;
 
-		v2d(): x(0), y(0) {}
-		v2d(T x, T y): x(x), y(y) {}
-		v2d(const v2d& v): x(v.x), y(v.y) {}
+		constexpr v2d() = default;
+		constexpr v2d(T x, T y): x(x), y(y) {}
 
-		inline T prod() const {
+		constexpr T prod() const {
 			return x * y;
 		}
 
-		inline v2d operator + (const T& rhs) const {
+		constexpr v2d operator + (const T& rhs) const {
 			return v2d(this->x + rhs, this->y + rhs);
 		}
-		inline v2d operator + (const v2d& rhs) const {
+		constexpr v2d operator + (const v2d& rhs) const {
 			return v2d(this->x + rhs.x, this->y + rhs.y);
 		}
-		inline v2d  operator - (const T& rhs) const {
+		constexpr v2d operator - (const T& rhs) const {
 			return v2d(this->x - rhs, this->y - rhs);
 		}
-		inline v2d  operator - (const v2d& rhs) const {
+		constexpr v2d operator - (const v2d& rhs) const {
 			return v2d(this->x - rhs.x, this->y - rhs.y);
 		}
-		inline v2d  operator * (const T& rhs) const {
+		constexpr v2d operator * (const T& rhs) const {
 			return v2d(this->x * rhs, this->y * rhs);
 		}
-		inline v2d  operator * (const v2d& rhs) const {
+		constexpr v2d operator * (const v2d& rhs) const {
 			return v2d(this->x * rhs.x, this->y * rhs.y);
 		}
-		inline v2d  operator / (const T& rhs) const {
+		constexpr v2d operator / (const T& rhs) const {
 			return v2d(this->x / rhs, this->y / rhs);
 		}
-		inline v2d  operator / (const v2d& rhs) const {
+		constexpr v2d operator / (const v2d& rhs) const {
 			return v2d(this->x / rhs.x, this->y / rhs.y);
 		}
 
-		inline v2d& operator += (const T& rhs) {
+		constexpr v2d& operator += (const T& rhs) {
 			this->x += rhs; this->y += rhs;
 			return *this;
 		}
-		inline v2d& operator += (const v2d& rhs) {
+		constexpr v2d& operator += (const v2d& rhs) {
 			this->x += rhs.x; this->y += rhs.y;
 			return *this;
 		}
-		inline v2d& operator -= (const T& rhs) {
+		constexpr v2d& operator -= (const T& rhs) {
 			this->x -= rhs; this->y -= rhs;
 			return *this;
 		}
-		inline v2d& operator -= (const v2d& rhs) {
+		constexpr v2d& operator -= (const v2d& rhs) {
 			this->x -= rhs.x; this->y -= rhs.y;
 			return *this;
 		}
-		inline v2d& operator *= (const T& rhs) {
+		constexpr v2d& operator *= (const T& rhs) {
 			this->x *= rhs; this->y *= rhs;
 			return *this;
 		}
-		inline v2d& operator *= (const v2d& rhs) {
+		constexpr v2d& operator *= (const v2d& rhs) {
 			this->x *= rhs.x; this->y *= rhs.y;
 			return *this;
 		}
-		inline v2d& operator /= (const T& rhs) {
+		constexpr v2d& operator /= (const T& rhs) {
 			this->x /= rhs; this->y /= rhs;
 			return *this;
 		}
-		inline v2d& operator /= (const v2d& rhs) {
+		constexpr v2d& operator /= (const v2d& rhs) {
 			this->x /= rhs.x; this->y /= rhs.y;
 			return *this;
 		}
 
-		inline operator v2d<int32_t>() const {
+		constexpr operator v2d<int32_t>() const {
 			return { static_cast<int32_t>(this->x), static_cast<int32_t>(this->y) };
 		}
-		inline operator v2d<float>() const {
+		constexpr operator v2d<float>() const {
 			return { static_cast<float>(this->x), static_cast<float>(this->y) };
 		}
-		inline operator v2d<double>() const {
+		constexpr operator v2d<double>() const {
 			return { static_cast<double>(this->x), static_cast<double>(this->y) };
 		}
 	};
@@ -206,6 +296,44 @@ namespace pixel {
 	typedef v2d<double> vd2d;
 	typedef v2d<float> vf2d;
 
+	static_assert(std::is_trivially_copyable_v<vf2d> && std::is_trivially_copyable_v<vi2d>);
+
+	class vf2dArray {
+
+	public:
+		vf2dArray() = default;
+		vf2dArray(size_t count);
+
+	public:
+		size_t Size() const;
+		void Resize(size_t count);
+		void Clear();
+
+		void Push(const vf2d& v);
+		vf2d Get(size_t i) const;
+		void Set(size_t i, const vf2d& v);
+
+		float* Xs();
+		float* Ys();
+		const float* Xs() const;
+		const float* Ys() const;
+
+		void Add(const vf2d& offset);
+		void Add(const vf2dArray& other);
+		void Scale(float factor);
+		void Scale(const vf2d& factor);
+		void Rotate(float angle, const vf2d& pivot = vf2d());
+		void Transform(const float (&m)[6]);
+
+		void Length(float* out) const;
+		void Normalize();
+		void Round(int32_t* outX, int32_t* outY) const;
+
+	private:
+		std::vector<float> pXs;
+		std::vector<float> pYs;
+	};
+
 	struct Pixel {
 		union {
 			uint32_t n = 0x000000FF;
@@ -261,1159 +389,8636 @@ namespace pixel {
 		return Pixel(rand() % 255, rand() % 255, rand() % 255, rand() % 255);
 	}
 
-	class Sprite {
+	/*
+		In PixelFormat::INDEXED8 the red channel of a Pixel carries the palette
+		index and the alpha channel still decides whether it is written.
+	*/
 
-	public:
-		Sprite(const std::string& filename);
-		~Sprite();
+	inline Pixel PaletteIndex(uint8_t index) {
+		return Pixel(index, 0, 0, 0xFF);
+	}
 
-		friend class Application;
+	inline uint16_t PackRGB565(const Pixel& p) {
+		return (uint16_t) (((p.r >> 3) << 11) | ((p.g >> 2) << 5) | (p.b >> 3));
+	}
+
+	inline Pixel UnpackRGB565(uint16_t p) {
+		uint8_t r = (p >> 11) & 0x1F, g = (p >> 5) & 0x3F, b = p & 0x1F;
+		return Pixel((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+	}
+
+	struct SrgbTables {
+		uint32_t toLinear[256];
+		uint8_t fromLinear[4096 + 4];
+	};
+
+	const SrgbTables& Srgb();
+
+	Pixel BlendPixel(const Pixel& d, const Pixel& pixel);
+	Pixel BlendPixelLinear(const Pixel& d, const Pixel& pixel);
+	Pixel BlendPixel(const Pixel& d, const Pixel& pixel, DrawingMode mode);
+
+	void BlendSpanLinear(Pixel* dst, size_t count, const Pixel& pixel);
+	void BlendRowLinear(Pixel* dst, const Pixel* src, size_t count);
+
+	void BlitPixels(const Pixel* src, uint32_t srcStride, Pixel* dst, uint32_t dstStride, int32_t w, int32_t h, DrawingMode mode);
+
+	void ExpandIndexed(const uint8_t* src, const Pixel* palette, Pixel* dst, size_t count);
+	void ExpandRGB565(const uint16_t* src, Pixel* dst, size_t count);
+
+	void GradientSpan(Pixel* dst, size_t count, const int32_t* color, const int32_t* step);
+	void RadialSpan(Pixel* dst, size_t count, float dx, float dy, float invRadius, const Pixel& inner, const Pixel& outer);
+
+	class FrameArena {
 
 	public:
-		void Update();
+		FrameArena(size_t capacity = 1 << 20);
+		~FrameArena();
 
-	private:
-		vu2d pSize;
-		vf2d pUvScale = vf2d(1.0f, 1.0f);
+		FrameArena(const FrameArena& other) = delete;
+		FrameArena& operator=(const FrameArena& other) = delete;
 
-		Pixel* pBuffer = nullptr;
-		uint32_t pBufferId = 0xFFFFFFFF;
+	public:
+		void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+		template<class T> T* Allocate(size_t count = 1);
 
-		vf2d pPos[4] = { vf2d(0.0f, 0.0f), vf2d(0.0f, 0.0f), vf2d(0.0f, 0.0f), vf2d(0.0f, 0.0f) };
-		vf2d pUv[4] = { vf2d(0.0f, 0.0f), vf2d(0.0f, 1.0f), vf2d(1.0f, 1.0f), vf2d(1.0f, 0.0f) };
-		float pW[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
-		Pixel pTint = White;
+		void Reset();
+
+		size_t Used() const;
+		size_t Capacity() const;
+		size_t HighWater() const;
 
 	private:
-		void pCreateTexture();
-		void pDeleteTexture();
-		void pUploadTexture();
-		void pApplyTexture();
+		struct Block {
+			Block* next;
+		};
+
+		uint8_t* pBuffer = nullptr;
+		size_t pCapacity = 0;
+		size_t pOffset = 0;
+
+		Block* pOverflow = nullptr;
+		size_t pOverflowBytes = 0;
+		size_t pHighWater = 0;
 	};
 
-	class Application {
+	class WorkerPool {
 
 	public:
-		Application() {}
+		WorkerPool(uint32_t threads = 0);
+		~WorkerPool();
 
-	public:
-		void Launch(const vu2d& size, uint8_t scale, const vu2d& position, const std::string& name, DrawingMode mode = DrawingMode::NO_ALPHA, bool fullScreen = false, bool vsync = false);
+		WorkerPool(const WorkerPool& other) = delete;
+		WorkerPool& operator=(const WorkerPool& other) = delete;
 
 	public:
-		Application(const Application& other) = delete;
-		Application& operator=(const Application& other) = delete;
+		template<class F> void ParallelFor(uint32_t count, uint32_t grain, F&& fn);
 
-	protected:
-		virtual bool OnCreate();
-		virtual bool OnUpdate(float et);
+		uint32_t Threads() const;
 
-	protected:
-		void Close();
+	private:
+		typedef void (*Task)(void* context, uint32_t begin, uint32_t end);
 
-		void SetName(const std::string& name);
-		void SetDrawingMode(pixel::DrawingMode mode);
+		std::vector<std::thread> pThreads;
 
-	protected:
-		void Draw(const vu2d& pos, const Pixel& pixel);
-		void DrawLine(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel);
+		std::mutex pCallMutex;
+		std::mutex pMutex;
+		std::condition_variable pWake;
+		std::condition_variable pDone;
 
-		void DrawCircle(const vu2d& pos, uint32_t radius, const Pixel& pixel);
-		void FillCircle(const vu2d& pos, uint32_t radius, const Pixel& pixel);
+		Task pTask = nullptr;
+		void* pContext = nullptr;
+		uint32_t pCount = 0;
+		uint32_t pGrain = 1;
 
-		void DrawRect(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel);
-		void FillRect(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel);
+		std::atomic<uint32_t> pNext = 0;
+		std::atomic<uint32_t> pFinished = 0;
+		uint64_t pGeneration = 0;
+		uint32_t pActive = 0;
+		bool pStop = false;
 
-		void DrawTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel);
-		void FillTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel);
+	private:
+		void pRun(uint32_t count, uint32_t grain, void* context, Task task);
+		void pWork();
+		void pWorkerThread();
+	};
 
-		void DrawSprite(const vf2d& pos, Sprite* sprite, const vf2d& scale = vf2d(1.0f, 1.0f), const Pixel& tint = White);
-		void DrawPartialSprite(const vf2d& pos, const vf2d& spos, const vf2d& ssize, Sprite* sprite, const vf2d& scale = vf2d(1.0f, 1.0f), const Pixel& tint = White);
+	WorkerPool& Workers();
 
-		void DrawWarpedSprite(Sprite* sprite, std::array<vf2d, 4>& pos, const Pixel& tint = White);
-		void DrawPartialWarpedSprite(Sprite* sprite, std::array<vf2d, 4>& post, const vf2d& spos, const vf2d& ssize, const Pixel& tint = White);
+	void UpscaleNearest(const Pixel* src, const vu2d& srcSize, Pixel* dst, uint32_t dstStride, uint32_t factor);
+	void UpscaleFit(const Pixel* src, const vu2d& srcSize, Pixel* dst, const vu2d& dstSize, const Pixel& border = Black);
 
-		void DrawRotatedSprite(const vf2d& pos, Sprite* sprite, float alpha, const vf2d& center = vf2d(0.0f, 0.0f), const vf2d scale = vf2d(1.0f, 1.0f), const Pixel& tint = White);
-		void DrawPartialRotatedSprite(const vf2d& pos, Sprite* sprite, float alpha, const vf2d& spos, const vf2d& ssize, const vf2d& center = vf2d(0.0f, 0.0f), const vf2d scale = vf2d(1.0f, 1.0f), const Pixel& tint = White);
+	void BoxBlur(const Pixel* src, Pixel* dst, Pixel* scratch, const vu2d& size, uint32_t radius);
 
-	protected:
-		bool ShouldExist() const;
-		pixel::DrawingMode DrawingMode() const;
+	uint64_t HashFrame(const Pixel* data, size_t count);
 
-		vu2d DrawableSize() const;
-		vu2d ScreenSize() const;
+	size_t EncodeQoiOps(const Pixel* src, uint32_t stride, const vu2d& size, uint8_t* out);
+	size_t DecodeQoiOps(const uint8_t* in, size_t length, Pixel* dst, uint32_t stride, const vu2d& size);
 
-		vu2d WindowSize() const;
-		vu2d WindowPos() const;
+	struct Span {
+		int32_t x1;
+		int32_t x2;
+		int32_t y;
+	};
 
-		vu2d MousePos() const;
-		uint32_t MouseWheel() const;
+	struct FrameStats {
+		uint64_t frame = 0;
+		uint64_t allocations = 0;
+		uint64_t allocatingFrames = 0;
 
-		Button MouseLeft() const;
-		Button MouseRight() const;
-		Button MouseMiddle() const;
+		size_t arenaUsed = 0;
+		size_t arenaHighWater = 0;
 
-		Button KeyboardKey(Key key) const;
+		uint64_t segments = 0;
+		double segmentTime = 0.0;
 
-		float ElapsedTime() const;
-		uint32_t FPS() const;
+		double postTime = 0.0;
 
-	protected:
-		vu2d pWindowSize;
-		vu2d pWindowPos;
+		inline double SegmentsPerSecond() const {
+			return segmentTime > 0.0 ? segments / segmentTime : 0.0;
+		}
+	};
 
-		vu2d pScreenSize;
-		vf2d pInvScreenSize;
+	struct OcclusionStats {
+		uint64_t written = 0;
+		uint64_t skipped = 0;
+		uint32_t culled = 0;
 
-		uint8_t pScale;
+		inline double SavedFraction() const {
+			return written + skipped ? double(skipped) / double(written + skipped) : 0.0;
+		}
+	};
 
-		vu2d pViewSize;
-		vu2d pViewPos;
+	struct RleStats {
+		size_t rawBytes = 0;
+		size_t encodedBytes = 0;
 
-	private:
-		std::string pWindowName = "";
-		std::string pWindowTittle = "";
+		uint32_t transparentRuns = 0;
+		uint32_t opaqueRuns = 0;
+		uint32_t blendRuns = 0;
 
-	private:
-		bool pVsync = false;
-		bool pFullScreen = false;
+		float rawBlitTime = 0.0f;
+		float rleBlitTime = 0.0f;
 
-		std::atomic_bool pShouldExist = false;
+		inline float Speedup() const {
+			return rleBlitTime > 0.0f ? rawBlitTime / rleBlitTime : 0.0f;
+		}
+	};
 
-	private:
-		std::map<size_t, uint8_t> pKeyMap;
+	struct MipStats {
+		uint32_t levels = 0;
+		size_t bytes = 0;
+		float buildTime = 0.0f;
+	};
 
-		vu2d pMousePos;
-		uint32_t pMouseWheel = 0;
+	class ImageEncoder {
 
-		Button pMouseButtons[3] = {};
-		bool pMouseButtonsOld[3] = {};
-		bool pMouseButtonsNew[3] = {};
+	public:
+		ImageEncoder() {}
 
-		Button pKeyboardKeys[256] = {};
-		bool pKeyboardKeysOld[256] = {};
-		bool pKeyboardKeysNew[256] = {};
+		ImageEncoder(const ImageEncoder& other) = delete;
+		ImageEncoder& operator=(const ImageEncoder& other) = delete;
 
-	private:
-		std::chrono::system_clock::time_point pClock1;
-		std::chrono::system_clock::time_point pClock2;
-		std::chrono::duration<float> pElapsedTimer;
+	public:
+		const std::vector<uint8_t>& Encode(const Pixel* data, const vu2d& size, ImageFormat format, bool fast = true);
+		void Save(const std::string& filename, const Pixel* data, const vu2d& size, ImageFormat format, bool fast = true);
 
-		float pElapsedTime = 0.0f;
-		float pFrameTimer = 0.0f;
-		uint32_t pFrameCount = 0;
-		uint32_t pFrameRate = 0;
+		float EncodeTime() const;
+
+		void SetParallel(bool parallel);
 
 	private:
-		void Update();
-		void EngineThread();
+		struct Group {
+			std::vector<uint8_t> filtered;
+			std::vector<uint8_t> scratch;
+			std::vector<uint8_t> output;
+			std::vector<uint32_t> tokens;
+			std::vector<int32_t> head;
+			std::vector<int32_t> chain;
+
+			size_t filteredSize = 0;
+			size_t outputSize = 0;
+			uint32_t adler = 1;
+			uint32_t crc = 0;
+		};
 
-		static LRESULT CALLBACK pStaticWinProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
-		LRESULT pWinProc(UINT uMsg, WPARAM wParam, LPARAM lParam);
+		struct BitWriter {
+			uint8_t* out;
+			uint64_t bits = 0;
+			uint32_t count = 0;
 
-		void pCreateWindow();
-		void pMapKeyboard();
+			inline void Put(uint32_t value, uint32_t length) {
+				bits |= (uint64_t) value << count;
+				count += length;
 
-	private:
-		HWND pHwnd = NULL;
-		MSG pMsg = {};
+				if(count >= 32) {
+					memcpy(out, &bits, 4);
+					out += 4;
+					bits >>= 32;
+					count -= 32;
+				}
+			}
 
-	private:
-		void pCreateDevice();
-		void pDestroyDevice();
-		void pUpdateViewport();
+			inline void Align() {
+				while(count > 0) {
+					*out++ = (uint8_t) bits;
+					bits >>= 8;
+					count = count > 8 ? count - 8 : 0;
+				}
+			}
+		};
+
+		std::vector<uint8_t> pOutput;
+		std::vector<Group> pGroups;
+		bool pParallel = true;
+		float pEncodeTime = 0.0f;
 
 	private:
-		Pixel* pBuffer = nullptr;
-		uint32_t pBufferId = 0xFFFFFFFF;
+		void pEncodeQoi(const Pixel* data, const vu2d& size);
+		void pEncodeBmp(const Pixel* data, const vu2d& size);
+		void pEncodePng(const Pixel* data, const vu2d& size, bool fast);
 
-		std::vector<Sprite*> pSprites;
-		pixel::DrawingMode pDrawingMode = pixel::DrawingMode::NO_ALPHA;
+		static void pFilterRows(const Pixel* data, const vu2d& size, uint32_t first, uint32_t last, bool fast, Group& group);
+		static void pDeflate(Group& group, bool first, bool last, bool fast);
 
-		HDC pDevideContext = NULL;
-		HGLRC pRenderContext = NULL;
+		template<class L, class M> static void pLz77(Group& group, uint32_t depth, L&& literal, M&& match);
+		static void pHuffmanLengths(const uint32_t* freq, uint32_t count, uint32_t limit, uint8_t* lengths);
+		static void pHuffmanCodes(const uint8_t* lengths, uint32_t count, uint16_t* codes);
+
+		static uint32_t pAdler32(uint32_t adler, const uint8_t* data, size_t size);
+		static uint32_t pAdler32Combine(uint32_t a, uint32_t b, size_t sizeB);
+		static uint32_t pCrc32(uint32_t crc, const uint8_t* data, size_t size);
 	};
-}
 
-/*
-____________________________
+	struct CaptureStats {
+		uint64_t submitted = 0;
+		uint64_t written = 0;
+		uint64_t dropped = 0;
+		uint64_t failed = 0;
 
-    Function definitions
-____________________________
+		float copyTime = 0.0f;
+		float averageCopyTime = 0.0f;
+		float encodeTime = 0.0f;
+	};
 
-*/
+	struct StreamStats {
+		uint64_t submitted = 0;
+		uint64_t sent = 0;
+		uint64_t dropped = 0;
+		uint64_t unchanged = 0;
+		uint64_t totalBytes = 0;
 
-namespace pixel {
+		uint32_t tiles = 0;
+		size_t bytes = 0;
+		size_t rawBytes = 0;
+		float encodeTime = 0.0f;
 
-	inline std::wstring s2ws(std::string string) {
-		int count = MultiByteToWideChar(CP_UTF8, 0, string.c_str(), -1, NULL, 0);
-		wchar_t* buffer = new wchar_t[count];
+		bool connected = false;
 
-		MultiByteToWideChar(CP_UTF8, 0, string.c_str(), -1, buffer, count);
-		std::wstring wide(buffer);
-		
-		delete[] buffer;
-		return wide;
-	}
+		inline float Ratio() const {
+			return rawBytes ? float(bytes) / float(rawBytes) : 0.0f;
+		}
+	};
 
-	inline Pixel::Pixel() {
-		r = 0; g = 0; b = 0; a = 0xFF;
-	}
+	struct StreamHeader {
+		uint32_t magic;
+		uint32_t width;
+		uint32_t height;
+		uint16_t tileSize;
+		uint16_t flags;
+		uint32_t tiles;
+		uint32_t payload;
+	};
 
-	inline Pixel::Pixel(uint32_t p) {
-		n = p;
-	}
+	static constexpr uint32_t StreamMagic = 0x53465850;
+	static constexpr uint16_t StreamKeyframe = 1;
+
+	struct ReplayStats {
+		uint64_t frames = 0;
+		uint64_t played = 0;
+		uint64_t verified = 0;
+		uint64_t mismatches = 0;
+		uint64_t firstMismatch = 0;
+
+		double totalTime = 0.0;
+		double averageTime = 0.0;
+		double medianTime = 0.0;
+		double p95Time = 0.0;
+		double p99Time = 0.0;
+		double maxTime = 0.0;
+
+		inline bool Matched() const {
+			return mismatches == 0;
+		}
+	};
 
-	inline Pixel::Pixel(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha) {
-		n = red | (green << 8) | (blue << 16) | (alpha << 24);
-	}
+	class FrameCapture {
 
-	inline Sprite::Sprite(const std::string& filename) {
-		Gdiplus::Bitmap* bmp = Gdiplus::Bitmap::FromFile(s2ws(filename).c_str());
-		Gdiplus::Color color;
+	public:
+		FrameCapture() {}
+		~FrameCapture();
 
-		if(bmp->GetLastStatus() != Gdiplus::Ok) {
-			pSize = vu2d(0, 0);
-			delete bmp;
-			return;
-		}
+		FrameCapture(const FrameCapture& other) = delete;
+		FrameCapture& operator=(const FrameCapture& other) = delete;
 
-		pSize = vu2d(bmp->GetWidth(), bmp->GetHeight());
-		pUvScale = vf2d(1.0f / float(pSize.x), 1.0f / float(pSize.y));
-		pBuffer = new Pixel[pSize.prod()];
-	
-		for(uint32_t i = 0; i < pSize.prod(); i++) {
-			bmp->GetPixel(i % pSize.x, i / pSize.x, &color);
-			pBuffer[i] = Pixel(color.GetRed(), color.GetGreen(), color.GetBlue(), color.GetAlpha());
-		}
+	public:
+		void Start(const std::string& path, const vu2d& size, CaptureFormat format, uint32_t fps = 60, uint32_t buffers = 4, ImageFormat imageFormat = ImageFormat::PNG);
+		void Stop();
 
-		pCreateTexture();
-		pApplyTexture();
-		pUploadTexture();
+		bool Submit(const Pixel* frame);
+		bool Active() const;
 
-		delete bmp;
-	}
+		CaptureStats Stats() const;
 
-	inline Sprite::~Sprite() {
-		if(pBuffer) {
-			delete[] pBuffer;
-		}
+	private:
+		std::string pPath;
+		vu2d pSize;
+		CaptureFormat pFormat = CaptureFormat::Y4M;
+		ImageFormat pImageFormat = ImageFormat::PNG;
 
-		if(pBufferId != 0xFFFFFFFF) {
-			pDeleteTexture();
-		}
-	}
+		std::vector<std::vector<Pixel>> pBuffers;
+		std::vector<uint32_t> pFree;
+		std::vector<uint32_t> pReady;
+		std::vector<uint64_t> pFrameNumbers;
+		size_t pReadyHead = 0;
+		size_t pReadyCount = 0;
 
-	inline void pixel::Sprite::Update() {
-		if(pBufferId != 0xFFFFFFFF) {
-			pDeleteTexture();
-		}
+		std::thread pThread;
+		mutable std::mutex pMutex;
+		std::condition_variable pWake;
+		bool pStop = false;
+		bool pActive = false;
 
-		pCreateTexture();
-		pApplyTexture();
-		pUploadTexture();
-	}
+		std::ofstream pFile;
+		ImageEncoder pEncoder;
+		std::vector<uint8_t> pPlanes;
 
-	inline void Sprite::pCreateTexture() {
-		glGenTextures(1, &pBufferId);
-		glBindTexture(GL_TEXTURE_2D, pBufferId);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-	}
+		CaptureStats pStats;
+		double pTotalCopyTime = 0.0;
 
-	inline void Sprite::pDeleteTexture() {
-		glDeleteTextures(1, &pBufferId);
-	}
+	private:
+		void pEncoderThread();
+		bool pWrite(const Pixel* frame, uint64_t number);
+	};
 
-	inline void Sprite::pUploadTexture() {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pSize.x, pSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pBuffer);
-	}
+	class FrameStream {
 
-	inline void Sprite::pApplyTexture() {
-		glBindTexture(GL_TEXTURE_2D, pBufferId);
-	}
+	public:
+		FrameStream() {}
+		~FrameStream();
 
-	LRESULT Application::pWinProc(UINT uMsg, WPARAM wParam, LPARAM lParam) {
-		switch(uMsg) {
-			case WM_CLOSE:
-			{
-				pDestroyDevice();
-				DestroyWindow(pHwnd);
-				return 0;
-			}
-			case WM_DESTROY:
-			{
-				pShouldExist = false;
-				PostQuitMessage(0);
-				return 0;
-			}
-			case WM_MOUSEWHEEL:
-			{
-				pMouseWheel += GET_WHEEL_DELTA_WPARAM(wParam);
-				return 0;
-			}
-			case WM_MOUSEMOVE:
-			{
-				uint16_t x = lParam & 0xFFFF; uint16_t y = (lParam >> 16) & 0xFFFF;
-				int16_t ix = *(int16_t*) &x;   int16_t iy = *(int16_t*) &y;
+		FrameStream(const FrameStream& other) = delete;
+		FrameStream& operator=(const FrameStream& other) = delete;
 
-				x -= pViewPos.x;
-				y -= pViewPos.y;
+	public:
+		void Start(const std::string& name, const vu2d& size, uint32_t tileSize = 32);
+		void Stop();
 
-				pMousePos.x = (int32_t) (((float) x / (float) (pWindowSize.x - (pViewPos.x * 2)) * (float) pScreenSize.x));
-				pMousePos.y = (int32_t) (((float) y / (float) (pWindowSize.y - (pViewPos.y * 2)) * (float) pScreenSize.y));
+		bool Submit(const Pixel* frame);
+		bool Active() const;
 
-				if(pMousePos.x >= (int32_t) pScreenSize.x)	pMousePos.x = pScreenSize.x - 1;
-				if(pMousePos.y >= (int32_t) pScreenSize.y) pMousePos.y = pScreenSize.y - 1;
-				if(pMousePos.x < 0) pMousePos.x = 0;
-				if(pMousePos.y < 0) pMousePos.y = 0;
+		StreamStats Stats() const;
 
-				return 0;
-			}
-			case WM_SIZE:
-			{
-				uint32_t x = lParam & 0xFFFF;
-				uint32_t y = (lParam >> 16) & 0xFFFF;
+	private:
+		vu2d pSize;
+		uint32_t pTileSize = 32;
+		vu2d pTiles;
+
+		std::vector<Pixel> pSent;
+		std::vector<std::vector<uint8_t>> pRows;
+		std::vector<size_t> pRowBytes;
+		std::vector<uint32_t> pRowTiles;
+		std::vector<uint8_t> pPacket;
+		size_t pPacketBytes = 0;
+
+		HANDLE pPipe = INVALID_HANDLE_VALUE;
+		HANDLE pIoEvent = NULL;
+		HANDLE pStopEvent = NULL;
+
+		std::thread pThread;
+		mutable std::mutex pMutex;
+		std::condition_variable pWake;
+		bool pStop = false;
+		bool pActive = false;
+		bool pBusy = false;
+		bool pKeyframe = true;
+
+		StreamStats pStats;
 
-				pWindowSize.x = x;
-				pWindowSize.y = y;
+	private:
+		void pWriterThread();
+		bool pWait(OVERLAPPED& overlapped, DWORD& transferred);
+	};
 
-				pUpdateViewport();
+	bool ApplyStreamFrame(const StreamHeader& header, const uint8_t* payload, Pixel* frame);
 
-				return 0;
-			}
-			case WM_KEYDOWN:
-			{
-				pKeyboardKeysNew[pKeyMap[wParam]] = true;
-				return 0;
-			}
-			case WM_KEYUP:
-			{
-				pKeyboardKeysNew[pKeyMap[wParam]] = false;
-				return 0;
-			}
-			case WM_LBUTTONDOWN:
-			{
-				pMouseButtonsNew[0] = true;
-				return 0;
-			}
-			case WM_LBUTTONUP:
-			{
-				pMouseButtonsNew[0] = false;
-				return 0;
-			}
-			case WM_RBUTTONDOWN:
-			{
-				pMouseButtonsNew[1] = true;
-				return 0;
-			}
-			case WM_RBUTTONUP:
-			{
-				pMouseButtonsNew[1] = false;
-				return 0;
-			}
-			case WM_MBUTTONDOWN:
-			{
-				pMouseButtonsNew[2] = true;
-				return 0;
-			}
-			case WM_MBUTTONUP:
-			{
-				pMouseButtonsNew[2] = false;
-				return 0;
-			}
-			default:
-				return DefWindowProcW(pHwnd, uMsg, wParam, lParam);
-		}
-	}
+	class SessionRecorder {
 
-	inline void Application::EngineThread() {
-		pCreateDevice();
+	public:
+		SessionRecorder() {}
+		~SessionRecorder();
 
-		glEnable(GL_TEXTURE_2D);
-		glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
+		SessionRecorder(const SessionRecorder& other) = delete;
+		SessionRecorder& operator=(const SessionRecorder& other) = delete;
 
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	public:
+		void Start(const std::string& path, const vu2d& size, bool hashFrames = true);
+		void Stop();
 
-		glViewport(pViewPos.x, pViewPos.y, pViewSize.x, pViewSize.y);
+		void RecordInput(float elapsed, const bool* keys, const bool* buttons, const vu2d& mouse, uint32_t wheel);
+		void RecordFrame(const Pixel* frame);
 
-		pMapKeyboard();
+		bool Active() const;
+		bool Sampled() const;
+		bool HashesFrames() const;
+		uint64_t Frames() const;
 
-		pClock1 = std::chrono::system_clock::now();
-		pClock2 = std::chrono::system_clock::now();
+	private:
+		std::ofstream pFile;
+		std::vector<uint8_t> pRecord;
 
-		glGenTextures(1, &pBufferId);
-		glBindTexture(GL_TEXTURE_2D, pBufferId);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+		bool pActive = false;
+		bool pSampled = false;
+		bool pHashFrames = true;
+		uint64_t pFrames = 0;
+		vu2d pSize;
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pScreenSize.x, pScreenSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pBuffer);
+		bool pInput[259] = {};
+		vu2d pMouse;
+		uint32_t pWheel = 0;
+	};
 
-		pShouldExist = OnCreate();
+	class SessionPlayer {
 
-		while(pShouldExist) {
-			Update();
-		}
-	}
+	public:
+		SessionPlayer() {}
 
-	LRESULT CALLBACK Application::pStaticWinProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
-		Application* window = nullptr;
+		SessionPlayer(const SessionPlayer& other) = delete;
+		SessionPlayer& operator=(const SessionPlayer& other) = delete;
 
-		if(uMsg == WM_NCCREATE) {
-			window = static_cast<Application*>(reinterpret_cast<LPCREATESTRUCT>(lParam)->lpCreateParams);
-			window->pHwnd = hWnd;
+	public:
+		void Start(const std::string& path, const vu2d& size, ReplaySpeed speed = ReplaySpeed::UNLIMITED);
+		void Stop();
 
-			SetWindowLongPtr(hWnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(window));
+		float NextElapsed() const;
+		void ReadInput(float& elapsed, bool* keys, bool* buttons, vu2d& mouse, uint32_t& wheel);
+		void EndFrame(double frameTime, const Pixel* frame);
 
-		} else {
-			window = reinterpret_cast<Application*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
-		}
+		bool Active() const;
+		bool Sampled() const;
+		bool Finished() const;
+		bool VerifiesFrames() const;
+		ReplaySpeed Speed() const;
 
-		if(window) {
-			return window->pWinProc(uMsg, wParam, lParam);
-		}
+		ReplayStats Stats() const;
 
-		return DefWindowProc(hWnd, uMsg, wParam, lParam);
-	}
+	private:
+		std::vector<uint8_t> pData;
+		size_t pCursor = 0;
+
+		std::atomic_bool pActive = false;
+		bool pSampled = false;
+		ReplaySpeed pSpeed = ReplaySpeed::UNLIMITED;
+		bool pHashFrames = false;
+		uint64_t pHash = 0;
+		vu2d pSize;
 
-	void Application::pUpdateViewport() {
+		std::vector<float> pTimes;
+		ReplayStats pStats;
 
-		int32_t ww = pScreenSize.x * pScale;
-		int32_t wh = pScreenSize.y * pScale;
-		float wasp = (float) ww / (float) wh;
+	private:
+		size_t pSkipRecord(size_t cursor) const;
+	};
 
-		pViewSize.x = (int32_t) pWindowSize.x;
-		pViewSize.y = (int32_t) ((float) pViewSize.x / wasp);
+	class Sprite {
 
-		if(pViewSize.y > pWindowSize.y) {
-			pViewSize.y = pWindowSize.y;
-			pViewSize.x = (int32_t) ((float) pViewSize.y * wasp);
-		}
+	public:
+		Sprite(const std::string& filename, SpriteFilter filter = SpriteFilter::NEAREST);
+		Sprite(const vu2d& size, SpriteFilter filter = SpriteFilter::NEAREST);
+		~Sprite();
 
-		pViewPos = (pWindowSize - pViewSize) / 2;
-	}
+		friend class Application;
+		friend class TileMap;
+		friend class CollisionMask;
+		friend class SpriteCache;
+		friend class SpriteSheet;
 
-	inline bool Application::ShouldExist() const {
-		return pShouldExist;
-	}
-	inline pixel::DrawingMode Application::DrawingMode() const {
-		return pDrawingMode;
-	}
+		friend bool ApplyStreamFrame(const StreamHeader& header, const uint8_t* payload, Sprite* frame);
 
-	inline vu2d Application::DrawableSize() const {
-		return pScreenSize - 1;
-	}
-	inline vu2d Application::ScreenSize() const {
-		return pScreenSize;
-	}
+	public:
+		void Update();
+		void BuildRle();
+		void SetFilter(SpriteFilter filter);
 
-	inline vu2d Application::WindowSize() const {
-		return pWindowSize;
-	}
-	inline vu2d Application::WindowPos() const {
-		return pWindowPos;
-	}
+		vu2d Size() const;
+		bool HasRle() const;
+		const RleStats& Rle() const;
 
-	inline vu2d Application::MousePos() const {
-		return pMousePos;
-	}
-	inline uint32_t Application::MouseWheel() const {
-		return pMouseWheel;
-	}
+		SpriteFilter Filter() const;
+		const MipStats& Mips() const;
 
-	inline Button Application::MouseLeft() const {
-		return pMouseButtons[0];
-	}
-	inline Button Application::MouseRight() const {
-		return pMouseButtons[1];
-	}
-	inline Button Application::MouseMiddle() const {
-		return pMouseButtons[2];
-	}
+		bool HasCpuCopy() const;
+		void ReleaseCpuCopy();
 
-	inline Button Application::KeyboardKey(Key key) const {
-		return pKeyboardKeys[(uint8_t) key];
-	}
+		size_t CpuBytes() const;
+		size_t GpuBytes() const;
 
-	inline float Application::ElapsedTime() const {
-		return pElapsedTime;
-	}
-	inline uint32_t Application::FPS() const {
-		return pFrameRate;
-	}
+		void Save(const std::string& filename, ImageFormat format = ImageFormat::PNG, bool fast = true) const;
 
-	void Application::pCreateWindow() {
+	private:
+		vu2d pSize;
+		vf2d pUvScale = vf2d(1.0f, 1.0f);
 
-		WNDCLASS wc;
+		Pixel* pBuffer = nullptr;
+		uint32_t pBufferId = 0xFFFFFFFF;
+		bool pDirty = false;
+		bool pQueued = false;
+		uint64_t pVersion = 0;
 
-		wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);
-		wc.hCursor = LoadCursor(NULL, IDC_ARROW);
-		wc.style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC;
+	private:
+		enum class RunKind: uint8_t {
+			SKIP, COPY, BLEND
+		};
 
-		wc.hInstance = GetModuleHandle(nullptr);
-		wc.lpfnWndProc = pStaticWinProc;
+		struct Run {
+			RunKind kind;
+			uint16_t length;
+		};
 
-		wc.cbClsExtra = 0;
-		wc.cbWndExtra = 0;
+		std::vector<uint32_t> pRleRows;
+		std::vector<Run> pRleRuns;
+		std::vector<Pixel> pRlePixels;
+		std::vector<uint32_t> pRlePixelRows;
+		RleStats pRleStats;
 
-		wc.lpszMenuName = nullptr;
-		wc.hbrBackground = nullptr;
+	private:
+		struct MipLevel {
+			vu2d size;
+			size_t offset;
+		};
 
-		wc.lpszClassName = L"pixel_window_class";
+		SpriteFilter pFilter = SpriteFilter::NEAREST;
+		std::vector<Pixel> pMipData;
+		std::vector<MipLevel> pMipLevels;
+		MipStats pMipStats;
 
-		RegisterClassW(&wc);
+	private:
+		void pCreateTexture();
+		void pDeleteTexture();
+		void pUploadTexture();
+		void pApplyTexture();
+		void pRefreshTexture();
+		void pMarkDirty();
 
-		DWORD extendedStyle = WS_EX_APPWINDOW | WS_EX_WINDOWEDGE;
-		DWORD style = WS_CAPTION | WS_SYSMENU | WS_VISIBLE | WS_THICKFRAME;
+		void pBlitRaw(Pixel* dst, uint32_t stride, int32_t sx, int32_t sy, int32_t w, int32_t h, DrawingMode mode) const;
+		void pBlitRle(Pixel* dst, uint32_t stride, int32_t sx, int32_t sy, int32_t w, int32_t h, DrawingMode mode) const;
 
-		vu2d topLeft = pWindowPos;
+		void pBuildMips();
+		const Pixel* pLevel(uint32_t level, vu2d& size) const;
+		Pixel pSampleBilinear(const Pixel* data, const vu2d& size, int32_t fx, int32_t fy) const;
+	};
 
-		if(pFullScreen) {
-			extendedStyle = 0;
-			style = WS_VISIBLE | WS_POPUP;
+	bool ApplyStreamFrame(const StreamHeader& header, const uint8_t* payload, Sprite* frame);
 
-			HMONITOR hmon = MonitorFromWindow(pHwnd, MONITOR_DEFAULTTONEAREST);
+	class CollisionMask {
+
+	public:
+		CollisionMask() = default;
+		CollisionMask(const Sprite* sprite, uint8_t threshold = 128);
+		CollisionMask(const Sprite* sprite, const vi2d& spos, const vi2d& ssize, uint8_t threshold = 128);
+
+	public:
+		vu2d Size() const;
+		bool Empty() const;
+		bool Test(const vi2d& pos) const;
+
+		bool Overlaps(const CollisionMask& other, const vi2d& offset) const;
+		uint32_t OverlapArea(const CollisionMask& other, const vi2d& offset) const;
+
+	private:
+		vu2d pSize;
+		uint32_t pWords = 0;
+		std::vector<uint64_t> pBits;
+
+		vi2d pMin;
+		vi2d pMax = vi2d(-1, -1);
+
+	private:
+		uint64_t pWord(int32_t y, int32_t bit) const;
+		template<bool Count> uint32_t pOverlap(const CollisionMask& other, const vi2d& offset) const;
+	};
+
+	struct SpriteCacheStats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		uint64_t releases = 0;
+
+		uint32_t resident = 0;
+		size_t cpuBytes = 0;
+		size_t gpuBytes = 0;
+
+		inline float HitRate() const {
+			return hits + misses ? float(hits) / float(hits + misses) : 0.0f;
+		}
+	};
+
+	class SpriteCache {
+
+	public:
+		SpriteCache(size_t cpuBudget = SIZE_MAX, size_t gpuBudget = SIZE_MAX);
+
+		SpriteCache(const SpriteCache& other) = delete;
+		SpriteCache& operator=(const SpriteCache& other) = delete;
+
+	public:
+		std::shared_ptr<Sprite> Load(const std::string& filename, SpriteFilter filter = SpriteFilter::NEAREST, bool keepCpuCopy = true);
+
+		void SetBudget(size_t cpuBudget, size_t gpuBudget);
+		void Trim();
+		void Clear();
+
+		SpriteCacheStats Stats() const;
+
+	private:
+		struct Entry {
+			std::string key;
+			std::shared_ptr<Sprite> sprite;
+		};
+
+		std::list<Entry> pEntries;
+		std::unordered_map<std::string, std::list<Entry>::iterator> pIndex;
+
+		size_t pCpuBudget;
+		size_t pGpuBudget;
+
+		SpriteCacheStats pStats;
+
+	private:
+		void pEnforce();
+		void pEvict(std::list<Entry>::iterator it);
+	};
+
+	class SpriteSheet {
+
+	public:
+		SpriteSheet(Sprite* sprite, const vu2d& frameSize, const vu2d& spacing = vu2d(0, 0), const vu2d& margin = vu2d(0, 0));
+		SpriteSheet(Sprite* sprite, const vi2d* spos, const vi2d* ssize, uint32_t count);
+
+		friend class Application;
+		friend class Animator;
+
+	public:
+		uint32_t AddClip(uint32_t first, uint32_t count, float fps, bool loop = true);
+
+		Sprite* Source() const;
+		uint32_t Frames() const;
+		uint32_t Clips() const;
+		vu2d FrameSize(uint32_t frame) const;
+
+	private:
+		struct Frame {
+			vf2d uv1;
+			vf2d uv2;
+			vf2d size;
+		};
+
+		struct Clip {
+			uint32_t first;
+			uint32_t count;
+			float frameTime;
+			float duration;
+			bool loop;
+		};
+
+		Sprite* pSprite;
+		std::vector<Frame> pFrames;
+		std::vector<Clip> pClips;
+
+	private:
+		void pAddFrame(const vi2d& spos, const vi2d& ssize);
+	};
+
+	class Animator {
+
+	public:
+		typedef uint32_t Instance;
+
+	public:
+		Animator(const SpriteSheet* sheet);
+
+		friend class Application;
+
+	public:
+		Instance Add(const vf2d& pos, uint32_t clip, float speed = 1.0f, const Pixel& tint = White);
+		void Remove(Instance instance);
+		void Clear();
+
+		void SetPosition(Instance instance, const vf2d& pos);
+		void SetClip(Instance instance, uint32_t clip, bool restart = true);
+		void SetSpeed(Instance instance, float speed);
+		void SetTint(Instance instance, const Pixel& tint);
+
+		uint32_t Frame(Instance instance) const;
+		bool Finished(Instance instance) const;
+
+		uint32_t Size() const;
+		const SpriteSheet* Sheet() const;
+
+		void Update(float et);
+
+	private:
+		const SpriteSheet* pSheet;
+
+		std::vector<float> pX;
+		std::vector<float> pY;
+		std::vector<float> pTime;
+		std::vector<float> pSpeed;
+		std::vector<uint32_t> pClip;
+		std::vector<uint32_t> pFrame;
+		std::vector<Pixel> pTint;
+
+		std::vector<Instance> pOwner;
+		std::vector<uint32_t> pSlot;
+		std::vector<Instance> pFree;
+
+	private:
+		uint32_t pIndex(Instance instance) const;
+	};
+
+	class TileMap {
+
+	public:
+		TileMap(const vu2d& size, const vu2d& tileSize, Sprite* tileset, uint32_t layers = 1);
+
+		friend class Application;
+
+	public:
+		static constexpr uint16_t EMPTY_TILE = 0xFFFF;
+
+		void SetTile(uint32_t layer, const vu2d& pos, uint16_t tile);
+		uint16_t GetTile(uint32_t layer, const vu2d& pos) const;
+
+		void SetStatic(uint32_t layer, bool isStatic);
+
+		vu2d Size() const;
+		vu2d TileSize() const;
+		uint32_t Layers() const;
+
+	private:
+		static constexpr uint32_t pChunkTiles = 16;
+		static constexpr uint64_t pCacheFrames = 120;
+
+		struct Chunk {
+			uint16_t tiles[pChunkTiles * pChunkTiles];
+			uint16_t filled[pChunkTiles] = {};
+			uint32_t count = 0;
+
+			bool dirty = true;
+			bool opaque = false;
+			uint64_t lastFrame = 0;
+
+			std::unique_ptr<Pixel[]> cache;
+		};
+
+		struct Layer {
+			std::vector<Chunk> chunks;
+			bool isStatic = true;
+		};
+
+		vu2d pSize;
+		vu2d pTileSize;
+		vu2d pChunks;
+		vu2d pChunkPixels;
+
+		Sprite* pTileset = nullptr;
+		uint32_t pTilesetColumns = 1;
+		uint64_t pTilesetVersion = 0;
+
+		std::vector<Layer> pLayers;
+		std::vector<Chunk*> pCached;
+
+	private:
+		void pBuildCache(Chunk& chunk);
+		void pCheckTileset();
+		void pEvictCaches(uint64_t frame);
+	};
+
+	class PostEffect {
+
+	public:
+		virtual ~PostEffect() = default;
+
+	public:
+		virtual void Apply(const Pixel* src, Pixel* dst, const vu2d& size) = 0;
+	};
+
+	class BlurEffect: public PostEffect {
+
+	public:
+		BlurEffect(uint32_t radius, uint32_t passes = 2);
+
+	public:
+		void Set(uint32_t radius, uint32_t passes);
+		void Apply(const Pixel* src, Pixel* dst, const vu2d& size) override;
+
+	private:
+		uint32_t pRadius;
+		uint32_t pPasses;
+
+		std::vector<Pixel> pScratch;
+	};
+
+	class BloomEffect: public PostEffect {
+
+	public:
+		BloomEffect(uint8_t threshold = 192, uint32_t radius = 8, float intensity = 1.0f);
+
+	public:
+		void Set(uint8_t threshold, uint32_t radius, float intensity);
+		void Apply(const Pixel* src, Pixel* dst, const vu2d& size) override;
+
+	private:
+		uint8_t pThreshold;
+		uint32_t pRadius;
+		uint16_t pIntensity;
+
+		std::vector<Pixel> pBright;
+		std::vector<Pixel> pScratch;
+	};
+
+	class GradeEffect: public PostEffect {
+
+	public:
+		GradeEffect(float brightness = 0.0f, float contrast = 1.0f, float saturation = 1.0f, float gamma = 1.0f, const Pixel& tint = White);
+
+	public:
+		void Set(float brightness, float contrast, float saturation, float gamma, const Pixel& tint);
+		void Apply(const Pixel* src, Pixel* dst, const vu2d& size) override;
+
+	private:
+		uint8_t pCurve[3][256];
+		int32_t pSaturation;
+	};
+
+	class VignetteEffect: public PostEffect {
+
+	public:
+		VignetteEffect(float strength = 0.5f, float radius = 0.5f);
+
+	public:
+		void Set(float strength, float radius);
+		void Apply(const Pixel* src, Pixel* dst, const vu2d& size) override;
+
+	private:
+		uint16_t pWeights[1024];
+		std::vector<float> pColumns;
+	};
+
+	class ScanlineEffect: public PostEffect {
+
+	public:
+		ScanlineEffect(float darkness = 0.3f, uint32_t period = 2);
+
+	public:
+		void Set(float darkness, uint32_t period);
+		void Apply(const Pixel* src, Pixel* dst, const vu2d& size) override;
+
+	private:
+		uint16_t pScale;
+		uint32_t pPeriod;
+	};
+
+	class Application {
+
+	public:
+		Application() {}
+
+	public:
+		void Launch(const vu2d& size, uint8_t scale, const vu2d& position, const std::string& name, DrawingMode mode = DrawingMode::NO_ALPHA, bool fullScreen = false, bool vsync = false, PixelFormat format = PixelFormat::RGBA32);
+
+	public:
+		Application(const Application& other) = delete;
+		Application& operator=(const Application& other) = delete;
+
+	protected:
+		virtual bool OnCreate();
+		virtual bool OnUpdate(float et);
+
+	protected:
+		void Close();
+
+		void SetName(const std::string& name);
+		void SetDrawingMode(pixel::DrawingMode mode);
+
+		void SetPalette(uint8_t index, const Pixel& pixel);
+		void SetPalette(const Pixel* palette, uint32_t count, uint8_t first = 0);
+
+	protected:
+		void Clear(const Pixel& pixel = Black);
+		void Draw(const vu2d& pos, const Pixel& pixel);
+		void DrawLine(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel);
+
+		void DrawLines(const vi2d* points, size_t count, const Pixel& pixel);
+		void DrawLines(const vi2d* points, const Pixel* pixels, size_t count);
+		void DrawPolyline(const vi2d* points, size_t count, const Pixel& pixel, bool closed = false);
+
+		void DrawLines(const vf2d* points, size_t count, float width, const Pixel& pixel);
+		void DrawPolyline(const vf2d* points, size_t count, float width, const Pixel& pixel, LineJoin join = LineJoin::MITER, bool closed = false);
+
+		void DrawPoints(const vi2d* points, size_t count, const Pixel& pixel, bool sortRows = false, bool parallel = false);
+		void DrawPoints(const vi2d* points, const Pixel* pixels, size_t count, bool sortRows = false, bool parallel = false);
+		void DrawPoints(const int32_t* xs, const int32_t* ys, size_t count, const Pixel& pixel, bool sortRows = false, bool parallel = false);
+		void DrawPoints(const int32_t* xs, const int32_t* ys, const Pixel* pixels, size_t count, bool sortRows = false, bool parallel = false);
+
+		void DrawCircle(const vu2d& pos, uint32_t radius, const Pixel& pixel);
+		void FillCircle(const vu2d& pos, uint32_t radius, const Pixel& pixel);
+		void FillCircleLinear(const vu2d& pos, uint32_t radius, const vf2d& from, const vf2d& to, const Pixel& start, const Pixel& end);
+		void FillCircleRadial(const vu2d& pos, uint32_t radius, const Pixel& inner, const Pixel& outer);
+
+		void DrawEllipse(const vu2d& pos, const vu2d& radius, const Pixel& pixel);
+		void FillEllipse(const vu2d& pos, const vu2d& radius, const Pixel& pixel);
+
+		void DrawArc(const vu2d& pos, uint32_t radius, float start, float end, const Pixel& pixel);
+		void FillPie(const vu2d& pos, uint32_t radius, float start, float end, const Pixel& pixel);
+
+		void DrawRect(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel);
+		void FillRect(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel);
+		void FillRectGradient(const vu2d& pos1, const vu2d& pos2, const Pixel& topLeft, const Pixel& topRight, const Pixel& bottomLeft, const Pixel& bottomRight);
+		void FillRectLinear(const vu2d& pos1, const vu2d& pos2, const vf2d& from, const vf2d& to, const Pixel& start, const Pixel& end);
+		void FillRectRadial(const vu2d& pos1, const vu2d& pos2, const vf2d& center, float radius, const Pixel& inner, const Pixel& outer);
+
+		void DrawRoundedRect(const vu2d& pos1, const vu2d& pos2, uint32_t radius, const Pixel& pixel);
+		void FillRoundedRect(const vu2d& pos1, const vu2d& pos2, uint32_t radius, const Pixel& pixel);
+
+		void DrawTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel);
+		void FillTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel);
+		void FillTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel1, const Pixel& pixel2, const Pixel& pixel3);
+
+		void PresentTo(Pixel* dst);
+		void PresentTo(Pixel* dst, const vu2d& dstSize);
+
+		void SaveFrame(const std::string& filename, ImageFormat format = ImageFormat::PNG, bool fast = true);
+
+		void StartCapture(const std::string& path, CaptureFormat format = CaptureFormat::Y4M, uint32_t fps = 60, uint32_t buffers = 4, ImageFormat imageFormat = ImageFormat::PNG);
+		void StopCapture();
+
+		void StartStream(const std::string& name, uint32_t tileSize = 32);
+		void StopStream();
+
+		void StartRecording(const std::string& path, bool hashFrames = true);
+		void StopRecording();
+
+		void StartReplay(const std::string& path, ReplaySpeed speed = ReplaySpeed::UNLIMITED, bool closeOnEnd = true);
+		void StopReplay();
+
+		void FloodFill(const vu2d& pos, const Pixel& pixel, uint8_t tolerance = 0);
+		void FloodFillRegion(const vu2d& pos, std::vector<Span>& spans, uint8_t tolerance = 0);
+		void FillSpans(const Span* spans, size_t count, const Pixel& pixel);
+
+		void BlitSprite(const vi2d& pos, Sprite* sprite);
+		void BlitPartialSprite(const vi2d& pos, const vi2d& spos, const vi2d& ssize, Sprite* sprite);
+		void BlitScaledSprite(const vf2d& pos, Sprite* sprite, const vf2d& scale);
+
+		void DrawTileMap(TileMap& map, const vi2d& camera);
+		void DrawTileMap(TileMap& map, const vi2d& camera, uint32_t layer);
+
+		void DrawSprite(const vf2d& pos, Sprite* sprite, const vf2d& scale = vf2d(1.0f, 1.0f), const Pixel& tint = White);
+		void DrawPartialSprite(const vf2d& pos, const vf2d& spos, const vf2d& ssize, Sprite* sprite, const vf2d& scale = vf2d(1.0f, 1.0f), const Pixel& tint = White);
+
+		void DrawWarpedSprite(Sprite* sprite, std::array<vf2d, 4>& pos, const Pixel& tint = White);
+		void DrawPartialWarpedSprite(Sprite* sprite, std::array<vf2d, 4>& post, const vf2d& spos, const vf2d& ssize, const Pixel& tint = White);
+
+		void DrawRotatedSprite(const vf2d& pos, Sprite* sprite, float alpha, const vf2d& center = vf2d(0.0f, 0.0f), const vf2d scale = vf2d(1.0f, 1.0f), const Pixel& tint = White);
+		void DrawPartialRotatedSprite(const vf2d& pos, Sprite* sprite, float alpha, const vf2d& spos, const vf2d& ssize, const vf2d& center = vf2d(0.0f, 0.0f), const vf2d scale = vf2d(1.0f, 1.0f), const Pixel& tint = White);
+
+		void DrawAnimator(const Animator& animator, const vf2d& offset = vf2d(0.0f, 0.0f), const vf2d& scale = vf2d(1.0f, 1.0f));
+
+		void AddPostEffect(PostEffect* effect);
+		void RemovePostEffect(PostEffect* effect);
+		void ClearPostEffects();
+
+	protected:
+		bool ShouldExist() const;
+		pixel::DrawingMode DrawingMode() const;
+		pixel::PixelFormat PixelFormat() const;
+		Pixel Palette(uint8_t index) const;
+
+		vu2d DrawableSize() const;
+		vu2d ScreenSize() const;
+
+		vu2d WindowSize() const;
+		vu2d WindowPos() const;
+
+		vu2d MousePos() const;
+		uint32_t MouseWheel() const;
+
+		Button MouseLeft() const;
+		Button MouseRight() const;
+		Button MouseMiddle() const;
+
+		Button KeyboardKey(Key key) const;
+
+		float ElapsedTime() const;
+		uint32_t FPS() const;
+
+		FrameArena& Arena();
+		const FrameStats& Stats() const;
+
+		bool Capturing() const;
+		pixel::CaptureStats CaptureStats() const;
+
+		bool Streaming() const;
+		pixel::StreamStats StreamStats() const;
+
+		bool Recording() const;
+		bool Replaying() const;
+		pixel::ReplayStats ReplayStats() const;
+
+		void SetDrawTarget(Sprite* target = nullptr);
+		Sprite* DrawTarget() const;
+		vu2d DrawTargetSize() const;
+
+		void PushClipRect(const vi2d& pos, const vi2d& size);
+		void PopClipRect();
+		void ClipRect(vi2d& pos, vi2d& size) const;
+
+		void BeginOcclusion();
+		void EndOcclusion();
+		void EndOcclusion(const Pixel& background);
+		bool Occluding() const;
+		pixel::OcclusionStats OcclusionStats() const;
+
+	protected:
+		vu2d pWindowSize;
+		vu2d pWindowPos;
+
+		vu2d pScreenSize;
+		vf2d pInvScreenSize;
+
+		uint8_t pScale;
+
+		vu2d pViewSize;
+		vu2d pViewPos;
+
+	private:
+		std::string pWindowName = "";
+		std::string pWindowTittle = "";
+
+	private:
+		bool pVsync = false;
+		bool pFullScreen = false;
+
+		std::atomic_bool pShouldExist = false;
+
+	private:
+		std::map<size_t, uint8_t> pKeyMap;
+
+		vu2d pMousePos;
+		uint32_t pMouseWheel = 0;
+
+		Button pMouseButtons[3] = {};
+		bool pMouseButtonsOld[3] = {};
+		bool pMouseButtonsNew[3] = {};
+
+		Button pKeyboardKeys[256] = {};
+		bool pKeyboardKeysOld[256] = {};
+		bool pKeyboardKeysNew[256] = {};
+
+	private:
+		std::chrono::system_clock::time_point pClock1;
+		std::chrono::system_clock::time_point pClock2;
+		std::chrono::duration<float> pElapsedTimer;
+
+		float pElapsedTime = 0.0f;
+		float pFrameTimer = 0.0f;
+		uint32_t pFrameCount = 0;
+		uint32_t pFrameRate = 0;
+
+	private:
+		static constexpr uint64_t pWarmupFrames = 120;
+
+		FrameArena pFrameArena;
+		FrameStats pStats;
+		uint64_t pAllocationsMark = 0;
+
+	private:
+		void Update();
+		void pUpdateTittle();
+		void pTrackAllocations();
+		void EngineThread();
+
+		static LRESULT CALLBACK pStaticWinProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+		LRESULT pWinProc(UINT uMsg, WPARAM wParam, LPARAM lParam);
+
+		void pCreateWindow();
+		void pMapKeyboard();
+
+	private:
+		HWND pHwnd = NULL;
+		MSG pMsg = {};
+
+	private:
+		void pCreateDevice();
+		void pDestroyDevice();
+		void pUpdateViewport();
+
+	private:
+		Pixel* pBuffer = nullptr;
+		uint32_t pBufferId = 0xFFFFFFFF;
+
+		struct BatchVertex {
+			float x, y;
+			float u, v;
+			Pixel tint;
+		};
+
+		struct SpriteDraw {
+			Sprite* sprite;
+			vf2d pos[4];
+			vf2d uv[4];
+			float w[4];
+			Pixel tint;
+			SpriteDraw* next;
+
+			BatchVertex* batch;
+			uint32_t quads;
+		};
+
+		SpriteDraw* pSpritesHead = nullptr;
+		SpriteDraw* pSpritesTail = nullptr;
+
+		SpriteDraw* pPushSprite(Sprite* sprite, const Pixel& tint);
+
+		pixel::DrawingMode pDrawingMode = pixel::DrawingMode::NO_ALPHA;
+		pixel::PixelFormat pPixelFormat = pixel::PixelFormat::RGBA32;
+
+		uint8_t* pIndexBuffer = nullptr;
+		uint16_t* p565Buffer = nullptr;
+		Pixel pPalette[256];
+		bool pFrameResolved = false;
+
+		std::vector<PostEffect*> pPostEffects;
+		std::vector<Pixel> pPostBuffers[2];
+		const Pixel* pPostFrame = nullptr;
+
+		void pApplyPostEffects();
+
+		Pixel* pTarget = nullptr;
+		vu2d pTargetSize;
+		pixel::PixelFormat pTargetFormat = pixel::PixelFormat::RGBA32;
+		Sprite* pTargetSprite = nullptr;
+
+		vi2d pClipMin = vi2d(0, 0);
+		vi2d pClipMax = vi2d(INT32_MAX, INT32_MAX);
+
+		struct ClipBox {
+			vi2d min;
+			vi2d max;
+		};
+
+		std::vector<ClipBox> pClipStack;
+
+		// The screen's clip, put aside while a sprite is the target
+		ClipBox pScreenClip;
+		std::vector<ClipBox> pScreenClipStack;
+
+		void pClipBounds(vi2d& min, vi2d& max) const;
+
+		void pDrawSpan(int32_t x1, int32_t x2, int32_t y, const Pixel& pixel);
+		bool pClipBlit(vi2d& pos, vi2d& spos, vi2d& ssize, const vu2d& size) const;
+
+		struct LineSegment {
+			vi2d a;
+			vi2d b;
+			Pixel pixel;
+			bool skipFirst;
+			bool skipLast;
+		};
+
+		template<class S> void pDrawSegments(size_t count, S&& segment);
+
+		std::vector<Span> pStrokeSpans;
+		std::vector<Span> pStrokeSorted;
+		std::vector<uint32_t> pStrokeRows;
+		std::vector<vf2d> pStrokePoints;
+
+		void pStrokePolygon(const vf2d* points, uint32_t count);
+		void pStrokeDisc(const vf2d& centre, float radius);
+		void pStrokeJoin(const vf2d& prev, const vf2d& pos, const vf2d& next, float half, LineJoin join);
+		void pFlushStroke(const Pixel& pixel);
+
+		struct PointRef {
+			uint32_t offset;
+			uint32_t row;
+		};
+
+		struct PointDraw {
+			uint32_t offset;
+			Pixel pixel;
+		};
+
+		std::vector<PointRef> pPointRefs;
+		std::vector<PointDraw> pPointSorted;
+		std::vector<uint32_t> pPointBuckets;
+
+		template<size_t S, class F> void pPointOffsets(const int32_t* xs, const int32_t* ys, size_t begin, size_t end, F&& emit) const;
+		template<class F> void pPointWriter(F&& body);
+		template<size_t S, class C> void pDrawPoints(const int32_t* xs, const int32_t* ys, size_t count, C&& colour, bool sortRows, bool parallel);
+
+		template<class F> void pEllipseRows(int32_t rx, int32_t ry, int32_t top, int32_t bottom, F&& row);
+		void pDrawWedgeSpan(int32_t cx, int32_t y, int32_t dy, int32_t x1, int32_t x2, float start, float sweep, const Pixel& pixel);
+
+		std::vector<uint64_t> pFillMask;
+		std::vector<Span> pFillStack;
+
+		template<class F> void pFloodFill(const vu2d& pos, uint8_t tolerance, F&& emit);
+		template<class R, class F> void pFloodFill(const vu2d& pos, uint8_t tolerance, R&& read, F&& emit);
+		void pWriteSpan(uint32_t offset, uint32_t count, const Pixel& pixel);
+		void pWriteRun(uint32_t offset, uint32_t count, const Pixel& pixel);
+
+		std::vector<Pixel> pShadeRow;
+
+		template<class G> void pWriteShaded(uint32_t offset, uint32_t count, bool opaque, G&& generate);
+		void pWritePixels(uint32_t offset, uint32_t count, const Pixel* src, bool opaque);
+
+		void pGradientSpan(int32_t x1, int32_t x2, int32_t y, const float* from, const float* to);
+		void pLinearSpan(int32_t x1, int32_t x2, int32_t y, const vf2d& from, const vf2d& slope, const Pixel& start, const Pixel& end);
+		void pRadialSpan(int32_t x1, int32_t x2, int32_t y, const vf2d& center, float radius, const Pixel& inner, const Pixel& outer);
+
+		static constexpr uint32_t pCoverageTileRows = 8;
+
+		struct Coverage {
+			bool active = false;
+			uint32_t words = 0;
+			std::vector<uint64_t> bits;
+			std::vector<uint32_t> rowFull;
+			std::vector<uint8_t> tileFull;
+			pixel::OcclusionStats stats;
+		};
+
+		Coverage pCoverage;
+
+		template<class F> void pCoverRuns(int32_t y, int32_t x1, int32_t x2, F&& run) const;
+		void pCover(int32_t y, int32_t x1, int32_t x2);
+		bool pOccluded(int32_t x1, int32_t y1, int32_t x2, int32_t y2);
+		void pWriteCovered(uint32_t offset, uint32_t count, const Pixel& pixel);
+		void pBlitCovered(const Pixel* src, uint32_t srcStride, int32_t dx, int32_t dy, int32_t w, int32_t h, pixel::DrawingMode mode);
+
+		const Pixel* pResolveFrame();
+		void pUploadFrame();
+
+		ImageEncoder pEncoder;
+		FrameCapture pCapture;
+		FrameStream pStream;
+
+		SessionRecorder pRecorder;
+		SessionPlayer pPlayer;
+
+		bool pReplayKeys[256] = {};
+		bool pReplayButtons[3] = {};
+		bool pCloseOnReplayEnd = true;
+
+		HDC pDevideContext = NULL;
+		HGLRC pRenderContext = NULL;
+
+		friend class Scene;
+	};
+
+	struct SceneStats {
+		uint32_t nodes = 0;
+		uint32_t regions = 0;
+		uint32_t redrawn = 0;
+		uint64_t pixels = 0;
+		float renderTime = 0.0f;
+	};
+
+	class Scene {
+
+	public:
+		typedef uint32_t Node;
+
+	public:
+		Node AddRect(const vi2d& pos, const vi2d& size, const Pixel& pixel, bool filled = true, uint32_t radius = 0);
+		Node AddCircle(const vi2d& centre, uint32_t radius, const Pixel& pixel, bool filled = true);
+		Node AddLine(const vi2d& pos1, const vi2d& pos2, const Pixel& pixel, float width = 1.0f);
+		Node AddSprite(const vi2d& pos, Sprite* sprite);
+
+		void Remove(Node node);
+		void Clear();
+
+		void SetPosition(Node node, const vi2d& pos);
+		void SetColour(Node node, const Pixel& pixel);
+		void SetVisible(Node node, bool visible);
+		void Touch(Node node);
+
+		void SetBackground(const Pixel& pixel);
+		void Invalidate();
+
+		void Render(Application& app);
+		const SceneStats& Stats() const;
+
+	private:
+		enum class NodeKind: uint8_t {
+			NONE, RECT, CIRCLE, LINE, SPRITE
+		};
+
+		struct NodeData {
+			NodeKind kind = NodeKind::NONE;
+			vi2d pos1;
+			vi2d pos2;
+			uint32_t radius = 0;
+			float width = 1.0f;
+			bool filled = true;
+			bool visible = true;
+			Pixel pixel;
+			Sprite* sprite = nullptr;
+		};
+
+		struct Box {
+			vi2d min;
+			vi2d max;
+		};
+
+		std::vector<NodeData> pNodes;
+		std::vector<Box> pDirty;
+		std::vector<Box> pRegions;
+		std::vector<uint32_t> pCandidates;
+
+		Pixel pBackground = Black;
+		bool pFull = true;
+		vu2d pScreenSize;
+		SceneStats pStats;
+
+	private:
+		Node pAdd(const NodeData& node);
+		NodeData& pNode(Node node);
+		Box pBounds(const NodeData& node) const;
+		void pMark(const NodeData& node);
+		void pDraw(Application& app, const NodeData& node);
+	};
+}
+
+/*
+____________________________
+
+    Function definitions
+____________________________
+
+*/
+
+namespace pixel {
+
+	inline std::wstring s2ws(const std::string& string) {
+		int count = MultiByteToWideChar(CP_UTF8, 0, string.c_str(), -1, NULL, 0);
+		if(count <= 1) return std::wstring();
+
+		std::wstring wide(count - 1, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, string.c_str(), -1, wide.data(), count);
+
+		return wide;
+	}
+
+	inline uint64_t AllocationCount() {
+	#ifdef PIXEL_TRACK_ALLOCATIONS
+		return allocationCount;
+	#else
+		return 0;
+	#endif
+	}
+
+	inline Pixel BlendPixel(const Pixel& d, const Pixel& pixel) {
+		float a = (float) (pixel.a / 255.0f);
+		float c = 1.0f - a;
+
+		float r = a * (float) pixel.r + c * (float) d.r;
+		float g = a * (float) pixel.g + c * (float) d.g;
+		float b = a * (float) pixel.b + c * (float) d.b;
+
+		return Pixel((uint8_t) r, (uint8_t) g, (uint8_t) b);
+	}
+
+	/*
+		LINEAR_ALPHA blends in linear light. Channels go through a 256 entry
+		table to 16 bit linear values, are mixed with alpha widened to 0..256
+		so the divide is a shift, and come back through a 4096 entry table
+		indexed by the top 12 bits. The inverse table is patched so every
+		sRGB value survives the round trip, which keeps alpha 0 and 255
+		exact. Long constant colour spans fold the blend into three 256 byte
+		tables up front; shorter spans and sprite rows gather eight pixels at
+		a time under AVX2. Every path gives the same result as the scalar one.
+	*/
+
+	inline const SrgbTables& Srgb() {
+		static const SrgbTables tables = [] {
+			SrgbTables t = {};
+
+			for(uint32_t i = 0; i < 256; i++) {
+				double c = i / 255.0;
+				double l = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+				t.toLinear[i] = (uint32_t) (l * 65535.0 + 0.5);
+			}
+
+			for(uint32_t i = 0; i < 4096; i++) {
+				double l = (i + 0.5) / 4096.0;
+				double c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1.0 / 2.4) - 0.055;
+				t.fromLinear[i] = (uint8_t) (std::clamp(c, 0.0, 1.0) * 255.0 + 0.5);
+			}
+
+			for(uint32_t i = 0; i < 256; i++) {
+				t.fromLinear[t.toLinear[i] >> 4] = (uint8_t) i;
+			}
+
+			return t;
+		}();
+
+		return tables;
+	}
+
+	inline Pixel BlendPixelLinear(const Pixel& d, const Pixel& pixel) {
+		const SrgbTables& t = Srgb();
+
+		uint32_t a = pixel.a + (pixel.a >> 7);
+		uint32_t c = 256 - a;
+
+		uint32_t r = (t.toLinear[pixel.r] * a + t.toLinear[d.r] * c) >> 12;
+		uint32_t g = (t.toLinear[pixel.g] * a + t.toLinear[d.g] * c) >> 12;
+		uint32_t b = (t.toLinear[pixel.b] * a + t.toLinear[d.b] * c) >> 12;
+
+		return Pixel(t.fromLinear[r], t.fromLinear[g], t.fromLinear[b]);
+	}
+
+	inline Pixel BlendPixel(const Pixel& d, const Pixel& pixel, DrawingMode mode) {
+		return mode == DrawingMode::LINEAR_ALPHA ? BlendPixelLinear(d, pixel) : BlendPixel(d, pixel);
+	}
+
+	inline void BlendSpanLinear(Pixel* dst, size_t count, const Pixel& pixel) {
+		const SrgbTables& t = Srgb();
+
+		uint32_t a = pixel.a + (pixel.a >> 7);
+		uint32_t c = 256 - a;
+
+		uint32_t sr = t.toLinear[pixel.r] * a;
+		uint32_t sg = t.toLinear[pixel.g] * a;
+		uint32_t sb = t.toLinear[pixel.b] * a;
+
+		size_t i = 0;
+
+		if(count >= 512) {
+			uint8_t lut[3][256];
+
+			for(uint32_t v = 0; v < 256; v++) {
+				uint32_t l = t.toLinear[v] * c;
+
+				lut[0][v] = t.fromLinear[(sr + l) >> 12];
+				lut[1][v] = t.fromLinear[(sg + l) >> 12];
+				lut[2][v] = t.fromLinear[(sb + l) >> 12];
+			}
+
+			for(; i < count; i++) {
+				Pixel& d = dst[i];
+				d = Pixel(lut[0][d.r], lut[1][d.g], lut[2][d.b]);
+			}
+
+			return;
+		}
+
+	#ifdef PIXEL_AVX2
+		const int* lin = reinterpret_cast<const int*>(t.toLinear);
+		const int* srgb = reinterpret_cast<const int*>(t.fromLinear);
+
+		const __m256i bytes = _mm256_set1_epi32(0xFF);
+		const __m256i inverse = _mm256_set1_epi32(c);
+		const __m256i vr = _mm256_set1_epi32(sr), vg = _mm256_set1_epi32(sg), vb = _mm256_set1_epi32(sb);
+		const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+
+		auto channel = [&] (__m256i d, int shift, __m256i s) {
+			__m256i l = _mm256_i32gather_epi32(lin, _mm256_and_si256(_mm256_srli_epi32(d, shift), bytes), 4);
+			__m256i m = _mm256_srli_epi32(_mm256_add_epi32(s, _mm256_mullo_epi32(l, inverse)), 12);
+			return _mm256_and_si256(_mm256_i32gather_epi32(srgb, m, 1), bytes);
+		};
+
+		for(; i + 8 <= count; i += 8) {
+			__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+
+			__m256i r = channel(d, 0, vr);
+			__m256i g = channel(d, 8, vg);
+			__m256i b = channel(d, 16, vb);
+
+			__m256i out = _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)), _mm256_or_si256(_mm256_slli_epi32(b, 16), alpha));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), out);
+		}
+	#endif
+
+		for(; i < count; i++) {
+			Pixel& d = dst[i];
+
+			d = Pixel(t.fromLinear[(sr + t.toLinear[d.r] * c) >> 12],
+					  t.fromLinear[(sg + t.toLinear[d.g] * c) >> 12],
+					  t.fromLinear[(sb + t.toLinear[d.b] * c) >> 12]);
+		}
+	}
+
+	inline void BlendRowLinear(Pixel* dst, const Pixel* src, size_t count) {
+		const SrgbTables& t = Srgb();
+		size_t i = 0;
+
+	#ifdef PIXEL_AVX2
+		const int* lin = reinterpret_cast<const int*>(t.toLinear);
+		const int* srgb = reinterpret_cast<const int*>(t.fromLinear);
+
+		const __m256i bytes = _mm256_set1_epi32(0xFF);
+		const __m256i full = _mm256_set1_epi32(256);
+		const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+
+		for(; i + 8 <= count; i += 8) {
+			__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+
+			__m256i a = _mm256_srli_epi32(s, 24);
+			a = _mm256_add_epi32(a, _mm256_srli_epi32(a, 7));
+			__m256i c = _mm256_sub_epi32(full, a);
+
+			auto channel = [&] (int shift) {
+				__m256i ls = _mm256_i32gather_epi32(lin, _mm256_and_si256(_mm256_srli_epi32(s, shift), bytes), 4);
+				__m256i ld = _mm256_i32gather_epi32(lin, _mm256_and_si256(_mm256_srli_epi32(d, shift), bytes), 4);
+				__m256i m = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(ls, a), _mm256_mullo_epi32(ld, c)), 12);
+				return _mm256_and_si256(_mm256_i32gather_epi32(srgb, m, 1), bytes);
+			};
+
+			__m256i r = channel(0);
+			__m256i g = channel(8);
+			__m256i b = channel(16);
+
+			__m256i out = _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)), _mm256_or_si256(_mm256_slli_epi32(b, 16), alpha));
+
+			// Fully transparent pixels leave the destination untouched, alpha included
+			__m256i skip = _mm256_cmpeq_epi32(_mm256_srli_epi32(s, 24), _mm256_setzero_si256());
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_blendv_epi8(out, d, skip));
+		}
+	#endif
+
+		for(; i < count; i++) {
+			if(src[i].a == 255) dst[i] = src[i];
+			else if(src[i].a) dst[i] = BlendPixelLinear(dst[i], src[i]);
+		}
+	}
+
+	inline void ExpandIndexed(const uint8_t* src, const Pixel* palette, Pixel* dst, size_t count) {
+		size_t i = 0;
+
+	#ifdef PIXEL_AVX2
+		const int* lut = reinterpret_cast<const int*>(palette);
+
+		for(; i + 8 <= count; i += 8) {
+			__m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_i32gather_epi32(lut, idx, 4));
+		}
+	#endif
+
+		for(; i + 4 <= count; i += 4) {
+			dst[i + 0] = palette[src[i + 0]];
+			dst[i + 1] = palette[src[i + 1]];
+			dst[i + 2] = palette[src[i + 2]];
+			dst[i + 3] = palette[src[i + 3]];
+		}
+
+		for(; i < count; i++) {
+			dst[i] = palette[src[i]];
+		}
+	}
+
+	inline void ExpandRGB565(const uint16_t* src, Pixel* dst, size_t count) {
+		size_t i = 0;
+
+	#ifdef PIXEL_SSE2
+		const __m128i m5 = _mm_set1_epi16(0x1F);
+		const __m128i m6 = _mm_set1_epi16(0x3F);
+		const __m128i alpha = _mm_set1_epi16((short) 0xFF00);
+
+		for(; i + 8 <= count; i += 8) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+			__m128i r = _mm_srli_epi16(v, 11);
+			__m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), m6);
+			__m128i b = _mm_and_si128(v, m5);
+
+			r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+			g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+			b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+			__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+			__m128i ba = _mm_or_si128(b, alpha);
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(rg, ba));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(rg, ba));
+		}
+	#endif
+
+		for(; i < count; i++) {
+			dst[i] = UnpackRGB565(src[i]);
+		}
+	}
+
+	/*
+		Writes a span whose channels change linearly, given as 16.16 fixed
+		point values for the first pixel and per pixel steps, rounding bias
+		included. Every channel must stay within 0 to 255 over the span.
+	*/
+
+	inline void GradientSpan(Pixel* dst, size_t count, const int32_t* color, const int32_t* step) {
+		int32_t r = color[0], g = color[1], b = color[2], a = color[3];
+		size_t i = 0;
+
+		// Channels sit at bit 16, so one shift and mask moves each into place
+	#ifdef PIXEL_AVX2
+		if(count >= 8) {
+			auto lanes = [] (int32_t v, int32_t s) {
+				return _mm256_setr_epi32(v, v + s, v + 2 * s, v + 3 * s, v + 4 * s, v + 5 * s, v + 6 * s, v + 7 * s);
+			};
+
+			__m256i vr = lanes(r, step[0]), vg = lanes(g, step[1]), vb = lanes(b, step[2]), va = lanes(a, step[3]);
+
+			const __m256i sr = _mm256_set1_epi32(step[0] * 8), sg = _mm256_set1_epi32(step[1] * 8);
+			const __m256i sb = _mm256_set1_epi32(step[2] * 8), sa = _mm256_set1_epi32(step[3] * 8);
+
+			const __m256i mg = _mm256_set1_epi32(0x0000FF00), mb = _mm256_set1_epi32(0x00FF0000), ma = _mm256_set1_epi32((int) 0xFF000000);
+
+			for(; i + 8 <= count; i += 8) {
+				__m256i rg = _mm256_or_si256(_mm256_srli_epi32(vr, 16), _mm256_and_si256(_mm256_srli_epi32(vg, 8), mg));
+				__m256i ba = _mm256_or_si256(_mm256_and_si256(vb, mb), _mm256_and_si256(_mm256_slli_epi32(va, 8), ma));
+
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(rg, ba));
+
+				vr = _mm256_add_epi32(vr, sr);
+				vg = _mm256_add_epi32(vg, sg);
+				vb = _mm256_add_epi32(vb, sb);
+				va = _mm256_add_epi32(va, sa);
+			}
+		}
+	#elif defined(PIXEL_SSE2)
+		if(count >= 4) {
+			auto lanes = [] (int32_t v, int32_t s) {
+				return _mm_setr_epi32(v, v + s, v + 2 * s, v + 3 * s);
+			};
+
+			__m128i vr = lanes(r, step[0]), vg = lanes(g, step[1]), vb = lanes(b, step[2]), va = lanes(a, step[3]);
+
+			const __m128i sr = _mm_set1_epi32(step[0] * 4), sg = _mm_set1_epi32(step[1] * 4);
+			const __m128i sb = _mm_set1_epi32(step[2] * 4), sa = _mm_set1_epi32(step[3] * 4);
+
+			const __m128i mg = _mm_set1_epi32(0x0000FF00), mb = _mm_set1_epi32(0x00FF0000), ma = _mm_set1_epi32((int) 0xFF000000);
+
+			for(; i + 4 <= count; i += 4) {
+				__m128i rg = _mm_or_si128(_mm_srli_epi32(vr, 16), _mm_and_si128(_mm_srli_epi32(vg, 8), mg));
+				__m128i ba = _mm_or_si128(_mm_and_si128(vb, mb), _mm_and_si128(_mm_slli_epi32(va, 8), ma));
+
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(rg, ba));
+
+				vr = _mm_add_epi32(vr, sr);
+				vg = _mm_add_epi32(vg, sg);
+				vb = _mm_add_epi32(vb, sb);
+				va = _mm_add_epi32(va, sa);
+			}
+		}
+	#endif
+
+		r += step[0] * (int32_t) i;
+		g += step[1] * (int32_t) i;
+		b += step[2] * (int32_t) i;
+		a += step[3] * (int32_t) i;
+
+		for(; i < count; i++) {
+			dst[i].n = (uint32_t) (r >> 16) | ((uint32_t) (g >> 8) & 0xFF00) | ((uint32_t) b & 0xFF0000) | (((uint32_t) a << 8) & 0xFF000000);
+
+			r += step[0];
+			g += step[1];
+			b += step[2];
+			a += step[3];
+		}
+	}
+
+	/*
+		Colour by distance from a centre, dx and dy being the offset of the
+		first pixel. Distance is not linear along a row, so this one works
+		in floats and takes the square roots a vector at a time.
+	*/
+
+	inline void RadialSpan(Pixel* dst, size_t count, float dx, float dy, float invRadius, const Pixel& inner, const Pixel& outer) {
+		float base[4] = { (float) inner.r, (float) inner.g, (float) inner.b, (float) inner.a };
+		float delta[4] = { (float) outer.r - inner.r, (float) outer.g - inner.g, (float) outer.b - inner.b, (float) outer.a - inner.a };
+
+		float dy2 = dy * dy;
+		size_t i = 0;
+
+	#ifdef PIXEL_AVX2
+		__m256 x = _mm256_setr_ps(dx, dx + 1.0f, dx + 2.0f, dx + 3.0f, dx + 4.0f, dx + 5.0f, dx + 6.0f, dx + 7.0f);
+
+		const __m256 eight = _mm256_set1_ps(8.0f), one = _mm256_set1_ps(1.0f);
+		const __m256 vdy2 = _mm256_set1_ps(dy2), inv = _mm256_set1_ps(invRadius);
+
+		const __m256 br = _mm256_set1_ps(base[0]), bg = _mm256_set1_ps(base[1]), bb = _mm256_set1_ps(base[2]), ba = _mm256_set1_ps(base[3]);
+		const __m256 dr = _mm256_set1_ps(delta[0]), dg = _mm256_set1_ps(delta[1]), db = _mm256_set1_ps(delta[2]), da = _mm256_set1_ps(delta[3]);
+
+		for(; i + 8 <= count; i += 8) {
+			__m256 t = _mm256_min_ps(_mm256_mul_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(x, x), vdy2)), inv), one);
+
+			__m256i r = _mm256_cvtps_epi32(_mm256_add_ps(br, _mm256_mul_ps(dr, t)));
+			__m256i g = _mm256_cvtps_epi32(_mm256_add_ps(bg, _mm256_mul_ps(dg, t)));
+			__m256i b = _mm256_cvtps_epi32(_mm256_add_ps(bb, _mm256_mul_ps(db, t)));
+			__m256i a = _mm256_cvtps_epi32(_mm256_add_ps(ba, _mm256_mul_ps(da, t)));
+
+			__m256i rg = _mm256_or_si256(r, _mm256_slli_epi32(g, 8));
+			__m256i bA = _mm256_or_si256(_mm256_slli_epi32(b, 16), _mm256_slli_epi32(a, 24));
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_or_si256(rg, bA));
+			x = _mm256_add_ps(x, eight);
+		}
+
+		dx += (float) i;
+	#elif defined(PIXEL_SSE2)
+		__m128 x = _mm_setr_ps(dx, dx + 1.0f, dx + 2.0f, dx + 3.0f);
+
+		const __m128 four = _mm_set1_ps(4.0f), one = _mm_set1_ps(1.0f);
+		const __m128 vdy2 = _mm_set1_ps(dy2), inv = _mm_set1_ps(invRadius);
+
+		const __m128 br = _mm_set1_ps(base[0]), bg = _mm_set1_ps(base[1]), bb = _mm_set1_ps(base[2]), ba = _mm_set1_ps(base[3]);
+		const __m128 dr = _mm_set1_ps(delta[0]), dg = _mm_set1_ps(delta[1]), db = _mm_set1_ps(delta[2]), da = _mm_set1_ps(delta[3]);
+
+		for(; i + 4 <= count; i += 4) {
+			__m128 t = _mm_min_ps(_mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), vdy2)), inv), one);
+
+			__m128i r = _mm_cvtps_epi32(_mm_add_ps(br, _mm_mul_ps(dr, t)));
+			__m128i g = _mm_cvtps_epi32(_mm_add_ps(bg, _mm_mul_ps(dg, t)));
+			__m128i b = _mm_cvtps_epi32(_mm_add_ps(bb, _mm_mul_ps(db, t)));
+			__m128i a = _mm_cvtps_epi32(_mm_add_ps(ba, _mm_mul_ps(da, t)));
+
+			__m128i rg = _mm_or_si128(r, _mm_slli_epi32(g, 8));
+			__m128i bA = _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24));
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(rg, bA));
+			x = _mm_add_ps(x, four);
+		}
+
+		dx += (float) i;
+	#endif
+
+		for(; i < count; i++, dx += 1.0f) {
+			float t = (std::min)(std::sqrt(dx * dx + dy2) * invRadius, 1.0f);
+
+			dst[i] = Pixel((uint8_t) std::nearbyint(base[0] + delta[0] * t), (uint8_t) std::nearbyint(base[1] + delta[1] * t),
+						   (uint8_t) std::nearbyint(base[2] + delta[2] * t), (uint8_t) std::nearbyint(base[3] + delta[3] * t));
+		}
+	}
+
+	inline Pixel::Pixel() {
+		r = 0; g = 0; b = 0; a = 0xFF;
+	}
+
+	inline Pixel::Pixel(uint32_t p) {
+		n = p;
+	}
+
+	inline Pixel::Pixel(uint8_t red, uint8_t green, uint8_t blue, uint8_t alpha) {
+		n = red | (green << 8) | (blue << 16) | (alpha << 24);
+	}
+
+	/*
+		vf2dArray keeps x and y in separate contiguous arrays so each batch
+		operation is a single pass four lanes at a time. Transform takes a
+		row major 2x3 matrix: x' = m0 x + m1 y + m2, y' = m3 x + m4 y + m5.
+	*/
+
+	inline vf2dArray::vf2dArray(size_t count) {
+		Resize(count);
+	}
+
+	inline size_t vf2dArray::Size() const {
+		return pXs.size();
+	}
+
+	inline void vf2dArray::Resize(size_t count) {
+		pXs.resize(count);
+		pYs.resize(count);
+	}
+
+	inline void vf2dArray::Clear() {
+		pXs.clear();
+		pYs.clear();
+	}
+
+	inline void vf2dArray::Push(const vf2d& v) {
+		pXs.push_back(v.x);
+		pYs.push_back(v.y);
+	}
+
+	inline vf2d vf2dArray::Get(size_t i) const {
+		return vf2d(pXs[i], pYs[i]);
+	}
+
+	inline void vf2dArray::Set(size_t i, const vf2d& v) {
+		pXs[i] = v.x;
+		pYs[i] = v.y;
+	}
+
+	inline float* vf2dArray::Xs() {
+		return pXs.data();
+	}
+
+	inline float* vf2dArray::Ys() {
+		return pYs.data();
+	}
+
+	inline const float* vf2dArray::Xs() const {
+		return pXs.data();
+	}
+
+	inline const float* vf2dArray::Ys() const {
+		return pYs.data();
+	}
+
+	inline void vf2dArray::Add(const vf2d& offset) {
+		Transform({1.0f, 0.0f, offset.x, 0.0f, 1.0f, offset.y});
+	}
+
+	inline void vf2dArray::Add(const vf2dArray& other) {
+		if(other.Size() != Size()) {
+			throw std::runtime_error("Vector array sizes do not match.");
+		}
+
+		float* xs = pXs.data(); float* ys = pYs.data();
+		const float* ox = other.pXs.data(); const float* oy = other.pYs.data();
+
+		size_t i = 0, count = Size();
+
+	#ifdef PIXEL_SSE2
+		for(; i + 4 <= count; i += 4) {
+			_mm_storeu_ps(xs + i, _mm_add_ps(_mm_loadu_ps(xs + i), _mm_loadu_ps(ox + i)));
+			_mm_storeu_ps(ys + i, _mm_add_ps(_mm_loadu_ps(ys + i), _mm_loadu_ps(oy + i)));
+		}
+	#endif
+
+		for(; i < count; i++) {
+			xs[i] += ox[i];
+			ys[i] += oy[i];
+		}
+	}
+
+	inline void vf2dArray::Scale(float factor) {
+		Scale(vf2d(factor, factor));
+	}
+
+	inline void vf2dArray::Scale(const vf2d& factor) {
+		Transform({factor.x, 0.0f, 0.0f, 0.0f, factor.y, 0.0f});
+	}
+
+	inline void vf2dArray::Rotate(float angle, const vf2d& pivot) {
+		float c = std::cos(angle), s = std::sin(angle);
+
+		Transform({c, -s, pivot.x - c * pivot.x + s * pivot.y,
+				   s, c, pivot.y - s * pivot.x - c * pivot.y});
+	}
+
+	inline void vf2dArray::Transform(const float (&m)[6]) {
+		float* xs = pXs.data(); float* ys = pYs.data();
+		size_t i = 0, count = Size();
+
+	#ifdef PIXEL_SSE2
+		const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]);
+		const __m128 m3 = _mm_set1_ps(m[3]), m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]);
+
+		for(; i + 4 <= count; i += 4) {
+			__m128 x = _mm_loadu_ps(xs + i);
+			__m128 y = _mm_loadu_ps(ys + i);
+
+			_mm_storeu_ps(xs + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m1, y)), m2));
+			_mm_storeu_ps(ys + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m3, x), _mm_mul_ps(m4, y)), m5));
+		}
+	#endif
+
+		for(; i < count; i++) {
+			float x = xs[i], y = ys[i];
+
+			xs[i] = m[0] * x + m[1] * y + m[2];
+			ys[i] = m[3] * x + m[4] * y + m[5];
+		}
+	}
+
+	inline void vf2dArray::Length(float* out) const {
+		const float* xs = pXs.data(); const float* ys = pYs.data();
+		size_t i = 0, count = Size();
+
+	#ifdef PIXEL_SSE2
+		for(; i + 4 <= count; i += 4) {
+			__m128 x = _mm_loadu_ps(xs + i);
+			__m128 y = _mm_loadu_ps(ys + i);
+
+			_mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y))));
+		}
+	#endif
+
+		for(; i < count; i++) {
+			out[i] = std::sqrt(xs[i] * xs[i] + ys[i] * ys[i]);
+		}
+	}
+
+	inline void vf2dArray::Normalize() {
+		float* xs = pXs.data(); float* ys = pYs.data();
+		size_t i = 0, count = Size();
+
+	#ifdef PIXEL_SSE2
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+
+		for(; i + 4 <= count; i += 4) {
+			__m128 x = _mm_loadu_ps(xs + i);
+			__m128 y = _mm_loadu_ps(ys + i);
+
+			// Zero length vectors are left alone instead of turning into NaNs
+			__m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+			__m128 nonzero = _mm_cmpgt_ps(l, zero);
+			__m128 inv = _mm_div_ps(one, l);
+
+			_mm_storeu_ps(xs + i, _mm_or_ps(_mm_and_ps(nonzero, _mm_mul_ps(x, inv)), _mm_andnot_ps(nonzero, x)));
+			_mm_storeu_ps(ys + i, _mm_or_ps(_mm_and_ps(nonzero, _mm_mul_ps(y, inv)), _mm_andnot_ps(nonzero, y)));
+		}
+	#endif
+
+		for(; i < count; i++) {
+			float l = std::sqrt(xs[i] * xs[i] + ys[i] * ys[i]);
+
+			if(l > 0.0f) {
+				float inv = 1.0f / l;
+				xs[i] *= inv;
+				ys[i] *= inv;
+			}
+		}
+	}
+
+	inline void vf2dArray::Round(int32_t* outX, int32_t* outY) const {
+		const float* xs = pXs.data(); const float* ys = pYs.data();
+		size_t i = 0, count = Size();
+
+	#ifdef PIXEL_SSE2
+		for(; i + 4 <= count; i += 4) {
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(outX + i), _mm_cvtps_epi32(_mm_loadu_ps(xs + i)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(outY + i), _mm_cvtps_epi32(_mm_loadu_ps(ys + i)));
+		}
+	#endif
+
+		for(; i < count; i++) {
+			outX[i] = (int32_t) std::nearbyint(xs[i]);
+			outY[i] = (int32_t) std::nearbyint(ys[i]);
+		}
+	}
+
+	inline FrameArena::FrameArena(size_t capacity) {
+		pCapacity = capacity;
+		pBuffer = new uint8_t[pCapacity];
+	}
+
+	inline FrameArena::~FrameArena() {
+		Reset();
+		delete[] pBuffer;
+	}
+
+	inline void* FrameArena::Allocate(size_t size, size_t alignment) {
+		uintptr_t base = reinterpret_cast<uintptr_t>(pBuffer);
+		uintptr_t aligned = (base + pOffset + alignment - 1) & ~(uintptr_t) (alignment - 1);
+
+		if(aligned + size <= base + pCapacity) {
+			pOffset = aligned + size - base;
+			return reinterpret_cast<void*>(aligned);
+		}
+
+		// Out of space: serve the request from a separate block for now, Reset()
+		// grows the main buffer so that the next frame fits without overflowing.
+		size_t header = (sizeof(Block) + alignment - 1) & ~(alignment - 1);
+		uint8_t* raw = new uint8_t[header + size + alignment];
+
+		Block* block = reinterpret_cast<Block*>(raw);
+		block->next = pOverflow;
+		pOverflow = block;
+		pOverflowBytes += size + alignment;
+
+		uintptr_t p = reinterpret_cast<uintptr_t>(raw) + header;
+		return reinterpret_cast<void*>((p + alignment - 1) & ~(uintptr_t) (alignment - 1));
+	}
+
+	template<class T> inline T* FrameArena::Allocate(size_t count) {
+		return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	inline void FrameArena::Reset() {
+		pHighWater = (std::max)(pHighWater, pOffset + pOverflowBytes);
+
+		if(pOverflow) {
+			while(pOverflow) {
+				Block* next = pOverflow->next;
+				delete[] reinterpret_cast<uint8_t*>(pOverflow);
+				pOverflow = next;
+			}
+
+			if(pHighWater > pCapacity) {
+				delete[] pBuffer;
+				pCapacity = pHighWater + pHighWater / 2;
+				pBuffer = new uint8_t[pCapacity];
+			}
+
+			pOverflowBytes = 0;
+		}
+
+		pOffset = 0;
+	}
+
+	inline size_t FrameArena::Used() const {
+		return pOffset + pOverflowBytes;
+	}
+
+	inline size_t FrameArena::Capacity() const {
+		return pCapacity;
+	}
+
+	inline size_t FrameArena::HighWater() const {
+		return pHighWater;
+	}
+
+	inline WorkerPool::WorkerPool(uint32_t threads) {
+		if(threads == 0) {
+			threads = (std::max)(std::thread::hardware_concurrency(), 1u) - 1;
+		}
+
+		for(uint32_t i = 0; i < threads; i++) {
+			pThreads.emplace_back(&WorkerPool::pWorkerThread, this);
+		}
+	}
+
+	inline WorkerPool::~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(pMutex);
+			pStop = true;
+		}
+
+		pWake.notify_all();
+
+		for(std::thread& t : pThreads) {
+			t.join();
+		}
+	}
+
+	template<class F> inline void WorkerPool::ParallelFor(uint32_t count, uint32_t grain, F&& fn) {
+		typedef std::remove_reference_t<F> Function;
+
+		pRun(count, grain, const_cast<void*>(static_cast<const void*>(&fn)), [] (void* context, uint32_t begin, uint32_t end) {
+			(*static_cast<Function*>(context))(begin, end);
+		});
+	}
+
+	inline uint32_t WorkerPool::Threads() const {
+		return (uint32_t) pThreads.size() + 1;
+	}
+
+	inline void WorkerPool::pRun(uint32_t count, uint32_t grain, void* context, Task task) {
+		if(count == 0) return;
+		grain = (std::max)(grain, 1u);
+
+		if(pThreads.empty() || count <= grain) {
+			task(context, 0, count);
+			return;
+		}
+
+		std::lock_guard<std::mutex> call(pCallMutex);
+
+		{
+			std::lock_guard<std::mutex> lock(pMutex);
+
+			pTask = task;
+			pContext = context;
+			pCount = count;
+			pGrain = grain;
+			pNext = 0;
+			pFinished = 0;
+			pGeneration++;
+		}
+
+		pWake.notify_all();
+		pWork();
+
+		// Wait for every range to finish and for every worker to have left the
+		// job, so that the next call can safely replace it.
+		std::unique_lock<std::mutex> lock(pMutex);
+		pDone.wait(lock, [this] { return pFinished == pCount && pActive == 0; });
+		pTask = nullptr;
+	}
+
+	inline void WorkerPool::pWork() {
+		for(;;) {
+			uint32_t begin = pNext.fetch_add(pGrain);
+			if(begin >= pCount) return;
+
+			uint32_t end = (std::min)(begin + pGrain, pCount);
+			pTask(pContext, begin, end);
+
+			if(pFinished.fetch_add(end - begin) + (end - begin) == pCount) {
+				std::lock_guard<std::mutex> lock(pMutex);
+				pDone.notify_all();
+			}
+		}
+	}
+
+	inline void WorkerPool::pWorkerThread() {
+		uint64_t generation = 0;
+
+		for(;;) {
+			{
+				std::unique_lock<std::mutex> lock(pMutex);
+				pWake.wait(lock, [&] { return pStop || (pTask && pGeneration != generation); });
+
+				if(pStop) return;
+
+				generation = pGeneration;
+				pActive++;
+			}
+
+			pWork();
+
+			std::lock_guard<std::mutex> lock(pMutex);
+			if(--pActive == 0) pDone.notify_all();
+		}
+	}
+
+	inline WorkerPool& Workers() {
+		static WorkerPool pool;
+		return pool;
+	}
+
+	inline void UpscaleNearest(const Pixel* src, const vu2d& srcSize, Pixel* dst, uint32_t dstStride, uint32_t factor) {
+		if(factor == 0) return;
+
+		Workers().ParallelFor(srcSize.y, 16, [&] (uint32_t begin, uint32_t end) {
+			for(uint32_t y = begin; y < end; y++) {
+				const Pixel* in = src + y * srcSize.x;
+				Pixel* out = dst + y * factor * dstStride;
+				uint32_t x = 0;
+
+			#ifdef PIXEL_SSE2
+				if(factor >= 2 && factor <= 4) {
+					for(; x + 4 <= srcSize.x; x += 4) {
+						__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x));
+						__m128i* o = reinterpret_cast<__m128i*>(out + x * factor);
+
+						if(factor == 2) {
+							_mm_storeu_si128(o + 0, _mm_unpacklo_epi32(v, v));
+							_mm_storeu_si128(o + 1, _mm_unpackhi_epi32(v, v));
+						} else if(factor == 3) {
+							_mm_storeu_si128(o + 0, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+							_mm_storeu_si128(o + 1, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+							_mm_storeu_si128(o + 2, _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+						} else {
+							_mm_storeu_si128(o + 0, _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)));
+							_mm_storeu_si128(o + 1, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)));
+							_mm_storeu_si128(o + 2, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)));
+							_mm_storeu_si128(o + 3, _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)));
+						}
+					}
+				}
+			#endif
+
+				for(; x < srcSize.x; x++) {
+					std::fill_n(out + x * factor, factor, in[x]);
+				}
+
+				for(uint32_t i = 1; i < factor; i++) {
+					memcpy(out + i * dstStride, out, srcSize.x * factor * sizeof(Pixel));
+				}
+			}
+		});
+	}
+
+	inline void UpscaleFit(const Pixel* src, const vu2d& srcSize, Pixel* dst, const vu2d& dstSize, const Pixel& border) {
+		if(!srcSize.x || !srcSize.y || !dstSize.x || !dstSize.y) return;
+
+		uint32_t factor = (std::min)(dstSize.x / srcSize.x, dstSize.y / srcSize.y);
+		vu2d view;
+
+		if(factor && (srcSize.x * factor == dstSize.x || srcSize.y * factor == dstSize.y)) {
+			view = srcSize * factor;
+		} else {
+			float aspect = (float) srcSize.x / (float) srcSize.y;
+			view = vu2d(dstSize.x, (uint32_t) ((float) dstSize.x / aspect));
+
+			if(view.y > dstSize.y) {
+				view.y = dstSize.y;
+				view.x = (uint32_t) ((float) view.y * aspect);
+			}
+
+			factor = 0;
+		}
+
+		vu2d offset = (dstSize - view) / 2;
+
+		if(factor) {
+
+			Workers().ParallelFor(dstSize.y, 64, [&] (uint32_t begin, uint32_t end) {
+				for(uint32_t y = begin; y < end; y++) {
+					if(y < offset.y || y >= offset.y + view.y) {
+						std::fill_n(dst + y * dstSize.x, dstSize.x, border);
+					} else {
+						std::fill_n(dst + y * dstSize.x, offset.x, border);
+						std::fill_n(dst + y * dstSize.x + offset.x + view.x, dstSize.x - offset.x - view.x, border);
+					}
+				}
+			});
+
+			UpscaleNearest(src, srcSize, dst + offset.y * dstSize.x + offset.x, dstSize.x, factor);
+			return;
+		}
+
+		uint32_t stepX = (uint32_t) (((uint64_t) srcSize.x << 16) / view.x);
+		uint32_t stepY = (uint32_t) (((uint64_t) srcSize.y << 16) / view.y);
+
+		Workers().ParallelFor(dstSize.y, 32, [&] (uint32_t begin, uint32_t end) {
+			uint32_t previous = 0xFFFFFFFF;
+
+			for(uint32_t y = begin; y < end; y++) {
+				Pixel* out = dst + y * dstSize.x;
+
+				if(y < offset.y || y >= offset.y + view.y) {
+					std::fill_n(out, dstSize.x, border);
+					continue;
+				}
+
+				uint32_t sy = (uint32_t) (((uint64_t) (y - offset.y) * stepY) >> 16);
+
+				// Consecutive rows that sample the same source row are copies
+				if(sy == previous) {
+					memcpy(out, out - dstSize.x, dstSize.x * sizeof(Pixel));
+					continue;
+				}
+
+				previous = sy;
+
+				const Pixel* in = src + sy * srcSize.x;
+				std::fill_n(out, offset.x, border);
+
+				uint32_t fx = 0;
+				for(uint32_t x = 0; x < view.x; x++, fx += stepX) {
+					out[offset.x + x] = in[fx >> 16];
+				}
+
+				std::fill_n(out + offset.x + view.x, dstSize.x - offset.x - view.x, border);
+			}
+		});
+	}
+
+	/*
+		One box blur pass, horizontal into scratch then vertical into dst,
+		with edges clamped. Both directions keep a running window sum that
+		gains one pixel and loses one per step, so the cost does not depend
+		on the radius. Rows run in parallel for the horizontal half and
+		strips of columns for the vertical one, walking down the rows so
+		every access stays sequential. dst may be the same buffer as src.
+		Repeated passes approach a gaussian.
+	*/
+
+	inline void BoxBlur(const Pixel* src, Pixel* dst, Pixel* scratch, const vu2d& size, uint32_t radius) {
+		const int32_t w = size.x, h = size.y, r = radius;
+		const float inv = 1.0f / float(2 * r + 1);
+
+		if(w == 0 || h == 0) return;
+
+		if(r == 0) {
+			if(dst != src) memcpy(dst, src, (size_t) w * h * sizeof(Pixel));
+			return;
+		}
+
+	#ifdef PIXEL_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128 scale = _mm_set1_ps(inv);
+
+		auto load = [&] (const Pixel& p) {
+			return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int) p.n), zero), zero);
+		};
+
+		auto store = [&] (__m128i sum) {
+			__m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+			v = _mm_packs_epi32(v, v);
+			return (uint32_t) _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+		};
+	#else
+		auto average = [&] (const int32_t* sum) {
+			Pixel p;
+			p.r = (uint8_t) std::nearbyint(sum[0] * inv);
+			p.g = (uint8_t) std::nearbyint(sum[1] * inv);
+			p.b = (uint8_t) std::nearbyint(sum[2] * inv);
+			p.a = (uint8_t) std::nearbyint(sum[3] * inv);
+			return p;
+		};
+	#endif
+
+		Workers().ParallelFor(h, 8, [&] (uint32_t begin, uint32_t end) {
+			// Only the first and last r pixels of a row need clamped reads
+			int32_t lo = (std::min)(r, w), hi = (std::max)(lo, w - r - 1);
+
+			for(uint32_t y = begin; y < end; y++) {
+				const Pixel* in = src + (size_t) y * w;
+				Pixel* out = scratch + (size_t) y * w;
+				int32_t x = 0;
+
+			#ifdef PIXEL_SSE2
+				__m128i sum = zero;
+
+				for(int32_t k = -r; k <= r; k++) {
+					sum = _mm_add_epi32(sum, load(in[(std::min)((std::max)(k, 0), w - 1)]));
+				}
+
+				auto step = [&] (int32_t x, int32_t add, int32_t sub) {
+					out[x].n = store(sum);
+					sum = _mm_add_epi32(sum, _mm_sub_epi32(load(in[add]), load(in[sub])));
+				};
+			#else
+				int32_t sum[4] = {};
+
+				for(int32_t k = -r; k <= r; k++) {
+					const Pixel& p = in[(std::min)((std::max)(k, 0), w - 1)];
+					sum[0] += p.r; sum[1] += p.g; sum[2] += p.b; sum[3] += p.a;
+				}
+
+				auto step = [&] (int32_t x, int32_t add, int32_t sub) {
+					out[x] = average(sum);
+
+					const Pixel& a = in[add];
+					const Pixel& b = in[sub];
+					sum[0] += a.r - b.r; sum[1] += a.g - b.g; sum[2] += a.b - b.b; sum[3] += a.a - b.a;
+				};
+			#endif
+
+				for(; x < lo; x++) step(x, (std::min)(x + r + 1, w - 1), (std::max)(x - r, 0));
+				for(; x < hi; x++) step(x, x + r + 1, x - r);
+				for(; x < w; x++) step(x, (std::min)(x + r + 1, w - 1), (std::max)(x - r, 0));
+			}
+		});
+
+		// Bands of rows each restart the window, so the sums for a whole row
+		// stay in cache and every row is read front to back.
+		int32_t band = (std::max)(64, 4 * r);
+
+		Workers().ParallelFor((h + band - 1) / band, 1, [&] (uint32_t begin, uint32_t end) {
+			thread_local std::vector<int32_t> sums;
+
+			for(uint32_t b = begin; b < end; b++) {
+				int32_t y1 = b * band, y2 = (std::min)(y1 + band, h);
+				sums.assign((size_t) w * 4, 0);
+
+				for(int32_t k = y1 - r; k <= y1 + r; k++) {
+					const Pixel* in = scratch + (size_t) (std::min)((std::max)(k, 0), h - 1) * w;
+
+					for(int32_t x = 0; x < w; x++) {
+						sums[x * 4 + 0] += in[x].r; sums[x * 4 + 1] += in[x].g;
+						sums[x * 4 + 2] += in[x].b; sums[x * 4 + 3] += in[x].a;
+					}
+				}
+
+				for(int32_t y = y1; y < y2; y++) {
+					const Pixel* add = scratch + (size_t) (std::min)(y + r + 1, h - 1) * w;
+					const Pixel* sub = scratch + (size_t) (std::max)(y - r, 0) * w;
+					Pixel* out = dst + (size_t) y * w;
+					int32_t* sum = sums.data();
+					int32_t x = 0;
+
+				#ifdef PIXEL_SSE2
+					for(; x + 4 <= w; x += 4, sum += 16) {
+						__m128i* s = reinterpret_cast<__m128i*>(sum);
+						__m128i s0 = _mm_loadu_si128(s + 0), s1 = _mm_loadu_si128(s + 1);
+						__m128i s2 = _mm_loadu_si128(s + 2), s3 = _mm_loadu_si128(s + 3);
+
+						auto average4 = [&] (__m128i v) {
+							return _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+						};
+
+						__m128i lo16 = _mm_packs_epi32(average4(s0), average4(s1));
+						__m128i hi16 = _mm_packs_epi32(average4(s2), average4(s3));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(lo16, hi16));
+
+						__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + x));
+						__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sub + x));
+						__m128i al = _mm_unpacklo_epi8(a, zero), ah = _mm_unpackhi_epi8(a, zero);
+						__m128i dl = _mm_unpacklo_epi8(d, zero), dh = _mm_unpackhi_epi8(d, zero);
+
+						// 16 bit differences widened with their sign
+						__m128i l = _mm_sub_epi16(al, dl), h = _mm_sub_epi16(ah, dh);
+						__m128i ls = _mm_srai_epi16(l, 15), hs = _mm_srai_epi16(h, 15);
+
+						_mm_storeu_si128(s + 0, _mm_add_epi32(s0, _mm_unpacklo_epi16(l, ls)));
+						_mm_storeu_si128(s + 1, _mm_add_epi32(s1, _mm_unpackhi_epi16(l, ls)));
+						_mm_storeu_si128(s + 2, _mm_add_epi32(s2, _mm_unpacklo_epi16(h, hs)));
+						_mm_storeu_si128(s + 3, _mm_add_epi32(s3, _mm_unpackhi_epi16(h, hs)));
+					}
+
+					for(; x < w; x++, sum += 4) {
+						__m128i* s = reinterpret_cast<__m128i*>(sum);
+						out[x].n = store(_mm_loadu_si128(s));
+						_mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_sub_epi32(load(add[x]), load(sub[x]))));
+					}
+				#else
+					for(; x < w; x++, sum += 4) {
+						out[x] = average(sum);
+
+						sum[0] += add[x].r - sub[x].r; sum[1] += add[x].g - sub[x].g;
+						sum[2] += add[x].b - sub[x].b; sum[3] += add[x].a - sub[x].a;
+					}
+				#endif
+				}
+			}
+		});
+	}
+
+	inline BlurEffect::BlurEffect(uint32_t radius, uint32_t passes) {
+		Set(radius, passes);
+	}
+
+	inline void BlurEffect::Set(uint32_t radius, uint32_t passes) {
+		pRadius = radius;
+		pPasses = (std::max)(passes, 1u);
+	}
+
+	inline void BlurEffect::Apply(const Pixel* src, Pixel* dst, const vu2d& size) {
+		pScratch.resize(size.prod());
+
+		BoxBlur(src, dst, pScratch.data(), size, pRadius);
+
+		for(uint32_t i = 1; i < pPasses; i++) {
+			BoxBlur(dst, dst, pScratch.data(), size, pRadius);
+		}
+	}
+
+	inline BloomEffect::BloomEffect(uint8_t threshold, uint32_t radius, float intensity) {
+		Set(threshold, radius, intensity);
+	}
+
+	inline void BloomEffect::Set(uint8_t threshold, uint32_t radius, float intensity) {
+		pThreshold = threshold;
+		pRadius = radius;
+		pIntensity = (uint16_t) (std::min)((std::max)(intensity * 256.0f + 0.5f, 0.0f), 65535.0f);
+	}
+
+	inline void BloomEffect::Apply(const Pixel* src, Pixel* dst, const vu2d& size) {
+		uint32_t w = size.x, h = size.y;
+
+		pBright.resize(size.prod());
+		pScratch.resize(size.prod());
+
+		// Only what is brighter than the threshold spills into its surroundings
+		Workers().ParallelFor(h, 16, [&] (uint32_t begin, uint32_t end) {
+			uint8_t t = pThreshold;
+
+			for(size_t i = (size_t) begin * w; i < (size_t) end * w; i++) {
+				const Pixel& p = src[i];
+				pBright[i] = Pixel(p.r > t ? p.r - t : 0, p.g > t ? p.g - t : 0, p.b > t ? p.b - t : 0, 0);
+			}
+		});
+
+		BoxBlur(pBright.data(), pBright.data(), pScratch.data(), size, pRadius);
+		BoxBlur(pBright.data(), pBright.data(), pScratch.data(), size, pRadius);
+
+		Workers().ParallelFor(h, 16, [&] (uint32_t begin, uint32_t end) {
+			size_t i = (size_t) begin * w, last = (size_t) end * w;
+
+		#ifdef PIXEL_SSE2
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i scale = _mm_set1_epi16((int16_t) pIntensity);
+
+			// 16 bit products only hold up to an intensity of 1
+			for(; pIntensity <= 256 && i + 4 <= last; i += 4) {
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBright.data() + i));
+				__m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), scale), 8);
+				__m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), scale), 8);
+
+				__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+			}
+		#endif
+
+			for(; i < last; i++) {
+				const Pixel& s = src[i];
+				const Pixel& b = pBright[i];
+
+				dst[i] = Pixel(
+					(uint8_t) (std::min)(s.r + ((b.r * pIntensity) >> 8), 255),
+					(uint8_t) (std::min)(s.g + ((b.g * pIntensity) >> 8), 255),
+					(uint8_t) (std::min)(s.b + ((b.b * pIntensity) >> 8), 255),
+					s.a);
+			}
+		});
+	}
+
+	inline GradeEffect::GradeEffect(float brightness, float contrast, float saturation, float gamma, const Pixel& tint) {
+		Set(brightness, contrast, saturation, gamma, tint);
+	}
+
+	inline void GradeEffect::Set(float brightness, float contrast, float saturation, float gamma, const Pixel& tint) {
+		const uint8_t channels[3] = { tint.r, tint.g, tint.b };
+		float exponent = gamma > 0.0f ? 1.0f / gamma : 1.0f;
+
+		// Brightness, contrast, gamma and tint all fold into one curve per channel
+		for(uint32_t c = 0; c < 3; c++) {
+			for(uint32_t i = 0; i < 256; i++) {
+				float v = (i / 255.0f - 0.5f) * contrast + 0.5f + brightness;
+				v = std::pow((std::min)((std::max)(v, 0.0f), 1.0f), exponent) * channels[c];
+				pCurve[c][i] = (uint8_t) (v + 0.5f);
+			}
+		}
+
+		pSaturation = (int32_t) (saturation * 256.0f + 0.5f);
+	}
+
+	inline void GradeEffect::Apply(const Pixel* src, Pixel* dst, const vu2d& size) {
+		uint32_t w = size.x;
+
+		Workers().ParallelFor(size.y, 16, [&] (uint32_t begin, uint32_t end) {
+			const uint8_t* cr = pCurve[0];
+			const uint8_t* cg = pCurve[1];
+			const uint8_t* cb = pCurve[2];
+			const int32_t saturation = pSaturation;
+
+			size_t i = (size_t) begin * w, last = (size_t) end * w;
+
+			if(saturation == 256) {
+				for(; i < last; i++) {
+					uint32_t p = src[i].n;
+					dst[i].n = cr[p & 0xFF] | (cg[(p >> 8) & 0xFF] << 8) | (cb[(p >> 16) & 0xFF] << 16) | (p & 0xFF000000);
+				}
+
+				return;
+			}
+
+			auto clamp = [] (int32_t v) {
+				return (uint32_t) (v < 0 ? 0 : v > 255 ? 255 : v);
+			};
+
+			for(; i < last; i++) {
+				uint32_t p = src[i].n;
+				int32_t r = cr[p & 0xFF], g = cg[(p >> 8) & 0xFF], b = cb[(p >> 16) & 0xFF];
+				int32_t l = (77 * r + 150 * g + 29 * b) >> 8;
+
+				r = l + (((r - l) * saturation) >> 8);
+				g = l + (((g - l) * saturation) >> 8);
+				b = l + (((b - l) * saturation) >> 8);
+
+				dst[i].n = clamp(r) | (clamp(g) << 8) | (clamp(b) << 16) | (p & 0xFF000000);
+			}
+		});
+	}
+
+	inline VignetteEffect::VignetteEffect(float strength, float radius) {
+		Set(strength, radius);
+	}
+
+	inline void VignetteEffect::Set(float strength, float radius) {
+		// Indexed by squared distance from the centre, 1.0 in the corners
+		for(uint32_t i = 0; i < 1024; i++) {
+			float d = std::sqrt(i / 1023.0f);
+			float t = radius < 1.0f ? (std::min)((std::max)((d - radius) / (1.0f - radius), 0.0f), 1.0f) : 0.0f;
+			float weight = 1.0f - strength * t * t * (3.0f - 2.0f * t);
+
+			pWeights[i] = (uint16_t) ((std::min)((std::max)(weight, 0.0f), 1.0f) * 256.0f + 0.5f);
+		}
+	}
+
+	inline void VignetteEffect::Apply(const Pixel* src, Pixel* dst, const vu2d& size) {
+		uint32_t w = size.x, h = size.y;
+		float cx = w * 0.5f, cy = h * 0.5f;
+
+		if(pColumns.size() != w) {
+			pColumns.resize(w);
+
+			for(uint32_t x = 0; x < w; x++) {
+				float dx = (x + 0.5f - cx) / cx;
+				pColumns[x] = dx * dx * 0.5f * 1023.0f;
+			}
+		}
+
+		Workers().ParallelFor(h, 16, [&] (uint32_t begin, uint32_t end) {
+			for(uint32_t y = begin; y < end; y++) {
+				float dy = (y + 0.5f - cy) / cy;
+				float row = dy * dy * 0.5f * 1023.0f;
+
+				const Pixel* in = src + (size_t) y * w;
+				Pixel* out = dst + (size_t) y * w;
+
+				for(uint32_t x = 0; x < w; x++) {
+					uint32_t k = pWeights[(std::min)((uint32_t) (pColumns[x] + row), 1023u)];
+					out[x] = Pixel((uint8_t) ((in[x].r * k) >> 8), (uint8_t) ((in[x].g * k) >> 8), (uint8_t) ((in[x].b * k) >> 8), in[x].a);
+				}
+			}
+		});
+	}
+
+	inline ScanlineEffect::ScanlineEffect(float darkness, uint32_t period) {
+		Set(darkness, period);
+	}
+
+	inline void ScanlineEffect::Set(float darkness, uint32_t period) {
+		pScale = (uint16_t) ((1.0f - (std::min)((std::max)(darkness, 0.0f), 1.0f)) * 256.0f + 0.5f);
+		pPeriod = (std::max)(period, 1u);
+	}
+
+	inline void ScanlineEffect::Apply(const Pixel* src, Pixel* dst, const vu2d& size) {
+		uint32_t w = size.x;
+
+		Workers().ParallelFor(size.y, 16, [&] (uint32_t begin, uint32_t end) {
+			for(uint32_t y = begin; y < end; y++) {
+				const Pixel* in = src + (size_t) y * w;
+				Pixel* out = dst + (size_t) y * w;
+
+				// The last row of every period is the dark one
+				if(y % pPeriod != pPeriod - 1) {
+					memcpy(out, in, w * sizeof(Pixel));
+					continue;
+				}
+
+				uint32_t x = 0;
+
+			#ifdef PIXEL_SSE2
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i scale = _mm_set1_epi16((int16_t) pScale);
+				const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+
+				for(; x + 4 <= w; x += 4) {
+					__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x));
+					__m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), scale), 8);
+					__m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), scale), 8);
+					__m128i v = _mm_packus_epi16(lo, hi);
+
+					v = _mm_or_si128(_mm_andnot_si128(alpha, v), _mm_and_si128(alpha, p));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), v);
+				}
+			#endif
+
+				for(; x < w; x++) {
+					out[x] = Pixel((uint8_t) ((in[x].r * pScale) >> 8), (uint8_t) ((in[x].g * pScale) >> 8), (uint8_t) ((in[x].b * pScale) >> 8), in[x].a);
+				}
+			}
+		});
+	}
+
+	/*
+		ImageEncoder keeps its output and scratch buffers between calls, so
+		saving a stream of frames settles into no allocations. PNG rows are
+		split into groups that are filtered and deflated independently on
+		the worker pool. Every group but the last ends on a byte aligned
+		sync flush, so the compressed groups concatenate into one zlib
+		stream, and each becomes its own IDAT chunk with its own CRC. The
+		Adler-32 of the stream is combined from the per group sums.
+
+		The fast mode uses the Sub filter and greedy single probe matching
+		with the fixed Huffman code. Otherwise each row picks the filter with
+		the smallest absolute sum, matches search a hash chain and every
+		group gets its own dynamic Huffman code.
+	*/
+
+	inline const std::vector<uint8_t>& ImageEncoder::Encode(const Pixel* data, const vu2d& size, ImageFormat format, bool fast) {
+		if(size.x == 0 || size.y == 0) {
+			throw std::runtime_error("Invalid image proportions.");
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		switch(format) {
+			case ImageFormat::QOI: pEncodeQoi(data, size); break;
+			case ImageFormat::BMP: pEncodeBmp(data, size); break;
+			case ImageFormat::PNG: pEncodePng(data, size, fast); break;
+		}
+
+		pEncodeTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+		return pOutput;
+	}
+
+	inline void ImageEncoder::Save(const std::string& filename, const Pixel* data, const vu2d& size, ImageFormat format, bool fast) {
+		Encode(data, size, format, fast);
+
+		std::ofstream file(filename, std::ios::binary);
+		file.write(reinterpret_cast<const char*>(pOutput.data()), pOutput.size());
+
+		if(!file) {
+			throw std::runtime_error("Failed to write the image file.");
+		}
+	}
+
+	inline float ImageEncoder::EncodeTime() const {
+		return pEncodeTime;
+	}
+
+	inline void ImageEncoder::SetParallel(bool parallel) {
+		pParallel = parallel;
+	}
+
+	/*
+		Hash used to check replayed frames against the recorded ones. Four
+		independent FNV style lanes over 64 bit words keep it well under a
+		millisecond for a full HD frame, the finalizer mixes them together.
+	*/
+
+	inline uint64_t HashFrame(const Pixel* data, size_t count) {
+		const uint64_t prime = 0x100000001B3ull;
+		uint64_t h0 = 0xCBF29CE484222325ull, h1 = h0 ^ 1, h2 = h0 ^ 2, h3 = h0 ^ 3;
+
+		const uint8_t* bytes = (const uint8_t*) data;
+		size_t size = count * sizeof(Pixel), i = 0;
+
+		for(; i + 32 <= size; i += 32) {
+			uint64_t w[4];
+			memcpy(w, bytes + i, 32);
+
+			h0 = (h0 ^ w[0]) * prime;
+			h1 = (h1 ^ w[1]) * prime;
+			h2 = (h2 ^ w[2]) * prime;
+			h3 = (h3 ^ w[3]) * prime;
+		}
+
+		for(; i < size; i += sizeof(Pixel)) {
+			uint32_t w;
+			memcpy(&w, bytes + i, sizeof(Pixel));
+
+			h0 = (h0 ^ w) * prime;
+		}
+
+		uint64_t h = h0;
+		h = (h ^ h1) * prime;
+		h = (h ^ h2) * prime;
+		h = (h ^ h3) * prime;
+		h = (h ^ size) * prime;
+
+		h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull;
+		h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull;
+		h ^= h >> 33;
+
+		return h;
+	}
+
+	/*
+		The QOI operations on their own, without header or end marker, over a
+		rectangle of a larger image. Every call starts from a fresh index and
+		previous pixel, so separately encoded rectangles decode on their own.
+		The output needs room for 5 bytes per pixel.
+	*/
+
+	inline size_t EncodeQoiOps(const Pixel* src, uint32_t stride, const vu2d& size, uint8_t* out) {
+		uint8_t* start = out;
+
+		Pixel index[64];
+		memset(index, 0, sizeof(index));
+
+		Pixel previous(0, 0, 0, 255);
+		uint32_t run = 0;
+
+		for(uint32_t y = 0; y < size.y; y++) {
+			const Pixel* row = src + (size_t) y * stride;
+
+			for(uint32_t x = 0; x < size.x; x++) {
+				const Pixel p = row[x];
+
+				if(p == previous) {
+					if(++run == 62) {
+						*out++ = (uint8_t) (0xC0 | (run - 1));
+						run = 0;
+					}
+
+					continue;
+				}
+
+				if(run) {
+					*out++ = (uint8_t) (0xC0 | (run - 1));
+					run = 0;
+				}
+
+				uint32_t slot = (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) & 63;
+
+				if(index[slot] == p) {
+					*out++ = (uint8_t) slot;
+				} else {
+					index[slot] = p;
+
+					if(p.a == previous.a) {
+						int8_t dr = (int8_t) (p.r - previous.r);
+						int8_t dg = (int8_t) (p.g - previous.g);
+						int8_t db = (int8_t) (p.b - previous.b);
+
+						int8_t drg = (int8_t) (dr - dg);
+						int8_t dbg = (int8_t) (db - dg);
+
+						if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+							*out++ = (uint8_t) (0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+						} else if(dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+							*out++ = (uint8_t) (0x80 | (dg + 32));
+							*out++ = (uint8_t) (((drg + 8) << 4) | (dbg + 8));
+						} else {
+							*out++ = 0xFE; *out++ = p.r; *out++ = p.g; *out++ = p.b;
+						}
+					} else {
+						*out++ = 0xFF; *out++ = p.r; *out++ = p.g; *out++ = p.b; *out++ = p.a;
+					}
+				}
+
+				previous = p;
+			}
+		}
+
+		if(run) *out++ = (uint8_t) (0xC0 | (run - 1));
+
+		return out - start;
+	}
+
+	inline size_t DecodeQoiOps(const uint8_t* in, size_t length, Pixel* dst, uint32_t stride, const vu2d& size) {
+		const uint8_t* start = in;
+		const uint8_t* end = in + length;
+
+		Pixel index[64];
+		memset(index, 0, sizeof(index));
+
+		Pixel p(0, 0, 0, 255);
+		uint32_t run = 0;
+
+		for(uint32_t y = 0; y < size.y; y++) {
+			Pixel* row = dst + (size_t) y * stride;
+
+			for(uint32_t x = 0; x < size.x; x++) {
+				if(run) {
+					run--;
+					row[x] = p;
+					continue;
+				}
+
+				if(in >= end) return 0;
+				uint8_t op = *in++;
+
+				if(op == 0xFE || op == 0xFF) {
+					if(end - in < (op == 0xFF ? 4 : 3)) return 0;
+
+					p.r = *in++; p.g = *in++; p.b = *in++;
+					if(op == 0xFF) p.a = *in++;
+				} else if((op & 0xC0) == 0x00) {
+					p = index[op];
+				} else if((op & 0xC0) == 0x40) {
+					p.r += ((op >> 4) & 3) - 2;
+					p.g += ((op >> 2) & 3) - 2;
+					p.b += (op & 3) - 2;
+				} else if((op & 0xC0) == 0x80) {
+					if(in >= end) return 0;
+
+					int32_t dg = (op & 0x3F) - 32;
+					uint8_t next = *in++;
+
+					p.r += dg + (next >> 4) - 8;
+					p.g += dg;
+					p.b += dg + (next & 0x0F) - 8;
+				} else {
+					run = op & 0x3F;
+				}
+
+				index[(p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) & 63] = p;
+				row[x] = p;
+			}
+		}
+
+		return run ? 0 : in - start;
+	}
+
+	inline void ImageEncoder::pEncodeQoi(const Pixel* data, const vu2d& size) {
+		size_t count = (size_t) size.x * size.y;
+		pOutput.resize(14 + count * 5 + 8);
+
+		uint8_t* out = pOutput.data();
+
+		auto put32 = [&] (uint32_t v) {
+			*out++ = (uint8_t) (v >> 24); *out++ = (uint8_t) (v >> 16);
+			*out++ = (uint8_t) (v >> 8); *out++ = (uint8_t) v;
+		};
+
+		memcpy(out, "qoif", 4); out += 4;
+		put32(size.x);
+		put32(size.y);
+		*out++ = 4;
+		*out++ = 0;
+
+		out += EncodeQoiOps(data, size.x, size, out);
+
+		static const uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+		memcpy(out, end, 8); out += 8;
+
+		pOutput.resize(out - pOutput.data());
+	}
+
+	inline void ImageEncoder::pEncodeBmp(const Pixel* data, const vu2d& size) {
+		size_t count = (size_t) size.x * size.y;
+		pOutput.resize(54 + count * 4);
+
+		uint8_t* out = pOutput.data();
+
+		auto put16 = [&] (uint16_t v) { memcpy(out, &v, 2); out += 2; };
+		auto put32 = [&] (uint32_t v) { memcpy(out, &v, 4); out += 4; };
+
+		// BITMAPFILEHEADER and a BITMAPINFOHEADER with a negative height for top down rows
+		*out++ = 'B'; *out++ = 'M';
+		put32((uint32_t) pOutput.size());
+		put32(0);
+		put32(54);
+
+		put32(40);
+		put32(size.x);
+		put32((uint32_t) -(int32_t) size.y);
+		put16(1);
+		put16(32);
+		put32(0);
+		put32((uint32_t) (count * 4));
+		put32(2835);
+		put32(2835);
+		put32(0);
+		put32(0);
+
+		// Pixel data starts at byte 54, so stores go through memcpy
+		for(size_t i = 0; i < count; i++, out += 4) {
+			uint32_t n = data[i].n;
+			n = (n & 0xFF00FF00) | ((n >> 16) & 0xFF) | ((n & 0xFF) << 16);
+			memcpy(out, &n, 4);
+		}
+	}
+
+	inline void ImageEncoder::pEncodePng(const Pixel* data, const vu2d& size, bool fast) {
+		const uint32_t rowBytes = size.x * 4 + 1;
+		const uint32_t rowsPerGroup = (std::max)((1u << 18) / rowBytes, 1u);
+		const uint32_t groups = (size.y + rowsPerGroup - 1) / rowsPerGroup;
+
+		if(pGroups.size() < groups) pGroups.resize(groups);
+
+		auto encode = [&] (uint32_t begin, uint32_t end) {
+			for(uint32_t g = begin; g < end; g++) {
+				Group& group = pGroups[g];
+
+				pFilterRows(data, size, g * rowsPerGroup, (std::min)((g + 1) * rowsPerGroup, size.y), fast, group);
+				pDeflate(group, g == 0, g + 1 == groups, fast);
+
+				group.adler = pAdler32(1, group.filtered.data(), group.filteredSize);
+				group.crc = pCrc32(pCrc32(0, reinterpret_cast<const uint8_t*>("IDAT"), 4), group.output.data(), group.outputSize);
+			}
+		};
+
+		if(pParallel) Workers().ParallelFor(groups, 1, encode);
+		else encode(0, groups);
+
+		size_t total = 8 + 25 + 16 + 12;
+		for(uint32_t g = 0; g < groups; g++) total += pGroups[g].outputSize + 12;
+
+		pOutput.resize(total);
+		uint8_t* out = pOutput.data();
+
+		auto put32 = [&] (uint32_t v) {
+			*out++ = (uint8_t) (v >> 24); *out++ = (uint8_t) (v >> 16);
+			*out++ = (uint8_t) (v >> 8); *out++ = (uint8_t) v;
+		};
+
+		auto chunk = [&] (const char* type, const uint8_t* chunkData, uint32_t chunkSize, uint32_t crc) {
+			put32(chunkSize);
+			memcpy(out, type, 4); out += 4;
+			if(chunkSize) memcpy(out, chunkData, chunkSize);
+			out += chunkSize;
+			put32(crc);
+		};
+
+		auto crcOf = [] (const char* type, const uint8_t* chunkData, uint32_t chunkSize) {
+			return pCrc32(pCrc32(0, reinterpret_cast<const uint8_t*>(type), 4), chunkData, chunkSize);
+		};
+
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+		memcpy(out, signature, 8); out += 8;
+
+		uint8_t header[13] = {
+			(uint8_t) (size.x >> 24), (uint8_t) (size.x >> 16), (uint8_t) (size.x >> 8), (uint8_t) size.x,
+			(uint8_t) (size.y >> 24), (uint8_t) (size.y >> 16), (uint8_t) (size.y >> 8), (uint8_t) size.y,
+			8, 6, 0, 0, 0
+		};
+
+		chunk("IHDR", header, 13, crcOf("IHDR", header, 13));
+
+		uint32_t adler = 1;
+
+		for(uint32_t g = 0; g < groups; g++) {
+			Group& group = pGroups[g];
+
+			chunk("IDAT", group.output.data(), (uint32_t) group.outputSize, group.crc);
+			adler = g == 0 ? group.adler : pAdler32Combine(adler, group.adler, group.filteredSize);
+		}
+
+		uint8_t trailer[4] = { (uint8_t) (adler >> 24), (uint8_t) (adler >> 16), (uint8_t) (adler >> 8), (uint8_t) adler };
+		chunk("IDAT", trailer, 4, crcOf("IDAT", trailer, 4));
+		chunk("IEND", nullptr, 0, crcOf("IEND", nullptr, 0));
+	}
+
+	inline void ImageEncoder::pFilterRows(const Pixel* data, const vu2d& size, uint32_t first, uint32_t last, bool fast, Group& group) {
+		const size_t bytes = (size_t) size.x * 4;
+
+		group.filteredSize = (bytes + 1) * (last - first);
+		if(group.filtered.size() < group.filteredSize) group.filtered.resize(group.filteredSize);
+		if(!fast && group.scratch.size() < bytes * 4) group.scratch.resize(bytes * 4);
+
+		uint8_t* out = group.filtered.data();
+
+		for(uint32_t y = first; y < last; y++, out += bytes + 1) {
+			const uint8_t* cur = reinterpret_cast<const uint8_t*>(data + (size_t) y * size.x);
+			const uint8_t* up = y > 0 ? cur - bytes : nullptr;
+
+			if(fast) {
+				out[0] = 1;
+				memcpy(out + 1, cur, 4);
+
+				size_t i = 4;
+
+			#ifdef PIXEL_SSE2
+				for(; i + 16 <= bytes; i += 16) {
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i - 4));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 1 + i), _mm_sub_epi8(a, b));
+				}
+			#endif
+
+				for(; i < bytes; i++) out[1 + i] = (uint8_t) (cur[i] - cur[i - 4]);
+				continue;
+			}
+
+			// Sub, Up, Average and Paeth go to scratch, None is the row itself
+			uint8_t* candidates[5] = { nullptr, group.scratch.data(), group.scratch.data() + bytes, group.scratch.data() + bytes * 2, group.scratch.data() + bytes * 3 };
+			uint64_t sums[5] = {};
+
+			for(size_t i = 0; i < bytes; i++) {
+				int a = i >= 4 ? cur[i - 4] : 0;
+				int b = up ? up[i] : 0;
+				int c = up && i >= 4 ? up[i - 4] : 0;
+
+				int p = a + b - c;
+				int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+				int paeth = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+
+				uint8_t f[5] = { cur[i], (uint8_t) (cur[i] - a), (uint8_t) (cur[i] - b), (uint8_t) (cur[i] - ((a + b) >> 1)), (uint8_t) (cur[i] - paeth) };
+
+				for(int k = 1; k < 5; k++) candidates[k][i] = f[k];
+				for(int k = 0; k < 5; k++) sums[k] += (uint32_t) std::abs((int8_t) f[k]);
+			}
+
+			int best = 0;
+			for(int k = 1; k < 5; k++) if(sums[k] < sums[best]) best = k;
+
+			out[0] = (uint8_t) best;
+			memcpy(out + 1, best == 0 ? cur : candidates[best], bytes);
+		}
+	}
+
+	template<class L, class M> inline void ImageEncoder::pLz77(Group& group, uint32_t depth, L&& literal, M&& match) {
+		const uint32_t hashBits = 15;
+		const int32_t window = 32768;
+
+		const uint8_t* in = group.filtered.data();
+		const size_t n = group.filteredSize;
+
+		group.head.assign((size_t) 1 << hashBits, -1);
+		if(depth > 1 && group.chain.size() < (size_t) window) group.chain.resize(window);
+
+		int32_t* head = group.head.data();
+		int32_t* chain = group.chain.data();
+
+		auto hash = [&] (size_t i) {
+			uint32_t v;
+			memcpy(&v, in + i, 4);
+			return (v * 2654435761u) >> (32 - hashBits);
+		};
+
+		auto insert = [&] (size_t i) {
+			uint32_t h = hash(i);
+			int32_t candidate = head[h];
+			head[h] = (int32_t) i;
+			if(depth > 1) chain[i & (window - 1)] = candidate;
+			return candidate;
+		};
+
+		auto length = [&] (const uint8_t* a, const uint8_t* b, size_t limit) {
+			size_t len = 0;
+
+			for(; len + 8 <= limit; len += 8) {
+				uint64_t x, y;
+				memcpy(&x, a + len, 8);
+				memcpy(&y, b + len, 8);
+				if(x != y) return len + (std::countr_zero(x ^ y) >> 3);
+			}
+
+			while(len < limit && a[len] == b[len]) len++;
+			return len;
+		};
+
+		size_t i = 0;
+		uint32_t misses = 0;
+
+		while(i + 4 <= n) {
+			int32_t candidate = insert(i);
+
+			size_t limit = (std::min)(n - i, (size_t) 258);
+			size_t bestLength = 0, bestDistance = 0;
+
+			for(uint32_t tries = depth; candidate >= 0 && (int64_t) i - candidate <= window && tries > 0; tries--) {
+				size_t len = length(in + candidate, in + i, limit);
+
+				if(len > bestLength) {
+					bestLength = len;
+					bestDistance = i - candidate;
+					if(len == limit) break;
+				}
+
+				if(depth == 1) break;
+
+				int32_t next = chain[candidate & (window - 1)];
+				if(next >= candidate) break;
+				candidate = next;
+			}
+
+			if(bestLength >= 4) {
+				match((uint32_t) bestLength, (uint32_t) bestDistance);
+
+				size_t end = i + bestLength;
+
+				if(depth > 1) {
+					for(size_t j = i + 1; j < end && j + 4 <= n; j++) insert(j);
+				} else if(end + 3 <= n) {
+					insert(end - 1);
+				}
+
+				i = end;
+				misses = 0;
+			} else {
+				// Single probe matching skips ahead through incompressible stretches, like LZ4
+				size_t step = depth == 1 ? 1 + (misses++ >> 5) : 1;
+				for(size_t end = (std::min)(i + step, n); i < end; i++) literal(in[i]);
+			}
+		}
+
+		while(i < n) literal(in[i++]);
+	}
+
+	inline void ImageEncoder::pDeflate(Group& group, bool first, bool last, bool fast) {
+		size_t capacity = group.filteredSize * 2 + 1024;
+		if(group.output.size() < capacity) group.output.resize(capacity);
+
+		BitWriter bits;
+		bits.out = group.output.data();
+
+		if(first) {
+			*bits.out++ = 0x78;
+			*bits.out++ = 0x01;
+		}
+
+		// Length and distance symbols follow from the bit width of the value
+		auto lengthSymbol = [] (uint32_t len, uint32_t& extra, uint32_t& extraBits) -> uint32_t {
+			if(len == 258) { extraBits = 0; return 285; }
+			if(len <= 10) { extraBits = 0; return 254 + len; }
+
+			uint32_t l = len - 3, b = std::bit_width(l) - 1;
+			extraBits = b - 2;
+			extra = l & ((1u << extraBits) - 1);
+			return 257 + 4 * (b - 1) + ((l >> (b - 2)) & 3);
+		};
+
+		auto distanceSymbol = [] (uint32_t dist, uint32_t& extra, uint32_t& extraBits) -> uint32_t {
+			if(dist <= 4) { extraBits = 0; return dist - 1; }
+
+			uint32_t d = dist - 1, b = std::bit_width(d) - 1;
+			extraBits = b - 1;
+			extra = d & ((1u << extraBits) - 1);
+			return 2 * b + ((d >> (b - 1)) & 1);
+		};
+
+		uint16_t litCodes[288];
+		uint8_t litLengths[288];
+		uint16_t distCodes[30];
+		uint8_t distLengths[30];
+
+		auto writeTokens = [&] (auto&& each) {
+			each([&] (uint32_t lit) {
+				bits.Put(litCodes[lit], litLengths[lit]);
+			}, [&] (uint32_t len, uint32_t dist) {
+				uint32_t extra = 0, extraBits;
+
+				uint32_t sym = lengthSymbol(len, extra, extraBits);
+				bits.Put(litCodes[sym], litLengths[sym]);
+				if(extraBits) bits.Put(extra, extraBits);
+
+				sym = distanceSymbol(dist, extra, extraBits);
+				bits.Put(distCodes[sym], distLengths[sym]);
+				if(extraBits) bits.Put(extra, extraBits);
+			});
+
+			bits.Put(litCodes[256], litLengths[256]);
+		};
+
+		if(fast) {
+			for(uint32_t i = 0; i < 288; i++) litLengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+			for(uint32_t i = 0; i < 30; i++) distLengths[i] = 5;
+
+			pHuffmanCodes(litLengths, 288, litCodes);
+			pHuffmanCodes(distLengths, 30, distCodes);
+
+			bits.Put(last ? 1 : 0, 1);
+			bits.Put(1, 2);
+
+			writeTokens([&] (auto&& literal, auto&& match) {
+				pLz77(group, 1, literal, match);
+			});
+		} else {
+			uint32_t litFreq[286] = {};
+			uint32_t distFreq[30] = {};
+
+			group.tokens.clear();
+
+			pLz77(group, 16, [&] (uint32_t lit) {
+				litFreq[lit]++;
+				group.tokens.push_back(lit);
+			}, [&] (uint32_t len, uint32_t dist) {
+				uint32_t extra, extraBits;
+				litFreq[lengthSymbol(len, extra, extraBits)]++;
+				distFreq[distanceSymbol(dist, extra, extraBits)]++;
+				group.tokens.push_back(0x80000000 | (len << 16) | dist);
+			});
+
+			litFreq[256] = 1;
+
+			// Two codes at least keep every tree complete, which strict decoders require
+			auto complete = [] (uint32_t* freq, uint32_t count) {
+				uint32_t used = (uint32_t) std::count_if(freq, freq + count, [] (uint32_t f) { return f > 0; });
+				for(uint32_t i = 0; used < 2; i++) if(!freq[i]) { freq[i] = 1; used++; }
+			};
+
+			complete(distFreq, 30);
+
+			pHuffmanLengths(litFreq, 286, 15, litLengths);
+			pHuffmanLengths(distFreq, 30, 15, distLengths);
+
+			uint32_t hlit = 286, hdist = 30;
+			while(hlit > 257 && !litLengths[hlit - 1]) hlit--;
+			while(hdist > 1 && !distLengths[hdist - 1]) hdist--;
+
+			uint8_t all[316];
+			memcpy(all, litLengths, hlit);
+			memcpy(all + hlit, distLengths, hdist);
+
+			// Code lengths are run length coded with symbols 16, 17 and 18
+			uint16_t runs[316];
+			uint32_t runCount = 0;
+			uint32_t clFreq[19] = {};
+
+			auto emit = [&] (uint32_t sym, uint32_t extra) {
+				runs[runCount++] = (uint16_t) (sym | (extra << 8));
+				clFreq[sym]++;
+			};
+
+			for(uint32_t i = 0, total = hlit + hdist; i < total;) {
+				uint32_t value = all[i], run = 1;
+				while(i + run < total && all[i + run] == value) run++;
+				i += run;
+
+				if(value == 0) {
+					while(run >= 11) { uint32_t r = (std::min)(run, 138u); emit(18, r - 11); run -= r; }
+					if(run >= 3) { emit(17, run - 3); run = 0; }
+				} else {
+					emit(value, 0); run--;
+					while(run >= 3) { uint32_t r = (std::min)(run, 6u); emit(16, r - 3); run -= r; }
+				}
+
+				while(run--) emit(value, 0);
+			}
+
+			static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+			complete(clFreq, 19);
+
+			uint8_t clLengths[19];
+			uint16_t clCodes[19];
+
+			pHuffmanLengths(clFreq, 19, 7, clLengths);
+			pHuffmanCodes(clLengths, 19, clCodes);
+			pHuffmanCodes(litLengths, 286, litCodes);
+			pHuffmanCodes(distLengths, 30, distCodes);
+
+			uint32_t hclen = 19;
+			while(hclen > 4 && !clLengths[order[hclen - 1]]) hclen--;
+
+			bits.Put(last ? 1 : 0, 1);
+			bits.Put(2, 2);
+			bits.Put(hlit - 257, 5);
+			bits.Put(hdist - 1, 5);
+			bits.Put(hclen - 4, 4);
+
+			for(uint32_t i = 0; i < hclen; i++) bits.Put(clLengths[order[i]], 3);
+
+			static const uint8_t runExtra[3] = { 2, 3, 7 };
+
+			for(uint32_t i = 0; i < runCount; i++) {
+				uint32_t sym = runs[i] & 0xFF;
+				bits.Put(clCodes[sym], clLengths[sym]);
+				if(sym >= 16) bits.Put(runs[i] >> 8, runExtra[sym - 16]);
+			}
+
+			writeTokens([&] (auto&& literal, auto&& match) {
+				for(uint32_t token : group.tokens) {
+					if(token & 0x80000000) match((token >> 16) & 0x1FF, token & 0xFFFF);
+					else literal(token);
+				}
+			});
+		}
+
+		if(last) {
+			bits.Align();
+		} else {
+			// An empty stored block ends the group on a byte boundary
+			bits.Put(0, 3);
+			bits.Align();
+
+			static const uint8_t sync[4] = { 0x00, 0x00, 0xFF, 0xFF };
+			memcpy(bits.out, sync, 4);
+			bits.out += 4;
+		}
+
+		group.outputSize = bits.out - group.output.data();
+	}
+
+	inline void ImageEncoder::pHuffmanLengths(const uint32_t* freq, uint32_t count, uint32_t limit, uint8_t* lengths) {
+		uint32_t symbols[288];
+		uint32_t n = 0;
+
+		for(uint32_t i = 0; i < count; i++) {
+			lengths[i] = 0;
+			if(freq[i]) symbols[n++] = i;
+		}
+
+		if(n == 0) return;
+
+		if(n == 1) {
+			lengths[symbols[0]] = 1;
+			return;
+		}
+
+		// Flattening the weights until the deepest leaf fits the limit is simple and near optimal
+		for(uint32_t shift = 0;; shift++) {
+			uint64_t weight[576];
+			uint32_t parent[576];
+			uint32_t depth[576];
+
+			auto scaled = [&] (uint32_t s) {
+				return (uint64_t) ((freq[s] >> shift) | 1);
+			};
+
+			std::sort(symbols, symbols + n, [&] (uint32_t a, uint32_t b) {
+				return scaled(a) < scaled(b);
+			});
+
+			for(uint32_t i = 0; i < n; i++) weight[i] = scaled(symbols[i]);
+
+			// Leaves and merged nodes are both produced in weight order, so two queues replace a heap
+			uint32_t leaf = 0, node = n;
+
+			auto pick = [&] (uint32_t k) {
+				if(leaf < n && (node >= k || weight[leaf] <= weight[node])) return leaf++;
+				return node++;
+			};
+
+			for(uint32_t k = n; k < 2 * n - 1; k++) {
+				uint32_t a = pick(k);
+				uint32_t b = pick(k);
+
+				weight[k] = weight[a] + weight[b];
+				parent[a] = parent[b] = k;
+			}
+
+			uint32_t deepest = 0;
+			depth[2 * n - 2] = 0;
+
+			for(int32_t k = 2 * n - 3; k >= 0; k--) {
+				depth[k] = depth[parent[k]] + 1;
+				if(k < (int32_t) n) deepest = (std::max)(deepest, depth[k]);
+			}
+
+			if(deepest <= limit) {
+				for(uint32_t i = 0; i < n; i++) lengths[symbols[i]] = (uint8_t) depth[i];
+				return;
+			}
+		}
+	}
+
+	inline void ImageEncoder::pHuffmanCodes(const uint8_t* lengths, uint32_t count, uint16_t* codes) {
+		uint32_t counts[16] = {};
+		uint32_t next[16] = {};
+
+		for(uint32_t i = 0; i < count; i++) counts[lengths[i]]++;
+		counts[0] = 0;
+
+		for(uint32_t bits = 1, code = 0; bits < 16; bits++) {
+			code = (code + counts[bits - 1]) << 1;
+			next[bits] = code;
+		}
+
+		// Deflate writes Huffman codes from the most significant bit, so store them reversed
+		for(uint32_t i = 0; i < count; i++) {
+			uint32_t len = lengths[i];
+			if(!len) { codes[i] = 0; continue; }
+
+			uint32_t code = next[len]++, reversed = 0;
+			for(uint32_t b = 0; b < len; b++) reversed |= ((code >> b) & 1) << (len - 1 - b);
+			codes[i] = (uint16_t) reversed;
+		}
+	}
+
+	inline uint32_t ImageEncoder::pAdler32(uint32_t adler, const uint8_t* data, size_t size) {
+		uint32_t a = adler & 0xFFFF, b = adler >> 16;
+
+		while(size > 0) {
+			size_t block = (std::min)(size, (size_t) 5552);
+			size -= block;
+
+		#ifdef PIXEL_SSE2
+			// Sixteen bytes at a time: sad_epu8 sums them for a, madd weights them 16..1 for b
+			if(block >= 16) {
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i weightsLo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+				const __m128i weightsHi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+
+				__m128i sumA = zero, sumB = zero, prefix = zero;
+				size_t vectors = block / 16;
+
+				for(size_t i = 0; i < vectors; i++, data += 16) {
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+
+					prefix = _mm_add_epi32(prefix, sumA);
+					sumA = _mm_add_epi32(sumA, _mm_sad_epu8(v, zero));
+					sumB = _mm_add_epi32(sumB, _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weightsLo));
+					sumB = _mm_add_epi32(sumB, _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weightsHi));
+				}
+
+				alignas(16) uint32_t lanesA[4], lanesB[4], lanesP[4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanesA), sumA);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanesB), sumB);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanesP), prefix);
+
+				uint64_t bytes = vectors * 16;
+				uint64_t s1 = (uint64_t) lanesA[0] + lanesA[2];
+				uint64_t s2 = (uint64_t) lanesB[0] + lanesB[1] + lanesB[2] + lanesB[3] + 16 * ((uint64_t) lanesP[0] + lanesP[2]);
+
+				b = (uint32_t) ((b + bytes * a + s2) % 65521);
+				a = (uint32_t) ((a + s1) % 65521);
+				block -= (size_t) bytes;
+			}
+		#endif
+
+			while(block--) {
+				a += *data++;
+				b += a;
+			}
+
+			a %= 65521;
+			b %= 65521;
+		}
+
+		return a | (b << 16);
+	}
+
+	inline uint32_t ImageEncoder::pAdler32Combine(uint32_t a, uint32_t b, size_t sizeB) {
+		const uint32_t base = 65521;
+
+		uint32_t rem = (uint32_t) (sizeB % base);
+		uint32_t sum1 = a & 0xFFFF;
+		uint32_t sum2 = (uint32_t) (((uint64_t) rem * sum1) % base);
+
+		sum1 += (b & 0xFFFF) + base - 1;
+		sum2 += (a >> 16) + (b >> 16) + base - rem;
+
+		if(sum1 >= base) sum1 -= base;
+		if(sum1 >= base) sum1 -= base;
+		if(sum2 >= base * 2) sum2 -= base * 2;
+		if(sum2 >= base) sum2 -= base;
+
+		return sum1 | (sum2 << 16);
+	}
+
+	inline uint32_t ImageEncoder::pCrc32(uint32_t crc, const uint8_t* data, size_t size) {
+		static const auto tables = [] {
+			std::array<std::array<uint32_t, 256>, 8> t = {};
+
+			for(uint32_t i = 0; i < 256; i++) {
+				uint32_t c = i;
+				for(int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+				t[0][i] = c;
+			}
+
+			for(uint32_t i = 0; i < 256; i++) {
+				for(int k = 1; k < 8; k++) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+			}
+
+			return t;
+		}();
+
+		crc = ~crc;
+
+		// Slicing by eight folds eight input bytes per step
+		for(; size >= 8; size -= 8, data += 8) {
+			uint32_t lo, hi;
+			memcpy(&lo, data, 4);
+			memcpy(&hi, data + 4, 4);
+			lo ^= crc;
+
+			crc = tables[7][lo & 0xFF] ^ tables[6][(lo >> 8) & 0xFF] ^ tables[5][(lo >> 16) & 0xFF] ^ tables[4][lo >> 24] ^
+				  tables[3][hi & 0xFF] ^ tables[2][(hi >> 8) & 0xFF] ^ tables[1][(hi >> 16) & 0xFF] ^ tables[0][hi >> 24];
+		}
+
+		while(size--) crc = tables[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+
+		return ~crc;
+	}
+
+	/*
+		FrameCapture copies finished frames into a small pool of recycled
+		buffers and hands them to an encoder thread. Submit never waits on
+		the encoder: when no buffer is free the frame is dropped and
+		counted. The lock is only held to move buffer indices around, never
+		while copying, converting or writing.
+
+		Y4M frames are 4:4:4 BT.601 studio range YCbCr, RAW is the RGBA
+		frames back to back, and IMAGES writes one file per frame numbered
+		by submission, so the gaps in the sequence show where frames were
+		dropped. Images are deflated serially on the encoder thread, since
+		going through the shared worker pool would make every parallel job
+		of the render thread wait for a whole frame to compress.
+
+		Frames are taken from the CPU buffer, like SaveFrame, so sprites
+		and animators drawn on the GPU are not part of them.
+	*/
+
+	inline FrameCapture::~FrameCapture() {
+		Stop();
+	}
+
+	inline void FrameCapture::Start(const std::string& path, const vu2d& size, CaptureFormat format, uint32_t fps, uint32_t buffers, ImageFormat imageFormat) {
+		Stop();
+
+		pPath = path;
+		pSize = size;
+		pFormat = format;
+		pImageFormat = imageFormat;
+
+		if(format != CaptureFormat::IMAGES) {
+			pFile.open(path, std::ios::binary | std::ios::trunc);
+
+			if(!pFile) {
+				throw std::runtime_error("Failed to open the capture file.");
+			}
+		}
+
+		if(format == CaptureFormat::Y4M) {
+			pFile << "YUV4MPEG2 W" << size.x << " H" << size.y << " F" << fps << ":1 Ip A1:1 C444\n";
+		}
+
+		buffers = (std::max)(buffers, 1u);
+
+		pBuffers.resize(buffers);
+		for(auto& buffer : pBuffers) buffer.resize(size.prod());
+
+		pFree.clear();
+		for(uint32_t i = 0; i < buffers; i++) pFree.push_back(i);
+
+		pReady.assign(buffers, 0);
+		pFrameNumbers.assign(buffers, 0);
+		pReadyHead = 0;
+		pReadyCount = 0;
+
+		pStats = CaptureStats();
+		pTotalCopyTime = 0.0;
+
+		pEncoder.SetParallel(false);
+
+		pStop = false;
+		pActive = true;
+		pThread = std::thread(&FrameCapture::pEncoderThread, this);
+	}
+
+	inline void FrameCapture::Stop() {
+		if(!pThread.joinable()) return;
+
+		{
+			std::lock_guard<std::mutex> lock(pMutex);
+			pStop = true;
+		}
+
+		pWake.notify_one();
+		pThread.join();
+
+		if(pFile.is_open()) pFile.close();
+		pActive = false;
+	}
+
+	inline bool FrameCapture::Submit(const Pixel* frame) {
+		auto start = std::chrono::steady_clock::now();
+
+		uint32_t buffer;
+		uint64_t number;
+
+		{
+			std::lock_guard<std::mutex> lock(pMutex);
+			number = pStats.submitted++;
+
+			if(pFree.empty()) {
+				pStats.dropped++;
+				return false;
+			}
+
+			buffer = pFree.back();
+			pFree.pop_back();
+		}
+
+		memcpy(pBuffers[buffer].data(), frame, pSize.prod() * sizeof(Pixel));
+
+		float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+		{
+			std::lock_guard<std::mutex> lock(pMutex);
+
+			size_t slot = (pReadyHead + pReadyCount++) % pReady.size();
+			pReady[slot] = buffer;
+			pFrameNumbers[slot] = number;
+
+			pStats.copyTime = elapsed;
+			pTotalCopyTime += elapsed;
+			pStats.averageCopyTime = (float) (pTotalCopyTime / (pStats.submitted - pStats.dropped));
+		}
+
+		pWake.notify_one();
+		return true;
+	}
+
+	inline bool FrameCapture::Active() const {
+		return pActive;
+	}
+
+	inline CaptureStats FrameCapture::Stats() const {
+		std::lock_guard<std::mutex> lock(pMutex);
+		return pStats;
+	}
+
+	inline void FrameCapture::pEncoderThread() {
+		std::unique_lock<std::mutex> lock(pMutex);
+
+		while(true) {
+			pWake.wait(lock, [&] { return pStop || pReadyCount > 0; });
+
+			// Frames already handed over are still written after Stop
+			if(pReadyCount == 0) return;
+
+			uint32_t buffer = pReady[pReadyHead];
+			uint64_t number = pFrameNumbers[pReadyHead];
+
+			pReadyHead = (pReadyHead + 1) % pReady.size();
+			pReadyCount--;
+
+			lock.unlock();
+
+			auto start = std::chrono::steady_clock::now();
+			bool written = pWrite(pBuffers[buffer].data(), number);
+			float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+			lock.lock();
+
+			pFree.push_back(buffer);
+			pStats.encodeTime = elapsed;
+
+			if(written) pStats.written++;
+			else pStats.failed++;
+		}
+	}
+
+	inline bool FrameCapture::pWrite(const Pixel* frame, uint64_t number) {
+		size_t count = pSize.prod();
+
+		switch(pFormat) {
+			case CaptureFormat::Y4M:
+			{
+				pPlanes.resize(count * 3);
+
+				uint8_t* y = pPlanes.data();
+				uint8_t* u = y + count;
+				uint8_t* v = u + count;
+
+				for(size_t i = 0; i < count; i++) {
+					int r = frame[i].r, g = frame[i].g, b = frame[i].b;
+
+					y[i] = (uint8_t) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+					u[i] = (uint8_t) (((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+					v[i] = (uint8_t) (((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+				}
+
+				pFile.write("FRAME\n", 6);
+				pFile.write(reinterpret_cast<const char*>(pPlanes.data()), pPlanes.size());
+				return (bool) pFile;
+			}
+			case CaptureFormat::RAW:
+			{
+				pFile.write(reinterpret_cast<const char*>(frame), count * sizeof(Pixel));
+				return (bool) pFile;
+			}
+			case CaptureFormat::IMAGES:
+			{
+				static const char* extensions[3] = { ".qoi", ".bmp", ".png" };
+
+				char digits[24];
+				auto result = std::to_chars(digits, digits + sizeof(digits), number);
+
+				std::string name = pPath;
+				name.append(6 - (std::min)((size_t) (result.ptr - digits), (size_t) 6), '0');
+				name.append(digits, result.ptr);
+				name += extensions[(int) pImageFormat];
+
+				try {
+					pEncoder.Save(name, frame, pSize, pImageFormat, true);
+				} catch(const std::runtime_error&) {
+					return false;
+				}
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/*
+		FrameStream sends the screen over a named pipe, \\.\pipe\<name>,
+		to one viewer at a time. Each frame is compared to the last one sent
+		in tiles, and only the tiles that changed go out, each as its own
+		run of QOI operations. A frame is a StreamHeader followed by its
+		payload, every tile being a u16 column, a u16 row, a u32 length and
+		the operations, all little endian.
+
+		Encoding happens on the calling thread, writing on a thread of its
+		own. While a write is still in flight new frames are dropped without
+		being encoded, and because the comparison is against the last frame
+		actually sent, their changes are picked up by the next one that
+		goes out. A slow viewer lowers the frame rate, it never stalls the
+		application. Every new connection starts with a keyframe.
+	*/
+
+	inline FrameStream::~FrameStream() {
+		Stop();
+	}
+
+	inline void FrameStream::Start(const std::string& name, const vu2d& size, uint32_t tileSize) {
+		Stop();
+
+		if(tileSize == 0 || tileSize > 0xFFFF) {
+			throw std::runtime_error("Invalid stream tile size.");
+		}
+
+		std::string path = "\\\\.\\pipe\\" + name;
+		pPipe = CreateNamedPipeA(path.c_str(), PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_WAIT, 1, 1 << 20, 0, 0, NULL);
+
+		if(pPipe == INVALID_HANDLE_VALUE) {
+			throw std::runtime_error("Failed to create the stream pipe.");
+		}
+
+		pIoEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+		pStopEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+		pSize = size;
+		pTileSize = tileSize;
+		pTiles = vu2d((size.x + tileSize - 1) / tileSize, (size.y + tileSize - 1) / tileSize);
+
+		// Worst case buffers up front, so streaming itself never allocates
+		size_t rowBytes = (size_t) pTiles.x * (8 + (size_t) tileSize * tileSize * 5);
+
+		pSent.assign(size.prod(), Pixel(0, 0, 0, 0));
+		pRows.resize(pTiles.y);
+		for(auto& row : pRows) row.resize(rowBytes);
+
+		pRowBytes.assign(pTiles.y, 0);
+		pRowTiles.assign(pTiles.y, 0);
+		pPacket.resize(sizeof(StreamHeader) + rowBytes * pTiles.y);
+		pPacketBytes = 0;
+
+		pStats = StreamStats();
+
+		pStop = false;
+		pBusy = false;
+		pKeyframe = true;
+		pActive = true;
+		pThread = std::thread(&FrameStream::pWriterThread, this);
+	}
+
+	inline void FrameStream::Stop() {
+		if(!pThread.joinable()) return;
+
+		{
+			std::lock_guard<std::mutex> lock(pMutex);
+			pStop = true;
+		}
+
+		SetEvent(pStopEvent);
+		pWake.notify_one();
+		pThread.join();
+
+		CloseHandle(pPipe);
+		CloseHandle(pIoEvent);
+		CloseHandle(pStopEvent);
+
+		pPipe = INVALID_HANDLE_VALUE;
+		pIoEvent = NULL;
+		pStopEvent = NULL;
+
+		pActive = false;
+	}
+
+	inline bool FrameStream::Submit(const Pixel* frame) {
+		bool keyframe;
+
+		{
+			std::lock_guard<std::mutex> lock(pMutex);
+			pStats.submitted++;
+
+			if(!pStats.connected) return false;
+
+			if(pBusy) {
+				pStats.dropped++;
+				return false;
+			}
+
+			keyframe = pKeyframe;
+			pKeyframe = false;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		uint32_t w = pSize.x, h = pSize.y, t = pTileSize;
+		std::atomic<size_t> raw = 0;
+
+		Workers().ParallelFor(pTiles.y, 1, [&] (uint32_t begin, uint32_t end) {
+			for(uint32_t ty = begin; ty < end; ty++) {
+				uint8_t* out = pRows[ty].data();
+				uint32_t tiles = 0;
+				size_t bytes = 0;
+
+				uint32_t y1 = ty * t, th = (std::min)(t, h - y1);
+
+				for(uint32_t tx = 0; tx < pTiles.x; tx++) {
+					uint32_t x1 = tx * t, tw = (std::min)(t, w - x1);
+					size_t origin = (size_t) y1 * w + x1;
+
+					bool changed = keyframe;
+
+					for(uint32_t y = 0; y < th && !changed; y++) {
+						changed = memcmp(frame + origin + (size_t) y * w, pSent.data() + origin + (size_t) y * w, tw * sizeof(Pixel)) != 0;
+					}
+
+					if(!changed) continue;
+
+					for(uint32_t y = 0; y < th; y++) {
+						memcpy(pSent.data() + origin + (size_t) y * w, frame + origin + (size_t) y * w, tw * sizeof(Pixel));
+					}
+
+					uint32_t length = (uint32_t) EncodeQoiOps(pSent.data() + origin, w, vu2d(tw, th), out + 8);
+					uint16_t column = (uint16_t) tx, row = (uint16_t) ty;
+
+					memcpy(out + 0, &column, 2);
+					memcpy(out + 2, &row, 2);
+					memcpy(out + 4, &length, 4);
+
+					out += 8 + length;
+					bytes += 8 + length;
+					tiles++;
+
+					raw += (size_t) tw * th * sizeof(Pixel);
+				}
+
+				pRowBytes[ty] = bytes;
+				pRowTiles[ty] = tiles;
+			}
+		});
+
+		StreamHeader header = { StreamMagic, w, h, (uint16_t) t, (uint16_t) (keyframe ? StreamKeyframe : 0), 0, 0 };
+		uint8_t* out = pPacket.data() + sizeof(StreamHeader);
+
+		for(uint32_t ty = 0; ty < pTiles.y; ty++) {
+			memcpy(out, pRows[ty].data(), pRowBytes[ty]);
+			out += pRowBytes[ty];
+
+			header.tiles += pRowTiles[ty];
+			header.payload += (uint32_t) pRowBytes[ty];
+		}
+
+		memcpy(pPacket.data(), &header, sizeof(StreamHeader));
+
+		float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+		{
+			std::lock_guard<std::mutex> lock(pMutex);
+
+			pStats.encodeTime = elapsed;
+			pStats.tiles = header.tiles;
+			pStats.rawBytes = raw;
+
+			if(header.tiles == 0) {
+				pStats.bytes = 0;
+				pStats.unchanged++;
+				return true;
+			}
+
+			pPacketBytes = sizeof(StreamHeader) + header.payload;
+			pStats.bytes = pPacketBytes;
+			pBusy = true;
+		}
+
+		pWake.notify_one();
+		return true;
+	}
+
+	inline bool FrameStream::Active() const {
+		return pActive;
+	}
+
+	inline StreamStats FrameStream::Stats() const {
+		std::lock_guard<std::mutex> lock(pMutex);
+		return pStats;
+	}
+
+	inline bool FrameStream::pWait(OVERLAPPED& overlapped, DWORD& transferred) {
+		HANDLE handles[2] = { overlapped.hEvent, pStopEvent };
+
+		if(WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+			CancelIo(pPipe);
+			GetOverlappedResult(pPipe, &overlapped, &transferred, TRUE);
+			return false;
+		}
+
+		return GetOverlappedResult(pPipe, &overlapped, &transferred, FALSE) != 0;
+	}
+
+	inline void FrameStream::pWriterThread() {
+		while(true) {
+			OVERLAPPED overlapped = {};
+			overlapped.hEvent = pIoEvent;
+			ResetEvent(pIoEvent);
+
+			DWORD transferred = 0;
+
+			if(!ConnectNamedPipe(pPipe, &overlapped)) {
+				DWORD error = GetLastError();
+
+				if(error == ERROR_IO_PENDING) {
+					if(!pWait(overlapped, transferred)) return;
+				} else if(error != ERROR_PIPE_CONNECTED) {
+					return;
+				}
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(pMutex);
+				pStats.connected = true;
+				pKeyframe = true;
+			}
+
+			bool failed = false;
+
+			while(!failed) {
+				{
+					std::unique_lock<std::mutex> lock(pMutex);
+					pWake.wait(lock, [&] { return pStop || pBusy; });
+
+					if(pStop) return;
+				}
+
+				size_t written = 0;
+
+				while(written < pPacketBytes) {
+					overlapped = {};
+					overlapped.hEvent = pIoEvent;
+					ResetEvent(pIoEvent);
+
+					DWORD length = (DWORD) (std::min)(pPacketBytes - written, (size_t) 1 << 20);
+
+					if(!WriteFile(pPipe, pPacket.data() + written, length, &transferred, &overlapped)) {
+						if(GetLastError() != ERROR_IO_PENDING) {
+							failed = true;
+							break;
+						}
+
+						if(!pWait(overlapped, transferred)) {
+							// Stopped while the viewer was not reading
+							if(WaitForSingleObject(pStopEvent, 0) == WAIT_OBJECT_0) return;
+
+							failed = true;
+							break;
+						}
+					}
+
+					written += transferred;
+				}
+
+				std::lock_guard<std::mutex> lock(pMutex);
+				pBusy = false;
+
+				if(!failed) {
+					pStats.sent++;
+					pStats.totalBytes += written;
+				}
+			}
+
+			// The viewer went away, wait for the next one
+			DisconnectNamedPipe(pPipe);
+
+			std::lock_guard<std::mutex> lock(pMutex);
+			pStats.connected = false;
+		}
+	}
+
+	/*
+		The viewer side of FrameStream: applies the tiles of one frame to a
+		full size buffer. Returns false, leaving the buffer partially
+		updated, when the payload does not match the header.
+	*/
+
+	inline bool ApplyStreamFrame(const StreamHeader& header, const uint8_t* payload, Pixel* frame) {
+		if(header.magic != StreamMagic || header.tileSize == 0) return false;
+
+		const uint8_t* in = payload;
+		const uint8_t* end = payload + header.payload;
+
+		uint32_t t = header.tileSize;
+
+		for(uint32_t i = 0; i < header.tiles; i++) {
+			if(end - in < 8) return false;
+
+			uint16_t column, row;
+			uint32_t length;
+
+			memcpy(&column, in + 0, 2);
+			memcpy(&row, in + 2, 2);
+			memcpy(&length, in + 4, 4);
+			in += 8;
+
+			uint32_t x1 = column * t, y1 = row * t;
+
+			if(x1 >= header.width || y1 >= header.height || (size_t) (end - in) < length) return false;
+
+			vu2d size((std::min)(t, header.width - x1), (std::min)(t, header.height - y1));
+
+			if(DecodeQoiOps(in, length, frame + (size_t) y1 * header.width + x1, header.width, size) != length) return false;
+			in += length;
+		}
+
+		return in == end;
+	}
+
+	inline bool ApplyStreamFrame(const StreamHeader& header, const uint8_t* payload, Sprite* frame) {
+		if(!frame->pBuffer || frame->pSize.x != header.width || frame->pSize.y != header.height) return false;
+
+		bool applied = ApplyStreamFrame(header, payload, frame->pBuffer);
+		frame->pMarkDirty();
+
+		return applied;
+	}
+
+	/*
+		A recording is a small header followed by one record per frame:
+
+			header	u32 magic 'PXRC', u16 version, u16 flags (1 = hashes),
+					u32 width, u32 height
+			record	u8 contents, f32 elapsed time,
+					[u16 mouse x, u16 mouse y] if contents & 1,
+					[u32 mouse wheel] if contents & 2,
+					[u16 count, count * u16 input] if contents & 4,
+					[u64 frame hash] if the header says so
+
+		An input is a key (0 to 255) or a mouse button (256 to 258), with the
+		top bit set when it went down. Only changes are stored, so a frame
+		where nothing happened costs five bytes, thirteen with its hash.
+		Input is sampled once per frame, exactly as the engine sees it,
+		which is what makes a replay deterministic. Sessions should be
+		recorded and replayed from OnCreate so they start from the same
+		state. One started during OnUpdate only takes over from the next
+		frame, since the input of the current one was already sampled.
+	*/
+
+	static constexpr uint32_t RecordingMagic = 0x43525850;
+	static constexpr uint16_t RecordingVersion = 1;
+
+	inline SessionRecorder::~SessionRecorder() {
+		Stop();
+	}
+
+	inline void SessionRecorder::Start(const std::string& path, const vu2d& size, bool hashFrames) {
+		Stop();
+
+		pFile.open(path, std::ios::binary);
+
+		if(!pFile) {
+			throw std::runtime_error("Failed to open the recording file.");
+		}
+
+		uint32_t header[4] = { RecordingMagic, RecordingVersion | ((hashFrames ? 1u : 0u) << 16), size.x, size.y };
+		pFile.write((const char*) header, sizeof(header));
+
+		pRecord.reserve(5 + 4 + 4 + 2 + 259 * 2 + 8);
+		memset(pInput, 0, sizeof(pInput));
+
+		pSize = size;
+		pHashFrames = hashFrames;
+		pFrames = 0;
+		pSampled = false;
+		pActive = true;
+	}
+
+	inline void SessionRecorder::Stop() {
+		if(!pActive) return;
+
+		pFile.close();
+		pActive = false;
+	}
+
+	inline void SessionRecorder::RecordInput(float elapsed, const bool* keys, const bool* buttons, const vu2d& mouse, uint32_t wheel) {
+		pRecord.assign(5, 0);
+		memcpy(pRecord.data() + 1, &elapsed, 4);
+
+		auto put = [&] (const void* data, size_t size) {
+			pRecord.insert(pRecord.end(), (const uint8_t*) data, (const uint8_t*) data + size);
+		};
+
+		if(pFrames == 0 || mouse.x != pMouse.x || mouse.y != pMouse.y) {
+			uint16_t position[2] = { (uint16_t) mouse.x, (uint16_t) mouse.y };
+			put(position, 4);
+
+			pRecord[0] |= 1;
+			pMouse = mouse;
+		}
+
+		if(pFrames == 0 || wheel != pWheel) {
+			put(&wheel, 4);
+
+			pRecord[0] |= 2;
+			pWheel = wheel;
+		}
+
+		size_t countAt = pRecord.size();
+		uint16_t count = 0;
+		put(&count, 2);
+
+		for(uint16_t i = 0; i < 259; i++) {
+			bool down = i < 256 ? keys[i] : buttons[i - 256];
+			if(down == pInput[i]) continue;
+
+			uint16_t input = i | (down ? 0x8000 : 0);
+			put(&input, 2);
+
+			pInput[i] = down;
+			count++;
+		}
+
+		if(count) {
+			memcpy(pRecord.data() + countAt, &count, 2);
+			pRecord[0] |= 4;
+		} else {
+			pRecord.resize(countAt);
+		}
+
+		pSampled = true;
+	}
+
+	inline void SessionRecorder::RecordFrame(const Pixel* frame) {
+		if(pHashFrames) {
+			uint64_t hash = HashFrame(frame, pSize.prod());
+			pRecord.insert(pRecord.end(), (const uint8_t*) &hash, (const uint8_t*) &hash + 8);
+		}
+
+		pFile.write((const char*) pRecord.data(), pRecord.size());
+		pFrames++;
+		pSampled = false;
+	}
+
+	inline bool SessionRecorder::Active() const {
+		return pActive;
+	}
+
+	inline bool SessionRecorder::Sampled() const {
+		return pActive && pSampled;
+	}
+
+	inline bool SessionRecorder::HashesFrames() const {
+		return pHashFrames;
+	}
+
+	inline uint64_t SessionRecorder::Frames() const {
+		return pFrames;
+	}
+
+	/*
+		The player reads the whole recording up front and checks every
+		record, so nothing can fail and no file access happens while the
+		session is being timed.
+	*/
+
+	inline void SessionPlayer::Start(const std::string& path, const vu2d& size, ReplaySpeed speed) {
+		Stop();
+
+		std::ifstream file(path, std::ios::binary);
+
+		if(!file) {
+			throw std::runtime_error("Failed to open the recording file.");
+		}
+
+		pData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+		uint32_t header[4];
+
+		if(pData.size() < sizeof(header)) {
+			throw std::runtime_error("Invalid recording.");
+		}
+
+		memcpy(header, pData.data(), sizeof(header));
+
+		if(header[0] != RecordingMagic || (header[1] & 0xFFFF) != RecordingVersion) {
+			throw std::runtime_error("Invalid recording.");
+		}
+
+		if(header[2] != size.x || header[3] != size.y) {
+			throw std::runtime_error("Recording does not match the screen size.");
+		}
+
+		pHashFrames = (header[1] >> 16) & 1;
+		pSize = size;
+		pCursor = sizeof(header);
+
+		pStats = ReplayStats();
+
+		for(size_t cursor = pCursor; cursor < pData.size(); pStats.frames++) {
+			cursor = pSkipRecord(cursor);
+
+			if(cursor == 0) {
+				throw std::runtime_error("Invalid recording.");
+			}
+		}
+
+		pTimes.clear();
+		pTimes.reserve(pStats.frames);
+
+		pSpeed = speed;
+		pSampled = false;
+		pActive = pStats.frames > 0;
+	}
+
+	inline void SessionPlayer::Stop() {
+		pActive = false;
+
+		pData.clear();
+		pData.shrink_to_fit();
+	}
+
+	inline size_t SessionPlayer::pSkipRecord(size_t cursor) const {
+		if(pData.size() - cursor < 5) return 0;
+
+		uint8_t contents = pData[cursor];
+		cursor += 5;
+
+		if(contents & 1) cursor += 4;
+		if(contents & 2) cursor += 4;
+
+		if(contents & 4) {
+			if(cursor > pData.size() || pData.size() - cursor < 2) return 0;
+
+			uint16_t count;
+			memcpy(&count, pData.data() + cursor, 2);
+			cursor += 2 + count * 2;
+		}
+
+		if(pHashFrames) cursor += 8;
+
+		return cursor <= pData.size() ? cursor : 0;
+	}
+
+	inline float SessionPlayer::NextElapsed() const {
+		float elapsed;
+		memcpy(&elapsed, pData.data() + pCursor + 1, 4);
+
+		return elapsed;
+	}
+
+	inline void SessionPlayer::ReadInput(float& elapsed, bool* keys, bool* buttons, vu2d& mouse, uint32_t& wheel) {
+		const uint8_t* in = pData.data() + pCursor;
+		uint8_t contents = *in++;
+
+		memcpy(&elapsed, in, 4);
+		in += 4;
+
+		if(contents & 1) {
+			uint16_t position[2];
+			memcpy(position, in, 4);
+			in += 4;
+
+			mouse = vu2d(position[0], position[1]);
+		}
+
+		if(contents & 2) {
+			memcpy(&wheel, in, 4);
+			in += 4;
+		}
+
+		if(contents & 4) {
+			uint16_t count;
+			memcpy(&count, in, 2);
+			in += 2;
+
+			for(uint16_t i = 0; i < count; i++, in += 2) {
+				uint16_t input;
+				memcpy(&input, in, 2);
+
+				uint16_t index = input & 0x7FFF;
+				bool down = (input & 0x8000) != 0;
+
+				if(index < 256) keys[index] = down;
+				else if(index < 259) buttons[index - 256] = down;
+			}
+		}
+
+		if(pHashFrames) {
+			memcpy(&pHash, in, 8);
+			in += 8;
+		}
+
+		pCursor = in - pData.data();
+		pSampled = true;
+	}
+
+	inline void SessionPlayer::EndFrame(double frameTime, const Pixel* frame) {
+		pSampled = false;
+
+		pTimes.push_back((float) frameTime);
+		pStats.totalTime += frameTime;
+		pStats.played++;
+
+		if(frame) {
+			pStats.verified++;
+
+			if(HashFrame(frame, pSize.prod()) != pHash) {
+				if(pStats.mismatches == 0) pStats.firstMismatch = pStats.played - 1;
+				pStats.mismatches++;
+			}
+		}
+	}
+
+	inline bool SessionPlayer::Active() const {
+		return pActive;
+	}
+
+	inline bool SessionPlayer::Sampled() const {
+		return pActive && pSampled;
+	}
+
+	inline bool SessionPlayer::Finished() const {
+		return pCursor >= pData.size();
+	}
+
+	inline bool SessionPlayer::VerifiesFrames() const {
+		return pHashFrames;
+	}
+
+	inline ReplaySpeed SessionPlayer::Speed() const {
+		return pSpeed;
+	}
+
+	inline ReplayStats SessionPlayer::Stats() const {
+		ReplayStats stats = pStats;
+		if(pTimes.empty()) return stats;
+
+		std::vector<float> times = pTimes;
+		std::sort(times.begin(), times.end());
+
+		auto percentile = [&] (double p) {
+			return (double) times[(std::min)((size_t) (p * times.size()), times.size() - 1)];
+		};
+
+		stats.averageTime = stats.totalTime / times.size();
+		stats.medianTime = percentile(0.5);
+		stats.p95Time = percentile(0.95);
+		stats.p99Time = percentile(0.99);
+		stats.maxTime = times.back();
+
+		return stats;
+	}
+
+	inline Sprite::Sprite(const std::string& filename, SpriteFilter filter) {
+		pFilter = filter;
+
+		Gdiplus::Bitmap* bmp = Gdiplus::Bitmap::FromFile(s2ws(filename).c_str());
+		Gdiplus::Color color;
+
+		if(bmp->GetLastStatus() != Gdiplus::Ok) {
+			pSize = vu2d(0, 0);
+			delete bmp;
+			return;
+		}
+
+		pSize = vu2d(bmp->GetWidth(), bmp->GetHeight());
+		pUvScale = vf2d(1.0f / float(pSize.x), 1.0f / float(pSize.y));
+		pBuffer = new Pixel[pSize.prod()];
+	
+		for(uint32_t i = 0; i < pSize.prod(); i++) {
+			bmp->GetPixel(i % pSize.x, i / pSize.x, &color);
+			pBuffer[i] = Pixel(color.GetRed(), color.GetGreen(), color.GetBlue(), color.GetAlpha());
+		}
+
+		if(pFilter == SpriteFilter::TRILINEAR) {
+			pBuildMips();
+		}
+
+		pCreateTexture();
+		pApplyTexture();
+		pUploadTexture();
+
+		delete bmp;
+	}
+
+	inline Sprite::Sprite(const vu2d& size, SpriteFilter filter) {
+		if(size.x == 0 || size.y == 0) {
+			throw std::runtime_error("Invalid sprite proportions.");
+		}
+
+		pFilter = filter;
+
+		pSize = size;
+		pUvScale = vf2d(1.0f / float(pSize.x), 1.0f / float(pSize.y));
+		pBuffer = new Pixel[pSize.prod()];
+
+		std::fill_n(pBuffer, pSize.prod(), Pixel(0, 0, 0, 0));
+
+		if(pFilter == SpriteFilter::TRILINEAR) {
+			pBuildMips();
+		}
+
+		pCreateTexture();
+		pApplyTexture();
+		pUploadTexture();
+	}
+
+	inline Sprite::~Sprite() {
+		if(pBuffer) {
+			delete[] pBuffer;
+		}
+
+		if(pBufferId != 0xFFFFFFFF) {
+			pDeleteTexture();
+		}
+	}
+
+	inline void pixel::Sprite::Update() {
+		if(!pBuffer) {
+			throw std::runtime_error("Sprite has no pixel data.");
+		}
+
+		if(pBufferId != 0xFFFFFFFF) {
+			pDeleteTexture();
+		}
+
+		pCreateTexture();
+		pApplyTexture();
+		pUploadTexture();
+
+		pDirty = false;
+	}
+
+	inline void Sprite::pCreateTexture() {
+		glGenTextures(1, &pBufferId);
+		glBindTexture(GL_TEXTURE_2D, pBufferId);
+
+		if(pFilter == SpriteFilter::NEAREST) {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		} else {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, pFilter == SpriteFilter::TRILINEAR ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+
+		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+	}
+
+	inline void Sprite::pDeleteTexture() {
+		glDeleteTextures(1, &pBufferId);
+	}
+
+	inline void Sprite::pUploadTexture() {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pSize.x, pSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pBuffer);
+
+		if(pFilter == SpriteFilter::TRILINEAR) {
+			for(uint32_t i = 1; i < pMipLevels.size(); i++) {
+				const MipLevel& level = pMipLevels[i];
+				glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, level.size.x, level.size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pMipData.data() + level.offset);
+			}
+		}
+	}
+
+	inline void Sprite::pApplyTexture() {
+		glBindTexture(GL_TEXTURE_2D, pBufferId);
+	}
+
+	/*
+		Sprites used as draw targets only reach the GPU again the next time
+		they are drawn through it, and only if something was rendered into
+		them. The texture is updated in place rather than recreated.
+	*/
+
+	inline void Sprite::pRefreshTexture() {
+		if(pBufferId == 0xFFFFFFFF) {
+			Update();
+			return;
+		}
+
+		pApplyTexture();
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, pSize.x, pSize.y, GL_RGBA, GL_UNSIGNED_BYTE, pBuffer);
+
+		if(pFilter == SpriteFilter::TRILINEAR) {
+			for(uint32_t i = 1; i < pMipLevels.size(); i++) {
+				const MipLevel& level = pMipLevels[i];
+				glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, level.size.x, level.size.y, GL_RGBA, GL_UNSIGNED_BYTE, pMipData.data() + level.offset);
+			}
+		}
+
+		pDirty = false;
+	}
+
+	inline void Sprite::pMarkDirty() {
+		// Runs and mips were built from the old pixels
+		if(HasRle()) {
+			pRleRows.clear();
+			pRleRuns.clear();
+			pRlePixels.clear();
+			pRlePixelRows.clear();
+			pRleStats = RleStats();
+		}
+
+		if(pFilter == SpriteFilter::TRILINEAR) {
+			pBuildMips();
+		}
+
+		pDirty = true;
+		pVersion++;
+	}
+
+	inline vu2d Sprite::Size() const {
+		return pSize;
+	}
+
+	inline SpriteFilter Sprite::Filter() const {
+		return pFilter;
+	}
+
+	inline const MipStats& Sprite::Mips() const {
+		return pMipStats;
+	}
+
+	inline bool Sprite::HasCpuCopy() const {
+		return pBuffer != nullptr;
+	}
+
+	/*
+		Once uploaded, a sprite that is only ever drawn through the GPU does
+		not need its pixels on the CPU. Releasing them also drops the runs and
+		mips built from them, CPU blits of the sprite then draw nothing.
+	*/
+
+	inline void Sprite::ReleaseCpuCopy() {
+		if(!pBuffer) return;
+
+		if(pBufferId == 0xFFFFFFFF || pDirty) {
+			throw std::runtime_error("Sprite must be uploaded before releasing its pixels.");
+		}
+
+		delete[] pBuffer;
+		pBuffer = nullptr;
+		pVersion++;
+
+		pRleRows = std::vector<uint32_t>();
+		pRleRuns = std::vector<Run>();
+		pRlePixels = std::vector<Pixel>();
+		pRlePixelRows = std::vector<uint32_t>();
+
+		pMipData = std::vector<Pixel>();
+	}
+
+	inline size_t Sprite::CpuBytes() const {
+		if(!pBuffer) return 0;
+
+		return (size_t) pSize.prod() * sizeof(Pixel) + pMipData.size() * sizeof(Pixel) +
+			pRleRuns.size() * sizeof(Run) + pRlePixels.size() * sizeof(Pixel) + (pRleRows.size() + pRlePixelRows.size()) * sizeof(uint32_t);
+	}
+
+	inline size_t Sprite::GpuBytes() const {
+		if(pBufferId == 0xFFFFFFFF) return 0;
+
+		size_t bytes = (size_t) pSize.prod() * sizeof(Pixel);
+
+		for(uint32_t i = 1; i < pMipLevels.size(); i++) {
+			bytes += (size_t) pMipLevels[i].size.prod() * sizeof(Pixel);
+		}
+
+		return bytes;
+	}
+
+	inline void Sprite::Save(const std::string& filename, ImageFormat format, bool fast) const {
+		if(!pBuffer) {
+			throw std::runtime_error("Cannot save an empty sprite.");
+		}
+
+		ImageEncoder encoder;
+		encoder.Save(filename, pBuffer, pSize, format, fast);
+	}
+
+	inline void Sprite::SetFilter(SpriteFilter filter) {
+		if(filter == pFilter) return;
+
+		if(!pBuffer) {
+			throw std::runtime_error("Sprite has no pixel data.");
+		}
+		pFilter = filter;
+
+		if(pFilter == SpriteFilter::TRILINEAR) {
+			pBuildMips();
+		} else {
+			pMipData = std::vector<Pixel>();
+			pMipLevels.clear();
+			pMipStats = MipStats();
+		}
+
+		if(pBufferId != 0xFFFFFFFF) {
+			Update();
+		}
+	}
+
+	inline void Sprite::pBuildMips() {
+		auto start = std::chrono::steady_clock::now();
+
+		pMipLevels.clear();
+		pMipLevels.push_back({ pSize, 0 });
+
+		size_t total = 0;
+		for(vu2d size = pSize; size.x > 1 || size.y > 1;) {
+			size = vu2d((std::max)(size.x / 2, 1u), (std::max)(size.y / 2, 1u));
+			pMipLevels.push_back({ size, total });
+			total += size.prod();
+		}
+
+		pMipData.resize(total);
+
+		for(uint32_t i = 1; i < pMipLevels.size(); i++) {
+			vu2d ss, ds = pMipLevels[i].size;
+			const Pixel* src = pLevel(i - 1, ss);
+			Pixel* dst = pMipData.data() + pMipLevels[i].offset;
+
+			// 2x2 box filter, odd edges reuse the last row or column
+			for(uint32_t y = 0; y < ds.y; y++) {
+				const Pixel* r0 = src + (std::min)(2 * y, ss.y - 1) * ss.x;
+				const Pixel* r1 = src + (std::min)(2 * y + 1, ss.y - 1) * ss.x;
+				Pixel* out = dst + y * ds.x;
+				uint32_t x = 0;
+
+			#ifdef PIXEL_SSE2
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i two = _mm_set1_epi16(2);
+
+				for(; x + 2 <= ds.x && 2 * x + 4 <= ss.x; x += 2) {
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + 2 * x));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + 2 * x));
+
+					__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+					__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+
+					lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+					hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+					__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+					_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(sum, zero));
+				}
+			#endif
+
+				for(; x < ds.x; x++) {
+					uint32_t x0 = (std::min)(2 * x, ss.x - 1), x1 = (std::min)(2 * x + 1, ss.x - 1);
+					const Pixel &a = r0[x0], &b = r0[x1], &c = r1[x0], &d = r1[x1];
+
+					out[x] = Pixel((a.r + b.r + c.r + d.r + 2) >> 2, (a.g + b.g + c.g + d.g + 2) >> 2,
+								   (a.b + b.b + c.b + d.b + 2) >> 2, (a.a + b.a + c.a + d.a + 2) >> 2);
+				}
+			}
+		}
+
+		pMipStats.levels = (uint32_t) pMipLevels.size();
+		pMipStats.bytes = total * sizeof(Pixel);
+		pMipStats.buildTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline const Pixel* Sprite::pLevel(uint32_t level, vu2d& size) const {
+		if(level == 0 || pMipLevels.empty()) {
+			size = pSize;
+			return pBuffer;
+		}
+
+		level = (std::min)(level, (uint32_t) pMipLevels.size() - 1);
+		size = pMipLevels[level].size;
+		return pMipData.data() + pMipLevels[level].offset;
+	}
+
+	inline Pixel Sprite::pSampleBilinear(const Pixel* data, const vu2d& size, int32_t fx, int32_t fy) const {
+		int32_t x0 = fx >> 16, y0 = fy >> 16;
+		int32_t wx = (fx >> 9) & 0x7F, wy = (fy >> 9) & 0x7F;
+
+		int32_t x1 = x0 + 1, y1 = y0 + 1;
+		int32_t mx = size.x - 1, my = size.y - 1;
+
+		x0 = x0 < 0 ? 0 : (x0 > mx ? mx : x0); x1 = x1 < 0 ? 0 : (x1 > mx ? mx : x1);
+		y0 = y0 < 0 ? 0 : (y0 > my ? my : y0); y1 = y1 < 0 ? 0 : (y1 > my ? my : y1);
+
+		const Pixel* r0 = data + y0 * size.x;
+		const Pixel* r1 = data + y1 * size.x;
+
+	#ifdef PIXEL_SSE2
+		const __m128i zero = _mm_setzero_si128();
+
+		__m128i left = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, r1[x0].n, r0[x0].n), zero);
+		__m128i right = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, r1[x1].n, r0[x1].n), zero);
+
+		__m128i h = _mm_add_epi16(left, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(right, left), _mm_set1_epi16((short) wx)), 7));
+		__m128i t = _mm_srli_si128(h, 8);
+		__m128i v = _mm_add_epi16(h, _mm_srai_epi16(_mm_mullo_epi16(_mm_sub_epi16(t, h), _mm_set1_epi16((short) wy)), 7));
+
+		return Pixel((uint32_t) _mm_cvtsi128_si32(_mm_packus_epi16(v, zero)));
+	#else
+		auto lerp = [] (int32_t a, int32_t b, int32_t w) {
+			return a + (((b - a) * w) >> 7);
+		};
+
+		const Pixel &a = r0[x0], &b = r0[x1], &c = r1[x0], &d = r1[x1];
+
+		return Pixel(lerp(lerp(a.r, b.r, wx), lerp(c.r, d.r, wx), wy), lerp(lerp(a.g, b.g, wx), lerp(c.g, d.g, wx), wy),
+					 lerp(lerp(a.b, b.b, wx), lerp(c.b, d.b, wx), wy), lerp(lerp(a.a, b.a, wx), lerp(c.a, d.a, wx), wy));
+	#endif
+	}
+
+	inline bool Sprite::HasRle() const {
+		return !pRleRows.empty();
+	}
+
+	inline const RleStats& Sprite::Rle() const {
+		return pRleStats;
+	}
+
+	inline void Sprite::BuildRle() {
+		pRleRows.clear();
+		pRleRuns.clear();
+		pRlePixels.clear();
+		pRlePixelRows.clear();
+		pRleStats = RleStats();
+
+		if(!pBuffer) return;
+
+		auto kindOf = [] (const Pixel& p) {
+			return p.a == 0 ? RunKind::SKIP : (p.a == 255 ? RunKind::COPY : RunKind::BLEND);
+		};
+
+		pRleRows.reserve(pSize.y + 1);
+		pRlePixelRows.reserve(pSize.y + 1);
+
+		for(uint32_t y = 0; y < pSize.y; y++) {
+			const Pixel* row = pBuffer + y * pSize.x;
+
+			pRleRows.push_back((uint32_t) pRleRuns.size());
+			pRlePixelRows.push_back((uint32_t) pRlePixels.size());
+
+			for(uint32_t x = 0; x < pSize.x;) {
+				RunKind kind = kindOf(row[x]);
+				uint32_t start = x;
+
+				while(x < pSize.x && x - start < 0xFFFF && kindOf(row[x]) == kind) x++;
+
+				pRleRuns.push_back({ kind, (uint16_t) (x - start) });
+
+				if(kind == RunKind::SKIP) {
+					pRleStats.transparentRuns++;
+				} else {
+					pRlePixels.insert(pRlePixels.end(), row + start, row + x);
+					if(kind == RunKind::COPY) pRleStats.opaqueRuns++;
+					else pRleStats.blendRuns++;
+				}
+			}
+		}
+
+		pRleRows.push_back((uint32_t) pRleRuns.size());
+		pRlePixelRows.push_back((uint32_t) pRlePixels.size());
+
+		pRleStats.rawBytes = pSize.prod() * sizeof(Pixel);
+		pRleStats.encodedBytes = pRleRuns.size() * sizeof(Run) + pRlePixels.size() * sizeof(Pixel) +
+								 (pRleRows.size() + pRlePixelRows.size()) * sizeof(uint32_t);
+
+		// Blit both representations into a scratch surface to report the
+		// speedup the encoding gives for this particular sprite.
+		std::vector<Pixel> scratch(pSize.prod());
+		auto measure = [&] (auto blit) {
+			auto start = std::chrono::steady_clock::now();
+			for(uint32_t i = 0; i < 8; i++) blit();
+			return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() / 8.0f;
+		};
+
+		pRleStats.rawBlitTime = measure([&] () {
+			pBlitRaw(scratch.data(), pSize.x, 0, 0, pSize.x, pSize.y, DrawingMode::FULL_ALPHA);
+		});
+		pRleStats.rleBlitTime = measure([&] () {
+			pBlitRle(scratch.data(), pSize.x, 0, 0, pSize.x, pSize.y, DrawingMode::FULL_ALPHA);
+		});
+	}
+
+	inline void Sprite::pBlitRaw(Pixel* dst, uint32_t stride, int32_t sx, int32_t sy, int32_t w, int32_t h, DrawingMode mode) const {
+		BlitPixels(pBuffer + sy * pSize.x + sx, pSize.x, dst, stride, w, h, mode);
+	}
+
+	inline void BlitPixels(const Pixel* src, uint32_t srcStride, Pixel* dst, uint32_t dstStride, int32_t w, int32_t h, DrawingMode mode) {
+		for(int32_t y = 0; y < h; y++, src += srcStride) {
+			Pixel* out = dst + y * dstStride;
+
+			if(mode == DrawingMode::NO_ALPHA) {
+				memcpy(out, src, w * sizeof(Pixel));
+				continue;
+			}
+
+			if(mode == DrawingMode::LINEAR_ALPHA) {
+				BlendRowLinear(out, src, w);
+				continue;
+			}
+
+			for(int32_t x = 0; x < w; x++) {
+				if(src[x].a == 255) out[x] = src[x];
+				else if(mode == DrawingMode::FULL_ALPHA && src[x].a) out[x] = BlendPixel(out[x], src[x]);
+			}
+		}
+	}
+
+	inline void Sprite::pBlitRle(Pixel* dst, uint32_t stride, int32_t sx, int32_t sy, int32_t w, int32_t h, DrawingMode mode) const {
+		for(int32_t y = 0; y < h; y++) {
+			const Run* run = pRleRuns.data() + pRleRows[sy + y];
+			const Run* end = pRleRuns.data() + pRleRows[sy + y + 1];
+			const Pixel* src = pRlePixels.data() + pRlePixelRows[sy + y];
+			Pixel* out = dst + y * stride;
+
+			int32_t x = 0;
+
+			for(; run != end && x < sx + w; run++) {
+				int32_t x1 = (std::max)(x, sx);
+				int32_t x2 = (std::min)(x + (int32_t) run->length, sx + w);
+
+				if(run->kind == RunKind::COPY && x1 < x2) {
+					memcpy(out + (x1 - sx), src + (x1 - x), (x2 - x1) * sizeof(Pixel));
+
+				} else if(run->kind == RunKind::BLEND && mode == DrawingMode::FULL_ALPHA) {
+					for(int32_t i = x1; i < x2; i++) out[i - sx] = BlendPixel(out[i - sx], src[i - x]);
+
+				} else if(run->kind == RunKind::BLEND && mode == DrawingMode::LINEAR_ALPHA && x1 < x2) {
+					BlendRowLinear(out + (x1 - sx), src + (x1 - x), x2 - x1);
+				}
+
+				if(run->kind != RunKind::SKIP) src += run->length;
+				x += run->length;
+			}
+		}
+	}
+
+	/*
+		Collision masks pack one bit per pixel into 64 bit words, one row of
+		words per sprite row, with pMin / pMax as the tight bounds of the set
+		bits. An overlap test first intersects those bounds and then ANDs only
+		the rows and words they share, shifting the other mask's words into
+		place, so a miss usually costs a couple of compares.
+	*/
+
+	inline CollisionMask::CollisionMask(const Sprite* sprite, uint8_t threshold):
+		CollisionMask(sprite, vi2d(0, 0), vi2d(sprite->pSize.x, sprite->pSize.y), threshold) {}
+
+	inline CollisionMask::CollisionMask(const Sprite* sprite, const vi2d& spos, const vi2d& ssize, uint8_t threshold) {
+		if(!sprite->pBuffer) {
+			throw std::runtime_error("Sprite has no pixel data.");
+		}
+
+		if(spos.x < 0 || spos.y < 0 || ssize.x <= 0 || ssize.y <= 0 ||
+		   spos.x + ssize.x > (int32_t) sprite->pSize.x || spos.y + ssize.y > (int32_t) sprite->pSize.y) {
+			throw std::runtime_error("Invalid collision mask proportions.");
+		}
+
+		pSize = vu2d(ssize.x, ssize.y);
+		pWords = (pSize.x + 63) / 64;
+		pBits.assign((size_t) pWords * pSize.y, 0);
+
+		pMin = vi2d(ssize.x, ssize.y);
+		pMax = vi2d(-1, -1);
+
+		for(int32_t y = 0; y < ssize.y; y++) {
+			const Pixel* src = sprite->pBuffer + (spos.y + y) * sprite->pSize.x + spos.x;
+			uint64_t* row = pBits.data() + (size_t) y * pWords;
+
+			for(int32_t x = 0; x < ssize.x; x++) {
+				if(src[x].a >= threshold) row[x >> 6] |= 1ull << (x & 63);
+			}
+
+			for(uint32_t w = 0; w < pWords; w++) {
+				if(!row[w]) continue;
+
+				pMin.x = (std::min)(pMin.x, (int32_t) (w * 64 + std::countr_zero(row[w])));
+				pMax.x = (std::max)(pMax.x, (int32_t) (w * 64 + 63 - std::countl_zero(row[w])));
+				pMin.y = (std::min)(pMin.y, y);
+				pMax.y = y;
+			}
+		}
+	}
+
+	inline vu2d CollisionMask::Size() const {
+		return pSize;
+	}
+
+	inline bool CollisionMask::Empty() const {
+		return pMax.y < pMin.y;
+	}
+
+	inline bool CollisionMask::Test(const vi2d& pos) const {
+		if(pos.x < 0 || pos.y < 0 || pos.x >= (int32_t) pSize.x || pos.y >= (int32_t) pSize.y) return false;
+		return (pBits[(size_t) pos.y * pWords + (pos.x >> 6)] >> (pos.x & 63)) & 1;
+	}
+
+	inline bool CollisionMask::Overlaps(const CollisionMask& other, const vi2d& offset) const {
+		return pOverlap<false>(other, offset) != 0;
+	}
+
+	inline uint32_t CollisionMask::OverlapArea(const CollisionMask& other, const vi2d& offset) const {
+		return pOverlap<true>(other, offset);
+	}
+
+	inline uint64_t CollisionMask::pWord(int32_t y, int32_t bit) const {
+		// Bits [bit, bit + 64) of row y, with zeros outside the mask
+		const uint64_t* row = pBits.data() + (size_t) y * pWords;
+
+		int32_t w = bit >> 6, r = bit & 63;
+
+		uint64_t lo = w >= 0 && w < (int32_t) pWords ? row[w] : 0;
+		uint64_t hi = w + 1 >= 0 && w + 1 < (int32_t) pWords ? row[w + 1] : 0;
+
+		return r ? (lo >> r) | (hi << (64 - r)) : lo;
+	}
+
+	template<bool Count> inline uint32_t CollisionMask::pOverlap(const CollisionMask& other, const vi2d& offset) const {
+		if(Empty() || other.Empty()) return 0;
+
+		int32_t x1 = (std::max)(pMin.x, other.pMin.x + offset.x);
+		int32_t y1 = (std::max)(pMin.y, other.pMin.y + offset.y);
+		int32_t x2 = (std::min)(pMax.x, other.pMax.x + offset.x);
+		int32_t y2 = (std::min)(pMax.y, other.pMax.y + offset.y);
+
+		if(x1 > x2 || y1 > y2) return 0;
+
+		int32_t w1 = x1 >> 6, w2 = x2 >> 6;
+		uint32_t area = 0;
+
+		for(int32_t y = y1; y <= y2; y++) {
+			const uint64_t* row = pBits.data() + (size_t) y * pWords;
+
+			for(int32_t w = w1; w <= w2; w++) {
+				uint64_t hit = row[w] & other.pWord(y - offset.y, w * 64 - offset.x);
+
+				if constexpr(Count) area += std::popcount(hit);
+				else if(hit) return 1;
+			}
+		}
+
+		return area;
+	}
+
+	/*
+		The cache owns one sprite per file and filter and hands out shared
+		handles to it, most recently loaded first. When over budget it walks
+		from the least recently used end: sprites nobody else holds are
+		evicted, held ones can only give up their CPU copy. Sprites queued
+		for the GPU this frame count as held until the frame is drawn. Tile
+		maps and sprite sheets only keep a plain pointer, so a handle must
+		be kept for as long as they use the sprite. Like any sprite, the
+		cache must be used and destroyed on the engine thread.
+	*/
+
+	inline SpriteCache::SpriteCache(size_t cpuBudget, size_t gpuBudget) {
+		pCpuBudget = cpuBudget;
+		pGpuBudget = gpuBudget;
+	}
+
+	inline std::shared_ptr<Sprite> SpriteCache::Load(const std::string& filename, SpriteFilter filter, bool keepCpuCopy) {
+		std::string key = filename;
+		key.push_back('\0');
+		key.push_back(char('0' + (uint8_t) filter));
+
+		auto found = pIndex.find(key);
+
+		if(found != pIndex.end()) {
+			pStats.hits++;
+			pEntries.splice(pEntries.begin(), pEntries, found->second);
+
+			return found->second->sprite;
+		}
+
+		pStats.misses++;
+
+		std::shared_ptr<Sprite> sprite = std::make_shared<Sprite>(filename, filter);
+
+		if(sprite->Size().prod() == 0) {
+			throw std::runtime_error("Could not load sprite.");
+		}
+
+		if(!keepCpuCopy) {
+			sprite->ReleaseCpuCopy();
+			pStats.releases++;
+		}
+
+		pEntries.push_front({ key, sprite });
+		pIndex[key] = pEntries.begin();
+
+		pEnforce();
+
+		return sprite;
+	}
+
+	inline void SpriteCache::SetBudget(size_t cpuBudget, size_t gpuBudget) {
+		pCpuBudget = cpuBudget;
+		pGpuBudget = gpuBudget;
+
+		pEnforce();
+	}
+
+	inline void SpriteCache::Trim() {
+		for(auto it = pEntries.begin(); it != pEntries.end();) {
+			auto next = std::next(it);
+			if(it->sprite.use_count() == 1 && !it->sprite->pQueued) pEvict(it);
+			it = next;
+		}
+	}
+
+	inline void SpriteCache::Clear() {
+		pEntries.clear();
+		pIndex.clear();
+	}
+
+	inline SpriteCacheStats SpriteCache::Stats() const {
+		SpriteCacheStats stats = pStats;
+
+		// Held sprites may release their pixels behind the cache's back
+		for(const Entry& e : pEntries) {
+			stats.cpuBytes += e.sprite->CpuBytes();
+			stats.gpuBytes += e.sprite->GpuBytes();
+		}
+
+		stats.resident = (uint32_t) pEntries.size();
+		return stats;
+	}
+
+	inline void SpriteCache::pEnforce() {
+		size_t cpu = 0, gpu = 0;
+
+		for(const Entry& e : pEntries) {
+			cpu += e.sprite->CpuBytes();
+			gpu += e.sprite->GpuBytes();
+		}
+
+		for(auto it = pEntries.end(); it != pEntries.begin() && (cpu > pCpuBudget || gpu > pGpuBudget);) {
+			--it;
+
+			Sprite* sprite = it->sprite.get();
+			size_t spriteCpu = sprite->CpuBytes();
+
+			if(it->sprite.use_count() == 1 && !sprite->pQueued) {
+				cpu -= spriteCpu;
+				gpu -= sprite->GpuBytes();
+
+				it = std::next(it);
+				pEvict(std::prev(it));
+
+			} else if(cpu > pCpuBudget && spriteCpu && !sprite->pDirty && sprite->pBufferId != 0xFFFFFFFF) {
+				cpu -= spriteCpu;
+
+				sprite->ReleaseCpuCopy();
+				pStats.releases++;
+			}
+		}
+	}
+
+	inline void SpriteCache::pEvict(std::list<Entry>::iterator it) {
+		pIndex.erase(it->key);
+		pEntries.erase(it);
+
+		pStats.evictions++;
+	}
+
+	inline SpriteSheet::SpriteSheet(Sprite* sprite, const vu2d& frameSize, const vu2d& spacing, const vu2d& margin) {
+		if(frameSize.x == 0 || frameSize.y == 0) {
+			throw std::runtime_error("Invalid sprite sheet frame.");
+		}
+
+		pSprite = sprite;
+		vu2d size = sprite->Size();
+
+		// Frames are numbered left to right, top to bottom
+		for(uint32_t y = margin.y; y + frameSize.y <= size.y; y += frameSize.y + spacing.y) {
+			for(uint32_t x = margin.x; x + frameSize.x <= size.x; x += frameSize.x + spacing.x) {
+				pAddFrame(vi2d(x, y), vi2d(frameSize.x, frameSize.y));
+			}
+		}
+	}
+
+	inline SpriteSheet::SpriteSheet(Sprite* sprite, const vi2d* spos, const vi2d* ssize, uint32_t count) {
+		pSprite = sprite;
+
+		for(uint32_t i = 0; i < count; i++) {
+			pAddFrame(spos[i], ssize[i]);
+		}
+	}
+
+	inline void SpriteSheet::pAddFrame(const vi2d& spos, const vi2d& ssize) {
+		vu2d size = pSprite->Size();
+
+		if(spos.x < 0 || spos.y < 0 || ssize.x <= 0 || ssize.y <= 0 || spos.x + ssize.x > (int32_t) size.x || spos.y + ssize.y > (int32_t) size.y) {
+			throw std::runtime_error("Invalid sprite sheet frame.");
+		}
+
+		Frame f;
+		f.uv1 = vf2d((float) spos.x, (float) spos.y) * pSprite->pUvScale;
+		f.uv2 = vf2d((float) (spos.x + ssize.x), (float) (spos.y + ssize.y)) * pSprite->pUvScale;
+		f.size = vf2d((float) ssize.x, (float) ssize.y);
+
+		pFrames.push_back(f);
+	}
+
+	inline uint32_t SpriteSheet::AddClip(uint32_t first, uint32_t count, float fps, bool loop) {
+		if(count == 0 || first + count > pFrames.size() || fps <= 0.0f) {
+			throw std::runtime_error("Invalid animation clip.");
+		}
+
+		pClips.push_back({ first, count, 1.0f / fps, count / fps, loop });
+		return (uint32_t) pClips.size() - 1;
+	}
+
+	inline Sprite* SpriteSheet::Source() const {
+		return pSprite;
+	}
+
+	inline uint32_t SpriteSheet::Frames() const {
+		return (uint32_t) pFrames.size();
+	}
+
+	inline uint32_t SpriteSheet::Clips() const {
+		return (uint32_t) pClips.size();
+	}
+
+	inline vu2d SpriteSheet::FrameSize(uint32_t frame) const {
+		if(frame >= pFrames.size()) {
+			throw std::runtime_error("Invalid sprite sheet frame.");
+		}
+
+		return vu2d((uint32_t) pFrames[frame].size.x, (uint32_t) pFrames[frame].size.y);
+	}
+
+	/*
+		Instance state lives in parallel arrays packed at the front, removal
+		moves the last instance into the hole. Handles go through a slot
+		table so they stay valid while instances move.
+	*/
+
+	inline Animator::Animator(const SpriteSheet* sheet) {
+		pSheet = sheet;
+	}
+
+	inline Animator::Instance Animator::Add(const vf2d& pos, uint32_t clip, float speed, const Pixel& tint) {
+		if(clip >= pSheet->pClips.size()) {
+			throw std::runtime_error("Invalid animation clip.");
+		}
+
+		Instance instance;
+
+		if(pFree.empty()) {
+			instance = (Instance) pSlot.size();
+			pSlot.push_back(0);
+		} else {
+			instance = pFree.back();
+			pFree.pop_back();
+		}
+
+		pSlot[instance] = (uint32_t) pOwner.size();
+		pOwner.push_back(instance);
+
+		pX.push_back(pos.x);
+		pY.push_back(pos.y);
+		pTime.push_back(0.0f);
+		pSpeed.push_back(speed);
+		pClip.push_back(clip);
+		pFrame.push_back(pSheet->pClips[clip].first);
+		pTint.push_back(tint);
+
+		return instance;
+	}
+
+	inline void Animator::Remove(Instance instance) {
+		uint32_t i = pIndex(instance);
+		uint32_t last = (uint32_t) pOwner.size() - 1;
+
+		if(i != last) {
+			pX[i] = pX[last];
+			pY[i] = pY[last];
+			pTime[i] = pTime[last];
+			pSpeed[i] = pSpeed[last];
+			pClip[i] = pClip[last];
+			pFrame[i] = pFrame[last];
+			pTint[i] = pTint[last];
+
+			pOwner[i] = pOwner[last];
+			pSlot[pOwner[i]] = i;
+		}
+
+		pX.pop_back();
+		pY.pop_back();
+		pTime.pop_back();
+		pSpeed.pop_back();
+		pClip.pop_back();
+		pFrame.pop_back();
+		pTint.pop_back();
+		pOwner.pop_back();
+
+		pSlot[instance] = UINT32_MAX;
+		pFree.push_back(instance);
+	}
+
+	inline void Animator::Clear() {
+		pX.clear();
+		pY.clear();
+		pTime.clear();
+		pSpeed.clear();
+		pClip.clear();
+		pFrame.clear();
+		pTint.clear();
+
+		pOwner.clear();
+		pSlot.clear();
+		pFree.clear();
+	}
+
+	inline void Animator::SetPosition(Instance instance, const vf2d& pos) {
+		uint32_t i = pIndex(instance);
+		pX[i] = pos.x;
+		pY[i] = pos.y;
+	}
+
+	inline void Animator::SetClip(Instance instance, uint32_t clip, bool restart) {
+		uint32_t i = pIndex(instance);
+
+		if(clip >= pSheet->pClips.size()) {
+			throw std::runtime_error("Invalid animation clip.");
+		}
+
+		if(!restart && clip == pClip[i]) return;
+
+		pClip[i] = clip;
+		pTime[i] = 0.0f;
+		pFrame[i] = pSheet->pClips[clip].first;
+	}
+
+	inline void Animator::SetSpeed(Instance instance, float speed) {
+		pSpeed[pIndex(instance)] = speed;
+	}
+
+	inline void Animator::SetTint(Instance instance, const Pixel& tint) {
+		pTint[pIndex(instance)] = tint;
+	}
+
+	inline uint32_t Animator::Frame(Instance instance) const {
+		uint32_t i = pIndex(instance);
+		return pFrame[i] - pSheet->pClips[pClip[i]].first;
+	}
+
+	inline bool Animator::Finished(Instance instance) const {
+		uint32_t i = pIndex(instance);
+		const SpriteSheet::Clip& c = pSheet->pClips[pClip[i]];
+
+		return !c.loop && pTime[i] >= c.duration;
+	}
+
+	inline uint32_t Animator::Size() const {
+		return (uint32_t) pOwner.size();
+	}
+
+	inline const SpriteSheet* Animator::Sheet() const {
+		return pSheet;
+	}
+
+	inline void Animator::Update(float et) {
+		const SpriteSheet::Clip* clips = pSheet->pClips.data();
+		uint32_t count = (uint32_t) pOwner.size();
+
+		float* time = pTime.data();
+		const float* speed = pSpeed.data();
+		const uint32_t* clip = pClip.data();
+		uint32_t* frame = pFrame.data();
+
+		for(uint32_t i = 0; i < count; i++) {
+			const SpriteSheet::Clip& c = clips[clip[i]];
+			float t = time[i] + et * speed[i];
+
+			if(t >= c.duration) {
+				t = c.loop ? std::fmod(t, c.duration) : c.duration;
+			} else if(t < 0.0f) {
+				t = c.loop ? c.duration + std::fmod(t, c.duration) : 0.0f;
+			}
+
+			uint32_t local = (std::min)((uint32_t) (t / c.frameTime), c.count - 1);
+
+			time[i] = t;
+			frame[i] = c.first + local;
+		}
+	}
+
+	inline uint32_t Animator::pIndex(Instance instance) const {
+		if(instance >= pSlot.size() || pSlot[instance] == UINT32_MAX) {
+			throw std::runtime_error("Invalid animation instance.");
+		}
+
+		return pSlot[instance];
+	}
+
+	inline TileMap::TileMap(const vu2d& size, const vu2d& tileSize, Sprite* tileset, uint32_t layers) {
+		if(size.x == 0 || size.y == 0 || tileSize.x == 0 || tileSize.y == 0 || layers == 0) {
+			throw std::runtime_error("Invalid tile map proportions.");
+		}
+
+		pSize = size;
+		pTileSize = tileSize;
+		pChunks = vu2d((size.x + pChunkTiles - 1) / pChunkTiles, (size.y + pChunkTiles - 1) / pChunkTiles);
+		pChunkPixels = tileSize * pChunkTiles;
+
+		pTileset = tileset;
+		pTilesetColumns = (std::max)(tileset->pSize.x / tileSize.x, 1u);
+
+		pLayers.resize(layers);
+
+		for(Layer& layer : pLayers) {
+			layer.chunks = std::vector<Chunk>(pChunks.prod());
+
+			for(Chunk& chunk : layer.chunks) {
+				std::fill_n(chunk.tiles, pChunkTiles * pChunkTiles, EMPTY_TILE);
+			}
+		}
+	}
+
+	inline void TileMap::SetTile(uint32_t layer, const vu2d& pos, uint16_t tile) {
+		if(layer >= pLayers.size() || pos.x >= pSize.x || pos.y >= pSize.y) return;
+
+		Chunk& chunk = pLayers[layer].chunks[(pos.y / pChunkTiles) * pChunks.x + pos.x / pChunkTiles];
+		uint16_t& t = chunk.tiles[(pos.y % pChunkTiles) * pChunkTiles + pos.x % pChunkTiles];
+
+		if(t == tile) return;
+
+		if(t == EMPTY_TILE) chunk.count++;
+		if(tile == EMPTY_TILE) chunk.count--;
+
+		t = tile;
+		chunk.dirty = true;
+	}
+
+	inline uint16_t TileMap::GetTile(uint32_t layer, const vu2d& pos) const {
+		if(layer >= pLayers.size() || pos.x >= pSize.x || pos.y >= pSize.y) return EMPTY_TILE;
+
+		const Chunk& chunk = pLayers[layer].chunks[(pos.y / pChunkTiles) * pChunks.x + pos.x / pChunkTiles];
+		return chunk.tiles[(pos.y % pChunkTiles) * pChunkTiles + pos.x % pChunkTiles];
+	}
+
+	inline void TileMap::SetStatic(uint32_t layer, bool isStatic) {
+		if(layer < pLayers.size()) pLayers[layer].isStatic = isStatic;
+	}
+
+	inline vu2d TileMap::Size() const {
+		return pSize;
+	}
+
+	inline vu2d TileMap::TileSize() const {
+		return pTileSize;
+	}
+
+	inline uint32_t TileMap::Layers() const {
+		return (uint32_t) pLayers.size();
+	}
+
+	inline void TileMap::pBuildCache(Chunk& chunk) {
+		if(!chunk.cache) {
+			chunk.cache.reset(new Pixel[pChunkPixels.prod()]);
+			pCached.push_back(&chunk);
+		}
+
+		chunk.opaque = chunk.count == pChunkTiles * pChunkTiles;
+
+		for(uint32_t ty = 0; ty < pChunkTiles; ty++) {
+			chunk.filled[ty] = 0;
+
+			for(uint32_t tx = 0; tx < pChunkTiles; tx++) {
+				uint16_t tile = chunk.tiles[ty * pChunkTiles + tx];
+				Pixel* dst = chunk.cache.get() + ty * pTileSize.y * pChunkPixels.x + tx * pTileSize.x;
+
+				uint32_t sx = (tile % pTilesetColumns) * pTileSize.x;
+				uint32_t sy = (tile / pTilesetColumns) * pTileSize.y;
+
+				if(tile == EMPTY_TILE || !pTileset->pBuffer || sx + pTileSize.x > pTileset->pSize.x || sy + pTileSize.y > pTileset->pSize.y) {
+					for(uint32_t y = 0; y < pTileSize.y; y++) std::fill_n(dst + y * pChunkPixels.x, pTileSize.x, Blank);
+					chunk.opaque = false;
+					continue;
+				}
+
+				const Pixel* src = pTileset->pBuffer + sy * pTileset->pSize.x + sx;
+				BlitPixels(src, pTileset->pSize.x, dst, pChunkPixels.x, pTileSize.x, pTileSize.y, DrawingMode::NO_ALPHA);
+				chunk.filled[ty] |= 1 << tx;
+
+				for(uint32_t y = 0; y < pTileSize.y && chunk.opaque; y++) {
+					for(uint32_t x = 0; x < pTileSize.x; x++) {
+						if(src[y * pTileset->pSize.x + x].a != 255) { chunk.opaque = false; break; }
+					}
+				}
+			}
+		}
+
+		chunk.dirty = false;
+	}
+
+	inline void TileMap::pCheckTileset() {
+		if(pTilesetVersion == pTileset->pVersion) return;
+
+		for(Chunk* chunk : pCached) chunk->dirty = true;
+		pTilesetVersion = pTileset->pVersion;
+	}
+
+	inline void TileMap::pEvictCaches(uint64_t frame) {
+		for(size_t i = 0; i < pCached.size();) {
+			if(frame - pCached[i]->lastFrame > pCacheFrames) {
+				pCached[i]->cache.reset();
+				pCached[i]->dirty = true;
+				pCached[i] = pCached.back();
+				pCached.pop_back();
+			} else {
+				i++;
+			}
+		}
+	}
+
+	LRESULT Application::pWinProc(UINT uMsg, WPARAM wParam, LPARAM lParam) {
+		switch(uMsg) {
+			case WM_CLOSE:
+			{
+				pDestroyDevice();
+				DestroyWindow(pHwnd);
+				return 0;
+			}
+			case WM_DESTROY:
+			{
+				pShouldExist = false;
+				PostQuitMessage(0);
+				return 0;
+			}
+			case WM_MOUSEWHEEL:
+			{
+				if(pPlayer.Active()) return 0;
+
+				pMouseWheel += GET_WHEEL_DELTA_WPARAM(wParam);
+				return 0;
+			}
+			case WM_MOUSEMOVE:
+			{
+				if(pPlayer.Active()) return 0;
+
+				uint16_t x = lParam & 0xFFFF; uint16_t y = (lParam >> 16) & 0xFFFF;
+				int16_t ix = *(int16_t*) &x;   int16_t iy = *(int16_t*) &y;
+
+				x -= pViewPos.x;
+				y -= pViewPos.y;
+
+				pMousePos.x = (int32_t) (((float) x / (float) (pWindowSize.x - (pViewPos.x * 2)) * (float) pScreenSize.x));
+				pMousePos.y = (int32_t) (((float) y / (float) (pWindowSize.y - (pViewPos.y * 2)) * (float) pScreenSize.y));
+
+				if(pMousePos.x >= (int32_t) pScreenSize.x)	pMousePos.x = pScreenSize.x - 1;
+				if(pMousePos.y >= (int32_t) pScreenSize.y) pMousePos.y = pScreenSize.y - 1;
+				if(pMousePos.x < 0) pMousePos.x = 0;
+				if(pMousePos.y < 0) pMousePos.y = 0;
+
+				return 0;
+			}
+			case WM_SIZE:
+			{
+				uint32_t x = lParam & 0xFFFF;
+				uint32_t y = (lParam >> 16) & 0xFFFF;
+
+				pWindowSize.x = x;
+				pWindowSize.y = y;
+
+				pUpdateViewport();
+
+				return 0;
+			}
+			case WM_KEYDOWN:
+			{
+				pKeyboardKeysNew[pKeyMap[wParam]] = true;
+				return 0;
+			}
+			case WM_KEYUP:
+			{
+				pKeyboardKeysNew[pKeyMap[wParam]] = false;
+				return 0;
+			}
+			case WM_LBUTTONDOWN:
+			{
+				pMouseButtonsNew[0] = true;
+				return 0;
+			}
+			case WM_LBUTTONUP:
+			{
+				pMouseButtonsNew[0] = false;
+				return 0;
+			}
+			case WM_RBUTTONDOWN:
+			{
+				pMouseButtonsNew[1] = true;
+				return 0;
+			}
+			case WM_RBUTTONUP:
+			{
+				pMouseButtonsNew[1] = false;
+				return 0;
+			}
+			case WM_MBUTTONDOWN:
+			{
+				pMouseButtonsNew[2] = true;
+				return 0;
+			}
+			case WM_MBUTTONUP:
+			{
+				pMouseButtonsNew[2] = false;
+				return 0;
+			}
+			default:
+				return DefWindowProcW(pHwnd, uMsg, wParam, lParam);
+		}
+	}
+
+	inline void Application::EngineThread() {
+		pCreateDevice();
+
+		glEnable(GL_TEXTURE_2D);
+		glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		glViewport(pViewPos.x, pViewPos.y, pViewSize.x, pViewSize.y);
+
+		pMapKeyboard();
+
+		pClock1 = std::chrono::system_clock::now();
+		pClock2 = std::chrono::system_clock::now();
+
+		glGenTextures(1, &pBufferId);
+		glBindTexture(GL_TEXTURE_2D, pBufferId);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+		pUploadFrame();
+
+		pShouldExist = OnCreate();
+
+		while(pShouldExist) {
+			Update();
+		}
+
+		pCapture.Stop();
+		pStream.Stop();
+		pRecorder.Stop();
+		pPlayer.Stop();
+	}
+
+	LRESULT CALLBACK Application::pStaticWinProc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam) {
+		Application* window = nullptr;
+
+		if(uMsg == WM_NCCREATE) {
+			window = static_cast<Application*>(reinterpret_cast<LPCREATESTRUCT>(lParam)->lpCreateParams);
+			window->pHwnd = hWnd;
+
+			SetWindowLongPtr(hWnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(window));
+
+		} else {
+			window = reinterpret_cast<Application*>(GetWindowLongPtr(hWnd, GWLP_USERDATA));
+		}
+
+		if(window) {
+			return window->pWinProc(uMsg, wParam, lParam);
+		}
+
+		return DefWindowProc(hWnd, uMsg, wParam, lParam);
+	}
+
+	void Application::pUpdateViewport() {
+
+		int32_t ww = pScreenSize.x * pScale;
+		int32_t wh = pScreenSize.y * pScale;
+		float wasp = (float) ww / (float) wh;
+
+		pViewSize.x = (int32_t) pWindowSize.x;
+		pViewSize.y = (int32_t) ((float) pViewSize.x / wasp);
+
+		if(pViewSize.y > pWindowSize.y) {
+			pViewSize.y = pWindowSize.y;
+			pViewSize.x = (int32_t) ((float) pViewSize.y * wasp);
+		}
+
+		pViewPos = (pWindowSize - pViewSize) / 2;
+	}
+
+	inline bool Application::ShouldExist() const {
+		return pShouldExist;
+	}
+	inline pixel::DrawingMode Application::DrawingMode() const {
+		return pDrawingMode;
+	}
+	inline pixel::PixelFormat Application::PixelFormat() const {
+		return pPixelFormat;
+	}
+	inline Pixel Application::Palette(uint8_t index) const {
+		return pPalette[index];
+	}
+
+	inline vu2d Application::DrawableSize() const {
+		return pScreenSize - 1;
+	}
+	inline vu2d Application::ScreenSize() const {
+		return pScreenSize;
+	}
+
+	inline vu2d Application::WindowSize() const {
+		return pWindowSize;
+	}
+	inline vu2d Application::WindowPos() const {
+		return pWindowPos;
+	}
+
+	inline vu2d Application::MousePos() const {
+		return pMousePos;
+	}
+	inline uint32_t Application::MouseWheel() const {
+		return pMouseWheel;
+	}
+
+	inline Button Application::MouseLeft() const {
+		return pMouseButtons[0];
+	}
+	inline Button Application::MouseRight() const {
+		return pMouseButtons[1];
+	}
+	inline Button Application::MouseMiddle() const {
+		return pMouseButtons[2];
+	}
+
+	inline Button Application::KeyboardKey(Key key) const {
+		return pKeyboardKeys[(uint8_t) key];
+	}
+
+	inline float Application::ElapsedTime() const {
+		return pElapsedTime;
+	}
+	inline uint32_t Application::FPS() const {
+		return pFrameRate;
+	}
+
+	inline FrameArena& Application::Arena() {
+		return pFrameArena;
+	}
+	inline const FrameStats& Application::Stats() const {
+		return pStats;
+	}
+
+	void Application::pCreateWindow() {
+
+		WNDCLASS wc;
+
+		wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);
+		wc.hCursor = LoadCursor(NULL, IDC_ARROW);
+		wc.style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC;
+
+		wc.hInstance = GetModuleHandle(nullptr);
+		wc.lpfnWndProc = pStaticWinProc;
+
+		wc.cbClsExtra = 0;
+		wc.cbWndExtra = 0;
+
+		wc.lpszMenuName = nullptr;
+		wc.hbrBackground = nullptr;
+
+		wc.lpszClassName = L"pixel_window_class";
+
+		RegisterClassW(&wc);
+
+		DWORD extendedStyle = WS_EX_APPWINDOW | WS_EX_WINDOWEDGE;
+		DWORD style = WS_CAPTION | WS_SYSMENU | WS_VISIBLE | WS_THICKFRAME;
+
+		vu2d topLeft = pWindowPos;
+
+		if(pFullScreen) {
+			extendedStyle = 0;
+			style = WS_VISIBLE | WS_POPUP;
+
+			HMONITOR hmon = MonitorFromWindow(pHwnd, MONITOR_DEFAULTTONEAREST);
 			MONITORINFO mi = { sizeof(mi) };
 
-			if(!GetMonitorInfo(hmon, &mi)) {
-				throw std::runtime_error("Failed to get monitor info.");
+			if(!GetMonitorInfo(hmon, &mi)) {
+				throw std::runtime_error("Failed to get monitor info.");
+			}
+
+			pWindowSize.x = mi.rcMonitor.right;
+			pWindowSize.y = mi.rcMonitor.bottom;
+			topLeft = { 0, 0 };
+		}
+
+		RECT winRect;
+		winRect.left = 0;
+		winRect.top = 0;
+		winRect.right = pWindowSize.x;
+		winRect.bottom = pWindowSize.y;
+
+		AdjustWindowRectEx(&winRect, style, FALSE, extendedStyle);
+
+		uint32_t w = winRect.right - winRect.left;
+		uint32_t h = winRect.bottom - winRect.top;
+
+		CreateWindowExW(extendedStyle, L"pixel_window_class", L"", style, topLeft.x, topLeft.y,
+						w, h, NULL, NULL, GetModuleHandle(nullptr), this);
+
+		if(!pHwnd) {
+			throw std::runtime_error("Window creation failed.");
+		}
+
+		SetWindowTextA(pHwnd, pWindowTittle.c_str());
+	}
+
+	void Application::pMapKeyboard() {
+		pKeyMap[0x00] = (uint8_t) Key::NONE;
+
+		pKeyMap[0x41] = (uint8_t) Key::A;
+		pKeyMap[0x42] = (uint8_t) Key::B;
+		pKeyMap[0x43] = (uint8_t) Key::C;
+		pKeyMap[0x44] = (uint8_t) Key::D;
+		pKeyMap[0x45] = (uint8_t) Key::E;
+		pKeyMap[0x46] = (uint8_t) Key::F;
+		pKeyMap[0x47] = (uint8_t) Key::G;
+		pKeyMap[0x48] = (uint8_t) Key::H;
+		pKeyMap[0x49] = (uint8_t) Key::I;
+		pKeyMap[0x4A] = (uint8_t) Key::J;
+		pKeyMap[0x4B] = (uint8_t) Key::K;
+		pKeyMap[0x4C] = (uint8_t) Key::L;
+		pKeyMap[0x4D] = (uint8_t) Key::M;
+		pKeyMap[0x4E] = (uint8_t) Key::N;
+		pKeyMap[0x4F] = (uint8_t) Key::O;
+		pKeyMap[0x50] = (uint8_t) Key::P;
+		pKeyMap[0x51] = (uint8_t) Key::Q;
+		pKeyMap[0x52] = (uint8_t) Key::R;
+		pKeyMap[0x53] = (uint8_t) Key::S;
+		pKeyMap[0x54] = (uint8_t) Key::T;
+		pKeyMap[0x55] = (uint8_t) Key::U;
+		pKeyMap[0x56] = (uint8_t) Key::V;
+		pKeyMap[0x57] = (uint8_t) Key::W;
+		pKeyMap[0x58] = (uint8_t) Key::X;
+		pKeyMap[0x59] = (uint8_t) Key::Y;
+		pKeyMap[0x5A] = (uint8_t) Key::Z;
+
+		pKeyMap[VK_F1] = (uint8_t) Key::F1;
+		pKeyMap[VK_F2] = (uint8_t) Key::F2;
+		pKeyMap[VK_F3] = (uint8_t) Key::F3;
+		pKeyMap[VK_F4] = (uint8_t) Key::F4;
+		pKeyMap[VK_F5] = (uint8_t) Key::F5;
+		pKeyMap[VK_F6] = (uint8_t) Key::F6;
+		pKeyMap[VK_F7] = (uint8_t) Key::F7;
+		pKeyMap[VK_F8] = (uint8_t) Key::F8;
+		pKeyMap[VK_F9] = (uint8_t) Key::F9;
+		pKeyMap[VK_F10] = (uint8_t) Key::F10;
+		pKeyMap[VK_F11] = (uint8_t) Key::F11;
+		pKeyMap[VK_F12] = (uint8_t) Key::F12;
+
+		pKeyMap[VK_DOWN] = (uint8_t) Key::DOWN;
+		pKeyMap[VK_LEFT] = (uint8_t) Key::LEFT;
+		pKeyMap[VK_RIGHT] = (uint8_t) Key::RIGHT;
+		pKeyMap[VK_UP] = (uint8_t) Key::UP;
+
+		pKeyMap[VK_RETURN] = (uint8_t) Key::ENTER;
+		pKeyMap[VK_BACK] = (uint8_t) Key::BACK;
+		pKeyMap[VK_ESCAPE] = (uint8_t) Key::ESCAPE;
+		pKeyMap[VK_RETURN] = (uint8_t) Key::ENTER;
+		pKeyMap[VK_PAUSE] = (uint8_t) Key::PAUSE;
+		pKeyMap[VK_SCROLL] = (uint8_t) Key::SCROLL;
+		pKeyMap[VK_TAB] = (uint8_t) Key::TAB;
+		pKeyMap[VK_DELETE] = (uint8_t) Key::DEL;
+		pKeyMap[VK_HOME] = (uint8_t) Key::HOME;
+		pKeyMap[VK_END] = (uint8_t) Key::END;
+		pKeyMap[VK_PRIOR] = (uint8_t) Key::PGUP;
+		pKeyMap[VK_NEXT] = (uint8_t) Key::PGDN;
+		pKeyMap[VK_INSERT] = (uint8_t) Key::INS;
+		pKeyMap[VK_SHIFT] = (uint8_t) Key::SHIFT;
+		pKeyMap[VK_CONTROL] = (uint8_t) Key::CTRL;
+		pKeyMap[VK_SPACE] = (uint8_t) Key::SPACE;
+
+		pKeyMap[VK_NUMPAD0] = (uint8_t) Key::NP0;
+		pKeyMap[VK_NUMPAD1] = (uint8_t) Key::NP1;
+		pKeyMap[VK_NUMPAD2] = (uint8_t) Key::NP2;
+		pKeyMap[VK_NUMPAD3] = (uint8_t) Key::NP3;
+		pKeyMap[VK_NUMPAD4] = (uint8_t) Key::NP4;
+		pKeyMap[VK_NUMPAD5] = (uint8_t) Key::NP5;
+		pKeyMap[VK_NUMPAD6] = (uint8_t) Key::NP6;
+		pKeyMap[VK_NUMPAD7] = (uint8_t) Key::NP7;
+		pKeyMap[VK_NUMPAD8] = (uint8_t) Key::NP8;
+		pKeyMap[VK_NUMPAD9] = (uint8_t) Key::NP9;
+
+		pKeyMap[VK_MULTIPLY] = (uint8_t) Key::NP_MUL;
+		pKeyMap[VK_ADD] = (uint8_t) Key::NP_ADD;
+		pKeyMap[VK_DIVIDE] = (uint8_t) Key::NP_DIV;
+		pKeyMap[VK_SUBTRACT] = (uint8_t) Key::NP_SUB;
+		pKeyMap[VK_DECIMAL] = (uint8_t) Key::NP_DECIMAL;
+	}
+
+	inline void Application::Launch(const vu2d& size, uint8_t scale, const vu2d& position, const std::string& name, pixel::DrawingMode mode, bool fullScreen, bool vsync, pixel::PixelFormat format) {
+		if(scale <= 0 || size.x <= 0 || size.y <= 0) {
+			throw std::runtime_error("Invalid screen proportions.");
+		}
+
+		pWindowSize = size * scale;
+		pWindowPos = position;
+
+		pScreenSize = size;
+		pInvScreenSize = vf2d(1.0f / size.x, 1.0f / size.y);
+		pScale = scale;
+
+		pWindowName = name;
+		pUpdateTittle();
+
+		pDrawingMode = mode;
+
+		pVsync = vsync;
+		pFullScreen = fullScreen;
+
+		pShouldExist = true;
+
+		pBuffer = new Pixel[size.prod()];
+		memset(pBuffer, 0x00, size.prod() * sizeof(Pixel));
+
+		pPixelFormat = format;
+
+		if(pPixelFormat == PixelFormat::INDEXED8) {
+			pIndexBuffer = new uint8_t[size.prod()];
+			memset(pIndexBuffer, 0x00, size.prod());
+
+		} else if(pPixelFormat == PixelFormat::RGB565) {
+			p565Buffer = new uint16_t[size.prod()];
+			memset(p565Buffer, 0x00, size.prod() * sizeof(uint16_t));
+		}
+
+		for(uint32_t i = 0; i < 256; i++) {
+			pPalette[i] = Pixel((i >> 5) * 255 / 7, ((i >> 2) & 7) * 255 / 7, (i & 3) * 255 / 3);
+		}
+
+		pTarget = pBuffer;
+		pTargetSize = pScreenSize;
+		pTargetFormat = pPixelFormat;
+
+		pCreateWindow();
+		pUpdateViewport();
+
+		std::thread t = std::thread(&Application::EngineThread, this);
+
+		while(pShouldExist) {
+			PeekMessageW(&pMsg, pHwnd, 0, 0, PM_REMOVE);
+			DispatchMessageW(&pMsg);
+		}
+
+		t.join();
+	}
+
+	inline bool Application::OnCreate() {
+		return true;
+	}
+
+	inline bool Application::OnUpdate(float et) {
+		return false;
+	}
+
+	void Application::pCreateDevice() {
+
+		pDevideContext = GetDC(pHwnd);
+
+		PIXELFORMATDESCRIPTOR pfd = {
+			sizeof(PIXELFORMATDESCRIPTOR), 1,
+			PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER,
+			PFD_TYPE_RGBA, 32, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+			PFD_MAIN_PLANE, 0, 0, 0, 0
+		};
+
+		int pf = 0;
+		if(!(pf = ChoosePixelFormat(pDevideContext, &pfd))) {
+			throw std::runtime_error("Failed to obtain the correct pixel format.");
+		}
+
+		SetPixelFormat(pDevideContext, pf, &pfd);
+
+		if(!(pRenderContext = wglCreateContext(pDevideContext))) {
+			throw std::runtime_error("Failed to create the rendering context.");
+		}
+
+		wglMakeCurrent(pDevideContext, pRenderContext);
+
+		wglSwapInterval = (wglSwapInterval_t*) wglGetProcAddress("wglSwapIntervalEXT");
+		if(wglSwapInterval && !pVsync) wglSwapInterval(0);
+	}
+
+	inline void Application::pDestroyDevice() {
+		wglDeleteContext(pRenderContext);
+	}
+
+	inline void Application::Close() {
+		PostMessageW(pHwnd, WM_CLOSE, 0, 0);
+	}
+
+	inline void Application::SetName(const std::string& name) {
+		pWindowName = name;
+		pWindowTittle.reserve(pWindowName.size() + 32);
+	}
+
+	inline void Application::pUpdateTittle() {
+		char fps[16];
+		char* end = std::to_chars(fps, fps + sizeof(fps), pFrameRate).ptr;
+
+		if(pWindowTittle.capacity() < pWindowName.size() + 32) {
+			pWindowTittle.reserve(pWindowName.size() + 32);
+		}
+
+		pWindowTittle.assign(pWindowName);
+		pWindowTittle.append(" - FPS: ");
+		pWindowTittle.append(fps, end);
+	}
+
+	inline void Application::pTrackAllocations() {
+		uint64_t count = AllocationCount();
+		uint64_t delta = count - pAllocationsMark;
+		pAllocationsMark = count;
+
+		pStats.frame++;
+		pStats.allocations = delta;
+		pStats.arenaUsed = pFrameArena.Used();
+		pStats.arenaHighWater = pFrameArena.HighWater();
+
+		if(delta && pStats.frame > pWarmupFrames) {
+			pStats.allocatingFrames++;
+
+			char message[96];
+			snprintf(message, sizeof(message), "pixel: frame %llu made %llu heap allocations\n",
+					 (unsigned long long) pStats.frame, (unsigned long long) delta);
+			OutputDebugStringA(message);
+		}
+	}
+
+	inline void Application::SetDrawingMode(pixel::DrawingMode mode) {
+		pDrawingMode = mode;
+	}
+
+	inline void Application::SetPalette(uint8_t index, const Pixel& pixel) {
+		pPalette[index] = pixel;
+		pFrameResolved = false;
+	}
+
+	inline void Application::SetPalette(const Pixel* palette, uint32_t count, uint8_t first) {
+		std::copy_n(palette, (std::min)(count, 256u - first), pPalette + first);
+		pFrameResolved = false;
+	}
+
+	void Application::Update() {
+		if(pPlayer.Active() && pPlayer.Speed() == ReplaySpeed::RECORDED) {
+			std::this_thread::sleep_until(pClock1 + std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::duration<float>(pPlayer.NextElapsed())));
+		}
+
+		auto frameStart = std::chrono::steady_clock::now();
+
+		pClock2 = std::chrono::system_clock::now();
+		pElapsedTimer = pClock2 - pClock1;
+		pClock1 = pClock2;
+		pElapsedTime = pElapsedTimer.count();
+
+		pFrameTimer += pElapsedTime;
+		pFrameCount++;
+
+		if(pFrameTimer >= 1.0f) {
+			pFrameRate = pFrameCount;
+			pFrameTimer -= 1.0f;
+
+			pUpdateTittle();
+			SetWindowTextA(pHwnd, pWindowTittle.c_str());
+
+			pFrameCount = 0;
+		}
+
+		// A replay feeds the recorded input and frame time instead of the live ones
+		const bool* buttons = pMouseButtonsNew;
+		const bool* keys = pKeyboardKeysNew;
+
+		if(pPlayer.Active()) {
+			pPlayer.ReadInput(pElapsedTime, pReplayKeys, pReplayButtons, pMousePos, pMouseWheel);
+
+			buttons = pReplayButtons;
+			keys = pReplayKeys;
+		}
+
+		for(uint32_t i = 0; i < 3; i++) {
+
+			pMouseButtons[i].pressed = false;
+			pMouseButtons[i].released = false;
+
+			if(buttons[i] != pMouseButtonsOld[i]) {
+
+				if(buttons[i]) {
+
+					pMouseButtons[i].pressed = !pMouseButtons[i].held;
+					pMouseButtons[i].held = true;
+
+				} else {
+
+					pMouseButtons[i].released = true;
+					pMouseButtons[i].held = false;
+				}
+			}
+
+			pMouseButtonsOld[i] = buttons[i];
+		}
+
+		for(uint32_t i = 0; i < 256; i++) {
+
+			pKeyboardKeys[i].pressed = false;
+			pKeyboardKeys[i].released = false;
+
+			if(keys[i] != pKeyboardKeysOld[i]) {
+
+				if(keys[i]) {
+
+					pKeyboardKeys[i].pressed = !pKeyboardKeys[i].held;
+					pKeyboardKeys[i].held = true;
+
+				} else {
+
+					pKeyboardKeys[i].released = true;
+					pKeyboardKeys[i].held = false;
+				}
+			}
+
+			pKeyboardKeysOld[i] = keys[i];
+		}
+
+		if(pRecorder.Active()) {
+			pRecorder.RecordInput(pElapsedTime, pKeyboardKeysOld, pMouseButtonsOld, pMousePos, pMouseWheel);
+		}
+
+		glClearColor(0, 0, 0, 0);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		pFrameResolved = false;
+		pPostFrame = nullptr;
+		pShouldExist = OnUpdate(pElapsedTime);
+
+		if(pTargetSprite) {
+			EndOcclusion();
+			SetDrawTarget(nullptr);
+		}
+
+		if(!pPostEffects.empty()) {
+			pApplyPostEffects();
+		}
+
+		glViewport(pViewPos.x, pViewPos.y, pViewSize.x, pViewSize.y);
+
+		pUploadFrame();
+
+		if(pCapture.Active()) {
+			pCapture.Submit(pResolveFrame());
+		}
+
+		if(pStream.Active()) {
+			pStream.Submit(pResolveFrame());
+		}
+
+		glBegin(GL_QUADS);
+
+		glColor4ub(255, 255, 255, 255);
+
+		glTexCoord2f(0.0f, 1.0f);
+		glVertex3f(-1.0f, -1.0f, 0.0f);
+		glTexCoord2f(0.0f, 0.0f);
+		glVertex3f(-1.0f, 1.0f, 0.0f);
+		glTexCoord2f(1.0f, 0.0f);
+		glVertex3f(1.0f, 1.0f, 0.0f);
+		glTexCoord2f(1.0f, 1.0f);
+		glVertex3f(1.0f, -1.0f, 0.0f);
+
+		glEnd();
+
+		for(SpriteDraw* s = pSpritesHead; s; s = s->next) {
+			s->sprite->pQueued = false;
+
+			if(s->sprite->pDirty) {
+				s->sprite->pRefreshTexture();
+			}
+
+			glBindTexture(GL_TEXTURE_2D, s->sprite->pBufferId);
+
+			if(s->quads) {
+				glEnableClientState(GL_VERTEX_ARRAY);
+				glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+				glEnableClientState(GL_COLOR_ARRAY);
+
+				glVertexPointer(2, GL_FLOAT, sizeof(BatchVertex), &s->batch->x);
+				glTexCoordPointer(2, GL_FLOAT, sizeof(BatchVertex), &s->batch->u);
+				glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BatchVertex), &s->batch->tint);
+
+				glDrawArrays(GL_QUADS, 0, s->quads * 4);
+
+				glDisableClientState(GL_COLOR_ARRAY);
+				glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+				glDisableClientState(GL_VERTEX_ARRAY);
+				continue;
+			}
+
+			glBegin(GL_QUADS);
+
+			glColor4ub(s->tint.r, s->tint.g, s->tint.b, s->tint.a);
+			
+			glTexCoord4f(s->uv[0].x, s->uv[0].y, 0.0f, s->w[0]); 
+			glVertex2f(s->pos[0].x, s->pos[0].y);
+			glTexCoord4f(s->uv[1].x, s->uv[1].y, 0.0f, s->w[1]); 
+			glVertex2f(s->pos[1].x, s->pos[1].y);
+			glTexCoord4f(s->uv[2].x, s->uv[2].y, 0.0f, s->w[2]); 
+			glVertex2f(s->pos[2].x, s->pos[2].y);
+			glTexCoord4f(s->uv[3].x, s->uv[3].y, 0.0f, s->w[3]); 
+			glVertex2f(s->pos[3].x, s->pos[3].y);
+
+			glEnd();
+		}
+
+		pSpritesHead = nullptr;
+		pSpritesTail = nullptr;
+
+		// Frame hashes are left out of the replay timings
+		double frameTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+
+		// Sessions started during OnUpdate have no input for this frame yet
+		if(pRecorder.Sampled()) {
+			pRecorder.RecordFrame(pRecorder.HashesFrames() ? pResolveFrame() : nullptr);
+		}
+
+		if(pPlayer.Sampled()) {
+			pPlayer.EndFrame(frameTime, pPlayer.VerifiesFrames() ? pResolveFrame() : nullptr);
+
+			if(pPlayer.Finished()) {
+				pPlayer.Stop();
+				if(pCloseOnReplayEnd) pShouldExist = false;
+			}
+		}
+
+		SwapBuffers(pDevideContext);
+
+		pTrackAllocations();
+		pFrameArena.Reset();
+	}
+
+	/*
+		Effects run on a copy of the finished frame, ping-ponging between two
+		buffers kept across frames, so the application's own buffer is never
+		touched and persistent drawing keeps working. Upload, capture and
+		PresentTo all see the processed frame.
+	*/
+
+	inline void Application::AddPostEffect(PostEffect* effect) {
+		pPostEffects.push_back(effect);
+	}
+
+	inline void Application::RemovePostEffect(PostEffect* effect) {
+		pPostEffects.erase(std::remove(pPostEffects.begin(), pPostEffects.end(), effect), pPostEffects.end());
+	}
+
+	inline void Application::ClearPostEffects() {
+		pPostEffects.clear();
+	}
+
+	inline void Application::pApplyPostEffects() {
+		auto start = std::chrono::steady_clock::now();
+
+		const Pixel* src = pResolveFrame();
+		size_t count = pScreenSize.prod();
+
+		for(uint32_t i = 0; i < pPostEffects.size(); i++) {
+			std::vector<Pixel>& buffer = pPostBuffers[i & 1];
+			if(buffer.size() != count) buffer.resize(count);
+
+			pPostEffects[i]->Apply(src, buffer.data(), pScreenSize);
+			src = buffer.data();
+		}
+
+		pPostFrame = src;
+		pStats.postTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline Application::SpriteDraw* Application::pPushSprite(Sprite* sprite, const Pixel& tint) {
+		SpriteDraw* s = new(pFrameArena.Allocate<SpriteDraw>()) SpriteDraw();
+
+		s->sprite = sprite;
+		s->tint = tint;
+
+		// Keeps a sprite cache from freeing it before the frame is drawn
+		sprite->pQueued = true;
+		s->next = nullptr;
+
+		s->uv[0] = { 0.0f, 0.0f };
+		s->uv[1] = { 0.0f, 1.0f };
+		s->uv[2] = { 1.0f, 1.0f };
+		s->uv[3] = { 1.0f, 0.0f };
+
+		s->w[0] = s->w[1] = s->w[2] = s->w[3] = 1.0f;
+
+		if(pSpritesTail) pSpritesTail->next = s;
+		else pSpritesHead = s;
+		pSpritesTail = s;
+
+		return s;
+	}
+
+	// The expansion is kept until the screen buffer or the palette changes
+	inline const Pixel* Application::pResolveFrame() {
+		if(!pFrameResolved) {
+			if(pPixelFormat == PixelFormat::INDEXED8) {
+				ExpandIndexed(pIndexBuffer, pPalette, pBuffer, pScreenSize.prod());
+			} else if(pPixelFormat == PixelFormat::RGB565) {
+				ExpandRGB565(p565Buffer, pBuffer, pScreenSize.prod());
+			}
+
+			pFrameResolved = true;
+		}
+
+		return pPostFrame ? pPostFrame : pBuffer;
+	}
+
+	inline void Application::pUploadFrame() {
+		glBindTexture(GL_TEXTURE_2D, pBufferId);
+
+		if(pPixelFormat == PixelFormat::RGB565 && !pPostFrame) {
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, pScreenSize.x, pScreenSize.y, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, p565Buffer);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			return;
+		}
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pScreenSize.x, pScreenSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pResolveFrame());
+	}
+
+	inline void Application::pWriteSpan(uint32_t offset, uint32_t count, const Pixel& pixel) {
+		if(pCoverage.active) pWriteCovered(offset, count, pixel);
+		else pWriteRun(offset, count, pixel);
+	}
+
+	inline void Application::pWriteRun(uint32_t offset, uint32_t count, const Pixel& pixel) {
+		bool opaque = pDrawingMode == DrawingMode::NO_ALPHA || pixel.a == 255;
+
+		switch(pTargetFormat) {
+			case PixelFormat::RGBA32:
+			{
+				Pixel* dst = pTarget + offset;
+
+				if(opaque) {
+					std::fill_n(dst, count, pixel);
+				} else if(pDrawingMode == DrawingMode::FULL_ALPHA) {
+					for(uint32_t i = 0; i < count; i++) dst[i] = BlendPixel(dst[i], pixel);
+				} else if(pDrawingMode == DrawingMode::LINEAR_ALPHA) {
+					BlendSpanLinear(dst, count, pixel);
+				}
+
+				return;
+			}
+			case PixelFormat::INDEXED8:
+			{
+				pFrameResolved = false;
+
+				if(opaque || (pDrawingMode != DrawingMode::MASK && pixel.a >= 128)) {
+					memset(pIndexBuffer + offset, pixel.r, count);
+				}
+
+				return;
+			}
+			case PixelFormat::RGB565:
+			{
+				uint16_t* dst = p565Buffer + offset;
+				pFrameResolved = false;
+
+				if(opaque) {
+					std::fill_n(dst, count, PackRGB565(pixel));
+				} else if(pDrawingMode != DrawingMode::MASK) {
+					for(uint32_t i = 0; i < count; i++) dst[i] = PackRGB565(BlendPixel(UnpackRGB565(dst[i]), pixel, pDrawingMode));
+				}
+
+				return;
+			}
+		}
+	}
+
+	/*
+		Shaded spans produce their colours into a row, straight into the
+		target when it is RGBA32 and nothing needs blending, into pShadeRow
+		otherwise, from where they are written the way pWriteRun would
+		write a single colour. Only spans that are opaque as a whole count
+		towards occlusion.
+	*/
+
+	template<class G> inline void Application::pWriteShaded(uint32_t offset, uint32_t count, bool opaque, G&& generate) {
+		if(opaque && pTargetFormat == PixelFormat::RGBA32 && !pCoverage.active) {
+			generate(pTarget + offset);
+			return;
+		}
+
+		if(pShadeRow.size() < count) pShadeRow.resize(count);
+		generate(pShadeRow.data());
+
+		if(!pCoverage.active) {
+			pWritePixels(offset, count, pShadeRow.data(), opaque);
+			return;
+		}
+
+		int32_t y = offset / pTargetSize.x;
+		int32_t x = offset - y * pTargetSize.x;
+
+		if(pCoverage.rowFull[y] == pCoverage.words) {
+			pCoverage.stats.skipped += count;
+			return;
+		}
+
+		uint32_t written = 0;
+
+		pCoverRuns(y, x, x + count - 1, [&] (int32_t x1, int32_t x2) {
+			pWritePixels(y * pTargetSize.x + x1, x2 - x1 + 1, pShadeRow.data() + (x1 - x), opaque);
+			if(opaque) pCover(y, x1, x2);
+			written += x2 - x1 + 1;
+		});
+
+		pCoverage.stats.written += written;
+		pCoverage.stats.skipped += count - written;
+	}
+
+	inline void Application::pWritePixels(uint32_t offset, uint32_t count, const Pixel* src, bool opaque) {
+		switch(pTargetFormat) {
+			case PixelFormat::RGBA32:
+			{
+				if(opaque) memcpy(pTarget + offset, src, count * sizeof(Pixel));
+				else BlitPixels(src, count, pTarget + offset, count, count, 1, pDrawingMode);
+
+				return;
+			}
+			case PixelFormat::INDEXED8:
+			{
+				uint8_t* dst = pIndexBuffer + offset;
+				pFrameResolved = false;
+
+				for(uint32_t i = 0; i < count; i++) {
+					if(opaque || src[i].a == 255 || (pDrawingMode != DrawingMode::MASK && src[i].a >= 128)) dst[i] = src[i].r;
+				}
+
+				return;
+			}
+			case PixelFormat::RGB565:
+			{
+				uint16_t* dst = p565Buffer + offset;
+				pFrameResolved = false;
+
+				for(uint32_t i = 0; i < count; i++) {
+					if(opaque || src[i].a == 255) dst[i] = PackRGB565(src[i]);
+					else if(pDrawingMode != DrawingMode::MASK) dst[i] = PackRGB565(BlendPixel(UnpackRGB565(dst[i]), src[i], pDrawingMode));
+				}
+
+				return;
+			}
+		}
+	}
+
+	/*
+		Gradient spans take float colours at both ends of the unclipped span,
+		clip it, and step the colour across in 16.16 fixed point. The step is
+		truncated toward zero and the start biased by half, so the last pixel
+		rounds to its end colour without ever overshooting it.
+	*/
+
+	inline void Application::pGradientSpan(int32_t x1, int32_t x2, int32_t y, const float* from, const float* to) {
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		if(y < lo.y || y >= hi.y) return;
+
+		int32_t c1 = (std::max)(x1, lo.x), c2 = (std::min)(x2, hi.x - 1);
+		if(c1 > c2) return;
+
+		float span = (float) (x2 - x1);
+		float u1 = span > 0.0f ? (c1 - x1) / span : 0.0f;
+		float u2 = span > 0.0f ? (c2 - x1) / span : 0.0f;
+
+		uint32_t count = c2 - c1 + 1;
+		int32_t color[4], step[4];
+
+		for(uint32_t k = 0; k < 4; k++) {
+			float a = (std::min)((std::max)(from[k] + (to[k] - from[k]) * u1, 0.0f), 255.0f);
+			float b = (std::min)((std::max)(from[k] + (to[k] - from[k]) * u2, 0.0f), 255.0f);
+
+			color[k] = (int32_t) (a * 65536.0f) + 0x8000;
+			step[k] = count > 1 ? (int32_t) ((b - a) * 65536.0f / (count - 1)) : 0;
+		}
+
+		bool opaque = pDrawingMode == DrawingMode::NO_ALPHA ||
+			((color[3] >> 16) == 255 && ((color[3] + step[3] * (int32_t) (count - 1)) >> 16) == 255);
+
+		pWriteShaded(y * pTargetSize.x + c1, count, opaque, [&] (Pixel* dst) {
+			GradientSpan(dst, count, color, step);
+		});
+	}
+
+	/*
+		A linear gradient is linear along a row as well, apart from where it
+		is clamped: each row splits into a flat run of the start colour, a
+		gradient span, and a flat run of the end colour. The slope is the
+		gradient direction divided by its squared length.
+	*/
+
+	inline void Application::pLinearSpan(int32_t x1, int32_t x2, int32_t y, const vf2d& from, const vf2d& slope, const Pixel& start, const Pixel& end) {
+		float t0 = (y - from.y) * slope.y - from.x * slope.x;
+
+		auto color = [&] (float t, float* out) {
+			t = (std::min)((std::max)(t, 0.0f), 1.0f);
+
+			out[0] = start.r + (end.r - start.r) * t;
+			out[1] = start.g + (end.g - start.g) * t;
+			out[2] = start.b + (end.b - start.b) * t;
+			out[3] = start.a + (end.a - start.a) * t;
+		};
+
+		auto flat = [&] (int32_t a, int32_t b, float t) {
+			if(a > b) return;
+
+			float c[4];
+			color(t, c);
+
+			pDrawSpan(a, b, y, Pixel((uint8_t) (c[0] + 0.5f), (uint8_t) (c[1] + 0.5f), (uint8_t) (c[2] + 0.5f), (uint8_t) (c[3] + 0.5f)));
+		};
+
+		if(slope.x == 0.0f) {
+			flat(x1, x2, t0);
+			return;
+		}
+
+		// Where t crosses 0 and 1, kept within the span before converting
+		float xs = -t0 / slope.x, xe = (1.0f - t0) / slope.x;
+		bool rising = slope.x > 0.0f;
+
+		float a = (std::max)((std::min)(rising ? xs : xe, x2 + 1.0f), x1 - 1.0f);
+		float b = (std::max)((std::min)(rising ? xe : xs, x2 + 1.0f), x1 - 1.0f);
+
+		int32_t left = (int32_t) std::floor(a), right = (int32_t) std::ceil(b);
+
+		flat(x1, (std::min)(x2, left), rising ? 0.0f : 1.0f);
+		flat((std::max)(x1, right), x2, rising ? 1.0f : 0.0f);
+
+		int32_t g1 = (std::max)(x1, left + 1), g2 = (std::min)(x2, right - 1);
+		if(g1 > g2) return;
+
+		float c1[4], c2[4];
+		color(t0 + g1 * slope.x, c1);
+		color(t0 + g2 * slope.x, c2);
+
+		pGradientSpan(g1, g2, y, c1, c2);
+	}
+
+	inline void Application::pRadialSpan(int32_t x1, int32_t x2, int32_t y, const vf2d& center, float radius, const Pixel& inner, const Pixel& outer) {
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		if(y < lo.y || y >= hi.y) return;
+
+		x1 = (std::max)(x1, lo.x);
+		x2 = (std::min)(x2, hi.x - 1);
+		if(x1 > x2) return;
+
+		uint32_t count = x2 - x1 + 1;
+		float inv = radius > 0.0f ? 1.0f / radius : 1e30f;
+
+		bool opaque = pDrawingMode == DrawingMode::NO_ALPHA || (inner.a == 255 && outer.a == 255);
+
+		pWriteShaded(y * pTargetSize.x + x1, count, opaque, [&] (Pixel* dst) {
+			RadialSpan(dst, count, x1 - center.x, y - center.y, inv, inner, outer);
+		});
+	}
+
+	/*
+		Every rasterizer writes through pTarget, which is the screen unless a
+		sprite was made the draw target. Sprites are always RGBA32, whatever
+		the screen format is, and get their own fresh clip. The screen's
+		clip and clip stack are put aside meanwhile and come back with it,
+		which happens at the latest when the frame ends.
+	*/
+
+	inline void Application::SetDrawTarget(Sprite* target) {
+		if(pCoverage.active) {
+			throw std::runtime_error("Cannot change the draw target while occluding.");
+		}
+
+		if(target && !target->pBuffer) {
+			throw std::runtime_error("Sprite has no pixel data.");
+		}
+
+		if(pTargetSprite) {
+			pTargetSprite->pMarkDirty();
+		} else if(target) {
+			pScreenClip = { pClipMin, pClipMax };
+			pScreenClipStack.swap(pClipStack);
+		}
+
+		bool toScreen = pTargetSprite && !target;
+		pTargetSprite = target;
+
+		if(target) {
+			// Keeps the pixels from being released or uploaded half drawn
+			target->pDirty = true;
+
+			pTarget = target->pBuffer;
+			pTargetSize = target->pSize;
+			pTargetFormat = PixelFormat::RGBA32;
+		} else {
+			pTarget = pBuffer;
+			pTargetSize = pScreenSize;
+			pTargetFormat = pPixelFormat;
+		}
+
+		if(toScreen) {
+			pClipMin = pScreenClip.min;
+			pClipMax = pScreenClip.max;
+
+			pClipStack.swap(pScreenClipStack);
+			pScreenClipStack.clear();
+		} else if(target) {
+			pClipMin = vi2d(0, 0);
+			pClipMax = vi2d(INT32_MAX, INT32_MAX);
+			pClipStack.clear();
+		}
+	}
+
+	inline Sprite* Application::DrawTarget() const {
+		return pTargetSprite;
+	}
+
+	inline vu2d Application::DrawTargetSize() const {
+		return pTargetSize;
+	}
+
+	/*
+		The clip is kept as a half open box that every rasterizer intersects
+		with the screen once, up front, so loops run over the visible rows
+		and columns only. Pushing intersects with the current clip, popping
+		restores it.
+	*/
+
+	inline void Application::PushClipRect(const vi2d& pos, const vi2d& size) {
+		pClipStack.push_back({ pClipMin, pClipMax });
+
+		pClipMin = vi2d((std::max)(pClipMin.x, pos.x), (std::max)(pClipMin.y, pos.y));
+		pClipMax = vi2d((std::min)(pClipMax.x, pos.x + (std::max)(size.x, 0)), (std::min)(pClipMax.y, pos.y + (std::max)(size.y, 0)));
+	}
+
+	inline void Application::PopClipRect() {
+		if(pClipStack.empty()) {
+			throw std::runtime_error("Clip stack is empty.");
+		}
+
+		pClipMin = pClipStack.back().min;
+		pClipMax = pClipStack.back().max;
+		pClipStack.pop_back();
+	}
+
+	inline void Application::ClipRect(vi2d& pos, vi2d& size) const {
+		vi2d min, max;
+		pClipBounds(min, max);
+
+		pos = min;
+		size = vi2d((std::max)(max.x - min.x, 0), (std::max)(max.y - min.y, 0));
+	}
+
+	inline void Application::pClipBounds(vi2d& min, vi2d& max) const {
+		min = vi2d((std::max)(pClipMin.x, 0), (std::max)(pClipMin.y, 0));
+		max = vi2d((std::min)(pClipMax.x, (int32_t) pTargetSize.x), (std::min)(pClipMax.y, (int32_t) pTargetSize.y));
+	}
+
+	inline void Application::pDrawSpan(int32_t x1, int32_t x2, int32_t y, const Pixel& pixel) {
+		vi2d min, max;
+		pClipBounds(min, max);
+
+		if(y < min.y || y >= max.y) return;
+
+		if(x1 > x2) std::swap(x1, x2);
+		if(x1 < min.x) x1 = min.x;
+		if(x2 >= max.x) x2 = max.x - 1;
+		if(x1 > x2) return;
+
+		pWriteSpan(y * pTargetSize.x + x1, x2 - x1 + 1, pixel);
+	}
+
+	inline void Application::Clear(const Pixel& pixel) {
+		if(pTargetFormat == PixelFormat::INDEXED8) {
+			memset(pIndexBuffer, pixel.r, pTargetSize.prod());
+			pFrameResolved = false;
+		} else if(pTargetFormat == PixelFormat::RGB565) {
+			std::fill_n(p565Buffer, pTargetSize.prod(), PackRGB565(pixel));
+			pFrameResolved = false;
+		} else {
+			std::fill_n(pTarget, pTargetSize.prod(), pixel);
+		}
+	}
+
+	inline void Application::Draw(const vu2d& pos, const Pixel& pixel) {
+		vi2d min, max;
+		pClipBounds(min, max);
+
+		if((int32_t) pos.x < min.x || (int32_t) pos.y < min.y || (int32_t) pos.x >= max.x || (int32_t) pos.y >= max.y) return;
+
+		pWriteSpan(pos.y * pTargetSize.x + pos.x, 1, pixel);
+	}
+
+	void Application::DrawLine(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel) {
+		int32_t x, y, dx, dy, dx1, dy1, px, py, xe, ye, i;
+		dx = pos2.x - pos1.x; dy = pos2.y - pos1.y;
+
+		if(dx == 0) {
+			if(pos2.y < pos1.y) for(y = pos2.y; y <= (int32_t) pos1.y; y++) Draw(vu2d(pos2.x, y), pixel);
+			else for(y = pos1.y; y <= (int32_t) pos2.y; y++) Draw(vu2d(pos1.x, y), pixel);
+
+			return;
+		}
+
+		if(dy == 0) {
+			pDrawSpan(pos1.x, pos2.x, pos1.y, pixel);
+			return;
+		}
+
+		dx1 = std::abs(dx); dy1 = std::abs(dy);
+		px = 2 * dy1 - dx1;	py = 2 * dx1 - dy1;
+
+		if(dy1 <= dx1) {
+			if(dx >= 0) {
+				x = pos1.x; y = pos1.y; xe = pos2.x;
+			} else {
+				x = pos2.x; y = pos2.y; xe = pos1.x;
+			}
+
+			Draw(vu2d(x, y), pixel);
+
+			for(i = 0; x < xe; i++) {
+
+				x = x + 1;
+
+				if(px < 0)
+					px = px + 2 * dy1;
+				else {
+					if((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) y = y + 1; else y = y - 1;
+					px = px + 2 * (dy1 - dx1);
+				}
+
+				Draw(vu2d(x, y), pixel);
+			}
+
+		} else {
+
+			if(dy >= 0) {
+				x = pos1.x; y = pos1.y; ye = pos2.y;
+			} else {
+				x = pos2.x; y = pos2.y; ye = pos1.y;
+			}
+
+			Draw(vu2d(x, y), pixel);
+
+			for(i = 0; y < ye; i++) {
+
+				y = y + 1;
+
+				if(py <= 0) {
+					py = py + 2 * dx1;
+				} else {
+					if((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) x = x + 1; else x = x - 1;
+					py = py + 2 * (dx1 - dy1);
+				}
+
+				Draw(vu2d(x, y), pixel);
+			}
+		}
+	}
+
+	/*
+		Point batches test bounds and form framebuffer offsets four at a
+		time. Coordinates are read with a stride of S ints, so vi2d arrays
+		(S = 2) and separate x and y arrays (S = 1) share one path. With
+		sortRows or parallel set, offsets are first bucketed by row or by
+		band with a stable counting sort, which keeps draw order within a
+		pixel and lets each thread own whole bands of the framebuffer.
+	*/
+
+	template<size_t S, class F> inline void Application::pPointOffsets(const int32_t* xs, const int32_t* ys, size_t begin, size_t end, F&& emit) const {
+		const int32_t w = pTargetSize.x;
+		const int32_t h = pTargetSize.y;
+
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		if(lo.x >= hi.x || lo.y >= hi.y) return;
+
+		const uint32_t cw = hi.x - lo.x, ch = hi.y - lo.y;
+		size_t i = begin;
+
+	#ifdef PIXEL_SSE2
+		// madd_epi16 forms y * w + x in one step while both fit in 16 bits
+		if(w < 0x8000 && h < 0x8000) {
+			const __m128i bias = _mm_set1_epi32((int) 0x80000000);
+			const __m128i left = _mm_set1_epi32(lo.x);
+			const __m128i top = _mm_set1_epi32(lo.y);
+			const __m128i width = _mm_xor_si128(_mm_set1_epi32(cw), bias);
+			const __m128i height = _mm_xor_si128(_mm_set1_epi32(ch), bias);
+			const __m128i stride = _mm_set1_epi32((1 << 16) | w);
+
+			for(; i + 4 <= end; i += 4) {
+				__m128i x, y;
+
+				if constexpr(S == 2) {
+					__m128 a = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(xs + 2 * i)));
+					__m128 b = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(xs + 2 * i + 4)));
+
+					x = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+					y = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+				} else {
+					x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(xs + i));
+					y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ys + i));
+				}
+
+				// Unsigned compares through the sign bias catch points left of or above the clip too
+				__m128i inside = _mm_and_si128(
+					_mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(x, left), bias), width),
+					_mm_cmplt_epi32(_mm_xor_si128(_mm_sub_epi32(y, top), bias), height));
+
+				int mask = _mm_movemask_ps(_mm_castsi128_ps(inside));
+				if(mask == 0) continue;
+
+				__m128i packed = _mm_or_si128(_mm_and_si128(y, _mm_set1_epi32(0xFFFF)), _mm_slli_epi32(x, 16));
+				alignas(16) uint32_t offsets[4];
+				alignas(16) uint32_t rows[4];
+				_mm_store_si128(reinterpret_cast<__m128i*>(offsets), _mm_madd_epi16(packed, stride));
+				_mm_store_si128(reinterpret_cast<__m128i*>(rows), y);
+
+				while(mask) {
+					int lane = std::countr_zero((unsigned) mask);
+					emit(i + lane, offsets[lane], rows[lane]);
+					mask &= mask - 1;
+				}
+			}
+		}
+	#endif
+
+		for(; i < end; i++) {
+			int32_t x = xs[S * i];
+			int32_t y = S == 2 ? xs[S * i + 1] : ys[i];
+
+			if((uint32_t) (x - lo.x) < cw && (uint32_t) (y - lo.y) < ch) emit(i, (uint32_t) (y * w + x), (uint32_t) y);
+		}
+	}
+
+	template<class F> inline void Application::pPointWriter(F&& body) {
+		pixel::DrawingMode mode = pDrawingMode;
+
+		if(pCoverage.active) {
+			body([this] (uint32_t o, const Pixel& p) { pWriteSpan(o, 1, p); });
+			return;
+		}
+
+		switch(pTargetFormat) {
+			case PixelFormat::RGBA32:
+			{
+				Pixel* d = pTarget;
+
+				if(mode == DrawingMode::NO_ALPHA) body([d] (uint32_t o, const Pixel& p) { d[o] = p; });
+				else if(mode == DrawingMode::FULL_ALPHA) body([d] (uint32_t o, const Pixel& p) { d[o] = p.a == 255 ? p : BlendPixel(d[o], p); });
+				else if(mode == DrawingMode::LINEAR_ALPHA) body([d] (uint32_t o, const Pixel& p) { d[o] = p.a == 255 ? p : BlendPixelLinear(d[o], p); });
+				else body([d] (uint32_t o, const Pixel& p) { if(p.a == 255) d[o] = p; });
+
+				return;
+			}
+			case PixelFormat::INDEXED8:
+			{
+				uint8_t* d = pIndexBuffer;
+				pFrameResolved = false;
+
+				uint8_t threshold = mode == DrawingMode::NO_ALPHA ? 0 : mode == DrawingMode::MASK ? 255 : 128;
+
+				body([d, threshold] (uint32_t o, const Pixel& p) { if(p.a >= threshold) d[o] = p.r; });
+				return;
+			}
+			case PixelFormat::RGB565:
+			{
+				uint16_t* d = p565Buffer;
+				pFrameResolved = false;
+
+				if(mode == DrawingMode::NO_ALPHA) body([d] (uint32_t o, const Pixel& p) { d[o] = PackRGB565(p); });
+				else if(mode != DrawingMode::MASK) body([d, mode] (uint32_t o, const Pixel& p) { d[o] = PackRGB565(p.a == 255 ? p : BlendPixel(UnpackRGB565(d[o]), p, mode)); });
+				else body([d] (uint32_t o, const Pixel& p) { if(p.a == 255) d[o] = PackRGB565(p); });
+
+				return;
+			}
+		}
+	}
+
+	template<size_t S, class C> inline void Application::pDrawPoints(const int32_t* xs, const int32_t* ys, size_t count, C&& colour, bool sortRows, bool parallel) {
+		if(count == 0) return;
+
+		if(!sortRows && !parallel) {
+			pPointWriter([&] (auto&& write) {
+				pPointOffsets<S>(xs, ys, 0, count, [&] (size_t i, uint32_t offset, uint32_t) {
+					write(offset, colour(i));
+				});
+			});
+
+			return;
+		}
+
+		const uint32_t chunk = 1 << 14;
+		const uint32_t chunks = (uint32_t) ((count + chunk - 1) / chunk);
+
+		// Offsets and rows land in per point slots, so chunks can be computed concurrently
+		pPointRefs.resize(count);
+		PointRef* refs = pPointRefs.data();
+
+		auto offsets = [&] (uint32_t begin, uint32_t end) {
+			for(uint32_t c = begin; c < end; c++) {
+				size_t first = (size_t) c * chunk;
+				size_t last = (std::min)(first + chunk, count);
+
+				for(size_t i = first; i < last; i++) refs[i].offset = 0xFFFFFFFF;
+
+				pPointOffsets<S>(xs, ys, first, last, [&] (size_t i, uint32_t offset, uint32_t row) {
+					refs[i].offset = offset;
+					refs[i].row = row;
+				});
+			}
+		};
+
+		if(parallel) Workers().ParallelFor(chunks, 1, offsets);
+		else offsets(0, chunks);
+
+		// Bands are a power of two rows tall so the bucket is a shift of the row
+		uint32_t rows = pTargetSize.y;
+		uint32_t shift = sortRows ? 0 : std::bit_width((std::max)(rows / (Workers().Threads() * 4), 1u)) - 1;
+		uint32_t buckets = ((rows - 1) >> shift) + 1;
+
+		pPointBuckets.assign(buckets + 1, 0);
+
+		for(size_t i = 0; i < count; i++) {
+			if(refs[i].offset != 0xFFFFFFFF) pPointBuckets[(refs[i].row >> shift) + 1]++;
+		}
+
+		for(uint32_t b = 0; b < buckets; b++) pPointBuckets[b + 1] += pPointBuckets[b];
+
+		size_t visible = pPointBuckets[buckets];
+		pPointSorted.resize(visible);
+
+		for(size_t i = 0; i < count; i++) {
+			uint32_t offset = refs[i].offset;
+			if(offset != 0xFFFFFFFF) pPointSorted[pPointBuckets[refs[i].row >> shift]++] = { offset, colour(i) };
+		}
+
+		// The scatter advanced each start to the next bucket's, so bucket b now begins at b - 1
+		pPointWriter([&] (auto&& write) {
+			auto bands = [&] (uint32_t begin, uint32_t end) {
+				size_t first = begin == 0 ? 0 : pPointBuckets[begin - 1];
+				size_t last = pPointBuckets[end - 1];
+
+				for(size_t i = first; i < last; i++) write(pPointSorted[i].offset, pPointSorted[i].pixel);
+			};
+
+			if(parallel && !pCoverage.active) Workers().ParallelFor(buckets, (std::max)(buckets / (Workers().Threads() * 4), 1u), bands);
+			else bands(0, buckets);
+		});
+	}
+
+	inline void Application::DrawPoints(const vi2d* points, size_t count, const Pixel& pixel, bool sortRows, bool parallel) {
+		const int32_t* xy = reinterpret_cast<const int32_t*>(points);
+		pDrawPoints<2>(xy, xy + 1, count, [&] (size_t) -> const Pixel& { return pixel; }, sortRows, parallel);
+	}
+
+	inline void Application::DrawPoints(const vi2d* points, const Pixel* pixels, size_t count, bool sortRows, bool parallel) {
+		const int32_t* xy = reinterpret_cast<const int32_t*>(points);
+		pDrawPoints<2>(xy, xy + 1, count, [&] (size_t i) -> const Pixel& { return pixels[i]; }, sortRows, parallel);
+	}
+
+	inline void Application::DrawPoints(const int32_t* xs, const int32_t* ys, size_t count, const Pixel& pixel, bool sortRows, bool parallel) {
+		pDrawPoints<1>(xs, ys, count, [&] (size_t) -> const Pixel& { return pixel; }, sortRows, parallel);
+	}
+
+	inline void Application::DrawPoints(const int32_t* xs, const int32_t* ys, const Pixel* pixels, size_t count, bool sortRows, bool parallel) {
+		pDrawPoints<1>(xs, ys, count, [&] (size_t i) -> const Pixel& { return pixels[i]; }, sortRows, parallel);
+	}
+
+	/*
+		Batched lines clip every segment against the screen up front by
+		solving for the range of major axis steps whose pixels land on it,
+		then run a single Bresenham loop per segment that writes straight
+		into the target buffer. The setup and format dispatch happen once
+		per batch rather than once per pixel.
+	*/
+
+	template<class S> inline void Application::pDrawSegments(size_t count, S&& segment) {
+		auto start = std::chrono::steady_clock::now();
+
+		const int64_t w = pTargetSize.x;
+		const pixel::DrawingMode mode = pDrawingMode;
+
+		vi2d clipMin, clipMax;
+		pClipBounds(clipMin, clipMax);
+
+		if(clipMin.x >= clipMax.x || clipMin.y >= clipMax.y) return;
+
+		auto raster = [&] (auto* buffer, bool canBlend, auto&& plot) {
+			LineSegment s;
+
+			for(size_t k = 0; k < count; k++) {
+				segment(k, s);
+
+				bool blend = false;
+
+				if(pDrawingMode != DrawingMode::NO_ALPHA && s.pixel.a != 255) {
+					if(pDrawingMode == DrawingMode::MASK) continue;
+					if(!canBlend && s.pixel.a < 128) continue;
+					blend = canBlend;
+				}
+
+				int64_t dx = int64_t(s.b.x) - s.a.x;
+				int64_t dy = int64_t(s.b.y) - s.a.y;
+
+				bool steep = std::abs(dy) > std::abs(dx);
+
+				int64_t major = steep ? std::abs(dy) : std::abs(dx);
+				int64_t minor = steep ? std::abs(dx) : std::abs(dy);
+
+				int64_t ma = steep ? s.a.y : s.a.x, maStep = (steep ? dy : dx) < 0 ? -1 : 1;
+				int64_t mi = steep ? s.a.x : s.a.y, miStep = (steep ? dx : dy) < 0 ? -1 : 1;
+
+				int64_t maLo = steep ? clipMin.y : clipMin.x, maHi = (steep ? clipMax.y : clipMax.x) - 1;
+				int64_t miLo = steep ? clipMin.x : clipMin.y, miHi = (steep ? clipMax.x : clipMax.y) - 1;
+
+				int64_t i0 = s.skipFirst ? 1 : 0;
+				int64_t i1 = major - (s.skipLast ? 1 : 0);
+
+				// Steps whose major coordinate is inside the clip
+				if(maStep > 0) {
+					i0 = (std::max)(i0, maLo - ma);
+					i1 = (std::min)(i1, maHi - ma);
+				} else {
+					i0 = (std::max)(i0, ma - maHi);
+					i1 = (std::min)(i1, ma - maLo);
+				}
+
+				// Minor offset at step i is (2 * i * minor + major) / (2 * major), so it can be inverted exactly
+				int64_t lo = miStep > 0 ? miLo - mi : mi - miHi;
+				int64_t hi = miStep > 0 ? miHi - mi : mi - miLo;
+
+				if(hi < 0) continue;
+
+				if(minor == 0) {
+					if(lo > 0) continue;
+				} else {
+					if(lo > 0) i0 = (std::max)(i0, (2 * major * lo - major + 2 * minor - 1) / (2 * minor));
+					i1 = (std::min)(i1, (2 * major * (hi + 1) - major - 1) / (2 * minor));
+				}
+
+				if(i0 > i1) continue;
+
+				int64_t num = 2 * i0 * minor + major;
+				int64_t m = major ? num / (2 * major) : 0;
+				int64_t err = num - m * 2 * major;
+
+				int64_t x = steep ? mi + miStep * m : ma + maStep * i0;
+				int64_t y = steep ? ma + maStep * i0 : mi + miStep * m;
+
+				int64_t offset = y * w + x;
+				int64_t majorStride = steep ? maStep * w : maStep;
+				int64_t minorStride = steep ? miStep : miStep * w;
+
+				for(int64_t i = i0; i <= i1; i++) {
+					plot(buffer, offset, s.pixel, blend);
+
+					offset += majorStride;
+					err += 2 * minor;
+
+					if(err >= 2 * major) {
+						err -= 2 * major;
+						offset += minorStride;
+					}
+				}
+			}
+		};
+
+		if(pCoverage.active) {
+			raster(pTarget, true, [this] (Pixel*, int64_t o, const Pixel& p, bool) {
+				pWriteSpan((uint32_t) o, 1, p);
+			});
+		} else switch(pTargetFormat) {
+			case PixelFormat::RGBA32:
+				raster(pTarget, true, [mode] (Pixel* d, int64_t o, const Pixel& p, bool blend) {
+					d[o] = blend ? BlendPixel(d[o], p, mode) : p;
+				});
+				break;
+			case PixelFormat::INDEXED8:
+				pFrameResolved = false;
+				raster(pIndexBuffer, false, [] (uint8_t* d, int64_t o, const Pixel& p, bool) {
+					d[o] = p.r;
+				});
+				break;
+			case PixelFormat::RGB565:
+				pFrameResolved = false;
+				raster(p565Buffer, true, [mode] (uint16_t* d, int64_t o, const Pixel& p, bool blend) {
+					d[o] = PackRGB565(blend ? BlendPixel(UnpackRGB565(d[o]), p, mode) : p);
+				});
+				break;
+		}
+
+		pStats.segments += count;
+		pStats.segmentTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline void Application::DrawLines(const vi2d* points, size_t count, const Pixel& pixel) {
+		pDrawSegments(count / 2, [&] (size_t k, LineSegment& s) {
+			s.a = points[2 * k];
+			s.b = points[2 * k + 1];
+			s.pixel = pixel;
+			s.skipFirst = s.skipLast = false;
+		});
+	}
+
+	// One pixel per segment, so pixels[k] colours points[2k] to points[2k + 1]
+	inline void Application::DrawLines(const vi2d* points, const Pixel* pixels, size_t count) {
+		pDrawSegments(count / 2, [&] (size_t k, LineSegment& s) {
+			s.a = points[2 * k];
+			s.b = points[2 * k + 1];
+			s.pixel = pixels[k];
+			s.skipFirst = s.skipLast = false;
+		});
+	}
+
+	inline void Application::DrawPolyline(const vi2d* points, size_t count, const Pixel& pixel, bool closed) {
+		if(count == 0) return;
+
+		if(count == 1) {
+			pDrawSegments(1, [&] (size_t, LineSegment& s) {
+				s.a = s.b = points[0];
+				s.pixel = pixel;
+				s.skipFirst = s.skipLast = false;
+			});
+
+			return;
+		}
+
+		size_t segments = closed ? count : count - 1;
+
+		// Shared vertices are only written by the segment that reaches them first
+		pDrawSegments(segments, [&] (size_t k, LineSegment& s) {
+			s.a = points[k];
+			s.b = points[k + 1 == count ? 0 : k + 1];
+			s.pixel = pixel;
+			s.skipFirst = k > 0;
+			s.skipLast = closed && k + 1 == segments;
+		});
+	}
+
+	/*
+		Thick strokes are built from convex pieces (segment quads, miter and
+		bevel wedges, round join discs) that are scan converted into row
+		spans. The spans of a whole batch are bucketed by row, merged and
+		written once, so overlapping pieces never blend twice. Pixel centres
+		sit on integer coordinates and pieces own the half open range
+		[top, bottom) on each axis.
+	*/
+
+	inline void Application::pStrokePolygon(const vf2d* points, uint32_t count) {
+		float top = points[0].y, bottom = points[0].y;
+		float left = points[0].x, right = points[0].x;
+
+		for(uint32_t i = 1; i < count; i++) {
+			top = (std::min)(top, points[i].y);
+			bottom = (std::max)(bottom, points[i].y);
+			left = (std::min)(left, points[i].x);
+			right = (std::max)(right, points[i].x);
+		}
+
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		if(right < (float) lo.x || left >= (float) hi.x) return;
+
+		int32_t y1 = (std::max)((int32_t) std::ceil(top), lo.y);
+		int32_t y2 = (std::min)((int32_t) std::ceil(bottom), hi.y);
+
+		for(int32_t y = y1; y < y2; y++) {
+			float fy = (float) y;
+			float x1 = right, x2 = left;
+
+			for(uint32_t i = 0, j = count - 1; i < count; j = i++) {
+				const vf2d& p = points[j];
+				const vf2d& q = points[i];
+
+				if((fy < p.y) == (fy < q.y)) continue;
+
+				float x = p.x + (fy - p.y) * (q.x - p.x) / (q.y - p.y);
+
+				x1 = (std::min)(x1, x);
+				x2 = (std::max)(x2, x);
+			}
+
+			int32_t sx1 = (int32_t) std::ceil(x1);
+			int32_t sx2 = (int32_t) std::ceil(x2) - 1;
+
+			if(sx1 <= sx2) pStrokeSpans.push_back({ sx1, sx2, y });
+		}
+	}
+
+	inline void Application::pStrokeDisc(const vf2d& centre, float radius) {
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		if(centre.x + radius < (float) lo.x || centre.x - radius >= (float) hi.x) return;
+
+		int32_t y1 = (std::max)((int32_t) std::ceil(centre.y - radius), lo.y);
+		int32_t y2 = (std::min)((int32_t) std::ceil(centre.y + radius), hi.y);
+
+		for(int32_t y = y1; y < y2; y++) {
+			float dy = (float) y - centre.y;
+			float dx = std::sqrt((std::max)(radius * radius - dy * dy, 0.0f));
+
+			int32_t sx1 = (int32_t) std::ceil(centre.x - dx);
+			int32_t sx2 = (int32_t) std::ceil(centre.x + dx) - 1;
+
+			if(sx1 <= sx2) pStrokeSpans.push_back({ sx1, sx2, y });
+		}
+	}
+
+	inline void Application::pStrokeJoin(const vf2d& prev, const vf2d& pos, const vf2d& next, float half, LineJoin join) {
+		if(join == LineJoin::ROUND) {
+			pStrokeDisc(pos, half);
+			return;
+		}
+
+		vf2d d0 = pos - prev, d1 = next - pos;
+		d0 /= std::sqrt(d0.x * d0.x + d0.y * d0.y);
+		d1 /= std::sqrt(d1.x * d1.x + d1.y * d1.y);
+
+		float cross = d0.x * d1.y - d0.y * d1.x;
+		if(cross == 0.0f) return;
+
+		// The join fills the gap on the outside of the turn
+		float side = cross > 0.0f ? -1.0f : 1.0f;
+
+		vf2d n0(-d0.y * side, d0.x * side);
+		vf2d n1(-d1.y * side, d1.x * side);
+
+		float dot = n0.x * n1.x + n0.y * n1.y;
+
+		// Same miter limit of 4 as SVG, past that the corner falls back to a bevel
+		if(join == LineJoin::MITER && 1.0f + dot > 0.125f) {
+			vf2d quad[4] = { pos, pos + n0 * half, pos + (n0 + n1) * (half / (1.0f + dot)), pos + n1 * half };
+			pStrokePolygon(quad, 4);
+		} else {
+			vf2d tri[3] = { pos, pos + n0 * half, pos + n1 * half };
+			pStrokePolygon(tri, 3);
+		}
+	}
+
+	inline void Application::pFlushStroke(const Pixel& pixel) {
+		size_t count = pStrokeSpans.size();
+		if(count == 0) return;
+
+		uint32_t h = pTargetSize.y;
+
+		pStrokeRows.assign(h + 1, 0);
+		for(const Span& s : pStrokeSpans) pStrokeRows[s.y + 1]++;
+		for(uint32_t y = 0; y < h; y++) pStrokeRows[y + 1] += pStrokeRows[y];
+
+		pStrokeSorted.resize(count);
+		for(const Span& s : pStrokeSpans) pStrokeSorted[pStrokeRows[s.y]++] = s;
+
+		for(size_t i = 0; i < count;) {
+			size_t end = i + 1;
+			while(end < count && pStrokeSorted[end].y == pStrokeSorted[i].y) end++;
+
+			std::sort(pStrokeSorted.begin() + i, pStrokeSorted.begin() + end, [] (const Span& a, const Span& b) {
+				return a.x1 < b.x1;
+			});
+
+			Span run = pStrokeSorted[i];
+
+			for(size_t j = i + 1; j < end; j++) {
+				if(pStrokeSorted[j].x1 <= run.x2 + 1) {
+					run.x2 = (std::max)(run.x2, pStrokeSorted[j].x2);
+				} else {
+					pDrawSpan(run.x1, run.x2, run.y, pixel);
+					run = pStrokeSorted[j];
+				}
+			}
+
+			pDrawSpan(run.x1, run.x2, run.y, pixel);
+			i = end;
+		}
+
+		pStrokeSpans.clear();
+	}
+
+	inline void Application::DrawLines(const vf2d* points, size_t count, float width, const Pixel& pixel) {
+		auto start = std::chrono::steady_clock::now();
+		float half = width * 0.5f;
+
+		for(size_t k = 0; k + 1 < count; k += 2) {
+			vf2d d = points[k + 1] - points[k];
+			float length = std::sqrt(d.x * d.x + d.y * d.y);
+			if(length == 0.0f) continue;
+
+			vf2d n(-d.y * half / length, d.x * half / length);
+			vf2d quad[4] = { points[k] + n, points[k + 1] + n, points[k + 1] - n, points[k] - n };
+
+			pStrokePolygon(quad, 4);
+		}
+
+		pFlushStroke(pixel);
+
+		pStats.segments += count / 2;
+		pStats.segmentTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline void Application::DrawPolyline(const vf2d* points, size_t count, float width, const Pixel& pixel, LineJoin join, bool closed) {
+		auto start = std::chrono::steady_clock::now();
+		float half = width * 0.5f;
+
+		// Repeated points have no direction to join along
+		pStrokePoints.clear();
+
+		for(size_t i = 0; i < count; i++) {
+			if(pStrokePoints.empty() || points[i].x != pStrokePoints.back().x || points[i].y != pStrokePoints.back().y) {
+				pStrokePoints.push_back(points[i]);
+			}
+		}
+
+		size_t n = pStrokePoints.size();
+
+		if(closed && n > 1 && pStrokePoints[0].x == pStrokePoints[n - 1].x && pStrokePoints[0].y == pStrokePoints[n - 1].y) {
+			pStrokePoints.pop_back();
+			n--;
+		}
+
+		if(n == 1 && join == LineJoin::ROUND) pStrokeDisc(pStrokePoints[0], half);
+		if(n < 2) closed = false;
+
+		size_t segments = n < 2 ? 0 : closed ? n : n - 1;
+
+		for(size_t k = 0; k < segments; k++) {
+			const vf2d& a = pStrokePoints[k];
+			const vf2d& b = pStrokePoints[(k + 1) % n];
+
+			vf2d d = b - a;
+			float length = std::sqrt(d.x * d.x + d.y * d.y);
+
+			vf2d o(-d.y * half / length, d.x * half / length);
+			vf2d quad[4] = { a + o, b + o, b - o, a - o };
+
+			pStrokePolygon(quad, 4);
+
+			if(closed || k + 1 < segments) pStrokeJoin(a, b, pStrokePoints[(k + 2) % n], half, join);
+		}
+
+		pFlushStroke(pixel);
+
+		pStats.segments += segments;
+		pStats.segmentTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/*
+		Conics are rasterized one row at a time: pEllipseRows walks the half
+		widths of an ellipse with integer midpoint stepping, and every shape
+		below turns each row into at most two spans, so no pixel is written
+		twice and blending stays correct. Rows outside the screen are skipped
+		before anything is written.
+	*/
+
+	template<class F> inline void Application::pEllipseRows(int32_t rx, int32_t ry, int32_t top, int32_t bottom, F&& row) {
+		auto walk = [&] (auto zero) {
+			using T = decltype(zero);
+
+			T a = T(2 * int64_t(rx) + 1) * T(2 * int64_t(rx) + 1);
+			T b = T(2 * int64_t(ry) + 1) * T(2 * int64_t(ry) + 1);
+
+			// Pixel (x, y) is inside the ellipse of radii rx + 1/2, ry + 1/2 while e <= 0
+			int32_t x = rx;
+			T e = 4 * T(x) * T(x) * b - a * b;
+
+			auto width = [&] () {
+				while(x >= 0 && e > 0) {
+					e -= 4 * b * T(2 * int64_t(x) - 1);
+					x--;
+				}
+
+				return x;
+			};
+
+			vi2d lo, hi;
+			pClipBounds(lo, hi);
+
+			int32_t hw = width();
+
+			for(int32_t y = 0; y <= ry; y++) {
+				int32_t next = -1;
+
+				if(y < ry) {
+					e += 4 * a * T(2 * int64_t(y) + 1);
+					next = width();
+				}
+
+				if((top - y >= lo.y && top - y < hi.y) || (bottom + y >= lo.y && bottom + y < hi.y)) {
+					row(y, hw, next);
+				} else if(top - y < lo.y && bottom + y >= hi.y) {
+					break;
+				}
+
+				hw = next;
+			}
+		};
+
+		// The error terms need about 4 * (2r)^4 of range, which int64_t covers up to r = 16383
+		if(rx < 0x4000 && ry < 0x4000) walk(int64_t(0)); else walk(double(0));
+	}
+
+	inline void Application::pDrawWedgeSpan(int32_t cx, int32_t y, int32_t dy, int32_t x1, int32_t x2, float start, float sweep, const Pixel& pixel) {
+		if(sweep >= 6.2831853f) {
+			pDrawSpan(cx + x1, cx + x2, y, pixel);
+			return;
+		}
+
+		float end = start + sweep;
+		float s0 = std::sin(start), c0 = std::cos(start);
+		float s1 = std::sin(end), c1 = std::cos(end);
+
+		const int32_t inf = 0x3FFFFFFF;
+
+		// Each bounding ray is a half plane, which on a single row is a half line
+		int32_t l0 = -inf, r0 = inf, l1 = -inf, r1 = inf;
+
+		if(s0 > 0.0f) r0 = (int32_t) std::floor(c0 * dy / s0);
+		else if(s0 < 0.0f) l0 = (int32_t) std::ceil(c0 * dy / s0);
+		else if(c0 * dy < 0.0f) l0 = inf;
+
+		if(s1 > 0.0f) l1 = (int32_t) std::ceil(c1 * dy / s1);
+		else if(s1 < 0.0f) r1 = (int32_t) std::floor(c1 * dy / s1);
+		else if(c1 * dy > 0.0f) l1 = inf;
+
+		auto emit = [&] (int32_t l, int32_t r) {
+			l = (std::max)(l, x1); r = (std::min)(r, x2);
+			if(l <= r) pDrawSpan(cx + l, cx + r, y, pixel);
+		};
+
+		if(sweep <= 3.14159265f) {
+			emit((std::max)(l0, l1), (std::min)(r0, r1));
+			return;
+		}
+
+		// Wider than half a turn: the union of both half lines, which may overlap
+		int32_t la = l0, ra = r0, lb = l1, rb = r1;
+		if(la > lb) { std::swap(la, lb); std::swap(ra, rb); }
+
+		if(ra >= lb - 1) {
+			emit(la, (std::max)(ra, rb));
+		} else {
+			emit(la, ra);
+			emit(lb, rb);
+		}
+	}
+
+	void Application::DrawCircle(const vu2d& pos, uint32_t radius, const Pixel& pixel) {
+		if(!radius) return;
+		DrawEllipse(pos, vu2d(radius, radius), pixel);
+	}
+
+	void Application::FillCircle(const vu2d& pos, uint32_t radius, const Pixel& pixel) {
+		if(!radius) return;
+		FillEllipse(pos, vu2d(radius, radius), pixel);
+	}
+
+	inline void Application::FillCircleLinear(const vu2d& pos, uint32_t radius, const vf2d& from, const vf2d& to, const Pixel& start, const Pixel& end) {
+		int32_t cx = pos.x, cy = pos.y, r = radius;
+
+		if(!radius || pOccluded(cx - r, cy - r, cx + r, cy + r)) return;
+
+		vf2d d = to - from;
+		float length = d.x * d.x + d.y * d.y;
+		vf2d slope = length > 0.0f ? vf2d(d.x / length, d.y / length) : vf2d(0.0f, 0.0f);
+
+		pEllipseRows(r, r, cy, cy, [&] (int32_t y, int32_t hw, int32_t) {
+			pLinearSpan(cx - hw, cx + hw, cy - y, from, slope, start, end);
+			if(y) pLinearSpan(cx - hw, cx + hw, cy + y, from, slope, start, end);
+		});
+	}
+
+	inline void Application::FillCircleRadial(const vu2d& pos, uint32_t radius, const Pixel& inner, const Pixel& outer) {
+		int32_t cx = pos.x, cy = pos.y, r = radius;
+
+		if(!radius || pOccluded(cx - r, cy - r, cx + r, cy + r)) return;
+
+		vf2d center((float) cx, (float) cy);
+
+		pEllipseRows(r, r, cy, cy, [&] (int32_t y, int32_t hw, int32_t) {
+			pRadialSpan(cx - hw, cx + hw, cy - y, center, (float) radius, inner, outer);
+			if(y) pRadialSpan(cx - hw, cx + hw, cy + y, center, (float) radius, inner, outer);
+		});
+	}
+
+	inline void Application::DrawEllipse(const vu2d& pos, const vu2d& radius, const Pixel& pixel) {
+		int32_t cx = pos.x, cy = pos.y;
+
+		pEllipseRows(radius.x, radius.y, cy, cy, [&] (int32_t y, int32_t hw, int32_t inner) {
+			int32_t in = (std::min)(inner, hw - 1);
+
+			for(int32_t row : { cy - y, cy + y }) {
+				if(in < 0) {
+					pDrawSpan(cx - hw, cx + hw, row, pixel);
+				} else {
+					pDrawSpan(cx - hw, cx - in - 1, row, pixel);
+					pDrawSpan(cx + in + 1, cx + hw, row, pixel);
+				}
+
+				if(y == 0) break;
+			}
+		});
+	}
+
+	inline void Application::FillEllipse(const vu2d& pos, const vu2d& radius, const Pixel& pixel) {
+		int32_t cx = pos.x, cy = pos.y;
+
+		if(pOccluded(cx - (int32_t) radius.x, cy - (int32_t) radius.y, cx + (int32_t) radius.x, cy + (int32_t) radius.y)) return;
+
+		pEllipseRows(radius.x, radius.y, cy, cy, [&] (int32_t y, int32_t hw, int32_t) {
+			pDrawSpan(cx - hw, cx + hw, cy - y, pixel);
+			if(y) pDrawSpan(cx - hw, cx + hw, cy + y, pixel);
+		});
+	}
+
+	inline void Application::DrawArc(const vu2d& pos, uint32_t radius, float start, float end, const Pixel& pixel) {
+		int32_t cx = pos.x, cy = pos.y;
+
+		float sweep = end - start;
+		if(std::abs(sweep) < 6.2831853f) sweep = std::fmod(sweep + 6.2831853f, 6.2831853f);
+		else sweep = 6.2831853f;
+
+		pEllipseRows(radius, radius, cy, cy, [&] (int32_t y, int32_t hw, int32_t inner) {
+			int32_t in = (std::min)(inner, hw - 1);
+
+			for(int32_t dy : { -y, y }) {
+				if(in < 0) {
+					pDrawWedgeSpan(cx, cy + dy, dy, -hw, hw, start, sweep, pixel);
+				} else {
+					pDrawWedgeSpan(cx, cy + dy, dy, -hw, -in - 1, start, sweep, pixel);
+					pDrawWedgeSpan(cx, cy + dy, dy, in + 1, hw, start, sweep, pixel);
+				}
+
+				if(y == 0) break;
+			}
+		});
+	}
+
+	inline void Application::FillPie(const vu2d& pos, uint32_t radius, float start, float end, const Pixel& pixel) {
+		int32_t cx = pos.x, cy = pos.y;
+
+		float sweep = end - start;
+		if(std::abs(sweep) < 6.2831853f) sweep = std::fmod(sweep + 6.2831853f, 6.2831853f);
+		else sweep = 6.2831853f;
+
+		pEllipseRows(radius, radius, cy, cy, [&] (int32_t y, int32_t hw, int32_t) {
+			pDrawWedgeSpan(cx, cy - y, -y, -hw, hw, start, sweep, pixel);
+			if(y) pDrawWedgeSpan(cx, cy + y, y, -hw, hw, start, sweep, pixel);
+		});
+	}
+
+	inline void Application::DrawRoundedRect(const vu2d& pos1, const vu2d& pos2, uint32_t radius, const Pixel& pixel) {
+		int32_t x1 = (std::min)((int32_t) pos1.x, (int32_t) pos2.x), x2 = (std::max)((int32_t) pos1.x, (int32_t) pos2.x);
+		int32_t y1 = (std::min)((int32_t) pos1.y, (int32_t) pos2.y), y2 = (std::max)((int32_t) pos1.y, (int32_t) pos2.y);
+		int32_t r = (std::min)((int32_t) radius, (std::min)(x2 - x1, y2 - y1) / 2);
+
+		int32_t l = x1 + r, rr = x2 - r;
+
+		pEllipseRows(r, r, y1 + r, y2 - r, [&] (int32_t y, int32_t hw, int32_t inner) {
+			if(y == 0) return;
+			int32_t in = (std::min)(inner, hw - 1);
+
+			for(int32_t row : { y1 + r - y, y2 - r + y }) {
+				if(in < 0) {
+					pDrawSpan(l - hw, rr + hw, row, pixel);
+				} else {
+					pDrawSpan(l - hw, l - in - 1, row, pixel);
+					pDrawSpan(rr + in + 1, rr + hw, row, pixel);
+				}
+			}
+		});
+
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		int32_t top = (std::max)(y1 + r, lo.y), bottom = (std::min)(y2 - r, hi.y - 1);
+
+		for(int32_t y = top; y <= bottom; y++) {
+			if(r == 0 && (y == y1 || y == y2)) {
+				pDrawSpan(x1, x2, y, pixel);
+				continue;
+			}
+
+			pDrawSpan(x1, x1, y, pixel);
+			if(x2 != x1) pDrawSpan(x2, x2, y, pixel);
+		}
+	}
+
+	inline void Application::FillRoundedRect(const vu2d& pos1, const vu2d& pos2, uint32_t radius, const Pixel& pixel) {
+		int32_t x1 = (std::min)((int32_t) pos1.x, (int32_t) pos2.x), x2 = (std::max)((int32_t) pos1.x, (int32_t) pos2.x);
+		int32_t y1 = (std::min)((int32_t) pos1.y, (int32_t) pos2.y), y2 = (std::max)((int32_t) pos1.y, (int32_t) pos2.y);
+
+		if(pOccluded(x1, y1, x2, y2)) return;
+		int32_t r = (std::min)((int32_t) radius, (std::min)(x2 - x1, y2 - y1) / 2);
+
+		int32_t l = x1 + r, rr = x2 - r;
+
+		pEllipseRows(r, r, y1 + r, y2 - r, [&] (int32_t y, int32_t hw, int32_t) {
+			if(y == 0) return;
+
+			pDrawSpan(l - hw, rr + hw, y1 + r - y, pixel);
+			pDrawSpan(l - hw, rr + hw, y2 - r + y, pixel);
+		});
+
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		int32_t top = (std::max)(y1 + r, lo.y), bottom = (std::min)(y2 - r, hi.y - 1);
+
+		for(int32_t y = top; y <= bottom; y++) {
+			pDrawSpan(x1, x2, y, pixel);
+		}
+	}
+
+	void Application::DrawRect(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel) {
+		DrawLine(vu2d(pos1.x, pos1.y), vu2d(pos1.y, pos2.x), pixel);
+		DrawLine(vu2d(pos1.y, pos2.x), vu2d(pos2.x, pos2.y), pixel);
+		DrawLine(vu2d(pos2.x, pos2.y), vu2d(pos2.y, pos1.x), pixel);
+		DrawLine(vu2d(pos2.y, pos1.x), vu2d(pos1.x, pos1.y), pixel);
+	}
+
+	void Application::FillRect(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel) {
+		if(pOccluded(min(pos1.x, pos2.x), min(pos1.y, pos2.y), max(pos1.x, pos2.x), max(pos1.y, pos2.y))) return;
+
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		int32_t x1 = (std::max)((int32_t) min(pos1.x, pos2.x), lo.x), x2 = (std::min)((int32_t) max(pos1.x, pos2.x), hi.x - 1);
+		int32_t y1 = (std::max)((int32_t) min(pos1.y, pos2.y), lo.y), y2 = (std::min)((int32_t) max(pos1.y, pos2.y), hi.y - 1);
+
+		if(x1 > x2) return;
+
+		for(int32_t y = y1; y <= y2; y++) {
+			pWriteSpan(y * pTargetSize.x + x1, x2 - x1 + 1, pixel);
+		}
+	}
+
+	/*
+		Gradient fills only differ from FillRect in how each span is written.
+		The four corner version interpolates the end colours of every row
+		down the sides, the span then steps across.
+	*/
+
+	inline void Application::FillRectGradient(const vu2d& pos1, const vu2d& pos2, const Pixel& topLeft, const Pixel& topRight, const Pixel& bottomLeft, const Pixel& bottomRight) {
+		int32_t xa = min(pos1.x, pos2.x), xb = max(pos1.x, pos2.x);
+		int32_t ya = min(pos1.y, pos2.y), yb = max(pos1.y, pos2.y);
+
+		if(pOccluded(xa, ya, xb, yb)) return;
+
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		int32_t y1 = (std::max)(ya, lo.y), y2 = (std::min)(yb, hi.y - 1);
+		float height = (float) (yb - ya);
+
+		float tl[4] = { (float) topLeft.r, (float) topLeft.g, (float) topLeft.b, (float) topLeft.a };
+		float tr[4] = { (float) topRight.r, (float) topRight.g, (float) topRight.b, (float) topRight.a };
+		float bl[4] = { (float) bottomLeft.r, (float) bottomLeft.g, (float) bottomLeft.b, (float) bottomLeft.a };
+		float br[4] = { (float) bottomRight.r, (float) bottomRight.g, (float) bottomRight.b, (float) bottomRight.a };
+
+		for(int32_t y = y1; y <= y2; y++) {
+			float v = height > 0.0f ? (y - ya) / height : 0.0f;
+			float left[4], right[4];
+
+			for(uint32_t k = 0; k < 4; k++) {
+				left[k] = tl[k] + (bl[k] - tl[k]) * v;
+				right[k] = tr[k] + (br[k] - tr[k]) * v;
 			}
 
-			pWindowSize.x = mi.rcMonitor.right;
-			pWindowSize.y = mi.rcMonitor.bottom;
-			topLeft = { 0, 0 };
+			pGradientSpan(xa, xb, y, left, right);
 		}
+	}
 
-		RECT winRect;
-		winRect.left = 0;
-		winRect.top = 0;
-		winRect.right = pWindowSize.x;
-		winRect.bottom = pWindowSize.y;
+	inline void Application::FillRectLinear(const vu2d& pos1, const vu2d& pos2, const vf2d& from, const vf2d& to, const Pixel& start, const Pixel& end) {
+		int32_t xa = min(pos1.x, pos2.x), xb = max(pos1.x, pos2.x);
+		int32_t ya = min(pos1.y, pos2.y), yb = max(pos1.y, pos2.y);
 
-		AdjustWindowRectEx(&winRect, style, FALSE, extendedStyle);
+		if(pOccluded(xa, ya, xb, yb)) return;
 
-		uint32_t w = winRect.right - winRect.left;
-		uint32_t h = winRect.bottom - winRect.top;
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
 
-		CreateWindowExW(extendedStyle, L"pixel_window_class", L"", style, topLeft.x, topLeft.y,
-						w, h, NULL, NULL, GetModuleHandle(nullptr), this);
+		vf2d d = to - from;
+		float length = d.x * d.x + d.y * d.y;
+		vf2d slope = length > 0.0f ? vf2d(d.x / length, d.y / length) : vf2d(0.0f, 0.0f);
 
-		if(!pHwnd) {
-			throw std::runtime_error("Window creation failed.");
+		for(int32_t y = (std::max)(ya, lo.y); y <= (std::min)(yb, hi.y - 1); y++) {
+			pLinearSpan(xa, xb, y, from, slope, start, end);
 		}
+	}
 
-		SetWindowTextA(pHwnd, pWindowTittle.c_str());
+	inline void Application::FillRectRadial(const vu2d& pos1, const vu2d& pos2, const vf2d& center, float radius, const Pixel& inner, const Pixel& outer) {
+		int32_t xa = min(pos1.x, pos2.x), xb = max(pos1.x, pos2.x);
+		int32_t ya = min(pos1.y, pos2.y), yb = max(pos1.y, pos2.y);
+
+		if(pOccluded(xa, ya, xb, yb)) return;
+
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		for(int32_t y = (std::max)(ya, lo.y); y <= (std::min)(yb, hi.y - 1); y++) {
+			pRadialSpan(xa, xb, y, center, radius, inner, outer);
+		}
 	}
 
-	void Application::pMapKeyboard() {
-		pKeyMap[0x00] = (uint8_t) Key::NONE;
+	void Application::DrawTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel) {
+		DrawLine(vu2d(pos1.x, pos1.y), vu2d(pos2.x, pos2.y), pixel);
+		DrawLine(vu2d(pos2.x, pos2.y), vu2d(pos3.x, pos3.y), pixel);
+		DrawLine(vu2d(pos3.x, pos3.y), vu2d(pos1.x, pos1.y), pixel);
+	}
 
-		pKeyMap[0x41] = (uint8_t) Key::A;
-		pKeyMap[0x42] = (uint8_t) Key::B;
-		pKeyMap[0x43] = (uint8_t) Key::C;
-		pKeyMap[0x44] = (uint8_t) Key::D;
-		pKeyMap[0x45] = (uint8_t) Key::E;
-		pKeyMap[0x46] = (uint8_t) Key::F;
-		pKeyMap[0x47] = (uint8_t) Key::G;
-		pKeyMap[0x48] = (uint8_t) Key::H;
-		pKeyMap[0x49] = (uint8_t) Key::I;
-		pKeyMap[0x4A] = (uint8_t) Key::J;
-		pKeyMap[0x4B] = (uint8_t) Key::K;
-		pKeyMap[0x4C] = (uint8_t) Key::L;
-		pKeyMap[0x4D] = (uint8_t) Key::M;
-		pKeyMap[0x4E] = (uint8_t) Key::N;
-		pKeyMap[0x4F] = (uint8_t) Key::O;
-		pKeyMap[0x50] = (uint8_t) Key::P;
-		pKeyMap[0x51] = (uint8_t) Key::Q;
-		pKeyMap[0x52] = (uint8_t) Key::R;
-		pKeyMap[0x53] = (uint8_t) Key::S;
-		pKeyMap[0x54] = (uint8_t) Key::T;
-		pKeyMap[0x55] = (uint8_t) Key::U;
-		pKeyMap[0x56] = (uint8_t) Key::V;
-		pKeyMap[0x57] = (uint8_t) Key::W;
-		pKeyMap[0x58] = (uint8_t) Key::X;
-		pKeyMap[0x59] = (uint8_t) Key::Y;
-		pKeyMap[0x5A] = (uint8_t) Key::Z;
+	void Application::FillTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel) {
+		auto drawline = [&] (int sx, int ex, int ny) {
+			pDrawSpan(sx, ex, ny, pixel);
+		};
 
-		pKeyMap[VK_F1] = (uint8_t) Key::F1;
-		pKeyMap[VK_F2] = (uint8_t) Key::F2;
-		pKeyMap[VK_F3] = (uint8_t) Key::F3;
-		pKeyMap[VK_F4] = (uint8_t) Key::F4;
-		pKeyMap[VK_F5] = (uint8_t) Key::F5;
-		pKeyMap[VK_F6] = (uint8_t) Key::F6;
-		pKeyMap[VK_F7] = (uint8_t) Key::F7;
-		pKeyMap[VK_F8] = (uint8_t) Key::F8;
-		pKeyMap[VK_F9] = (uint8_t) Key::F9;
-		pKeyMap[VK_F10] = (uint8_t) Key::F10;
-		pKeyMap[VK_F11] = (uint8_t) Key::F11;
-		pKeyMap[VK_F12] = (uint8_t) Key::F12;
+		int32_t t1x, t2x, y, minx, maxx, t1xp, t2xp;
+		int32_t signx1, signx2, dx1, dy1, dx2, dy2;
+		int32_t e1, e2;
 
-		pKeyMap[VK_DOWN] = (uint8_t) Key::DOWN;
-		pKeyMap[VK_LEFT] = (uint8_t) Key::LEFT;
-		pKeyMap[VK_RIGHT] = (uint8_t) Key::RIGHT;
-		pKeyMap[VK_UP] = (uint8_t) Key::UP;
+		bool changed1 = false;
+		bool changed2 = false;
 
-		pKeyMap[VK_RETURN] = (uint8_t) Key::ENTER;
-		pKeyMap[VK_BACK] = (uint8_t) Key::BACK;
-		pKeyMap[VK_ESCAPE] = (uint8_t) Key::ESCAPE;
-		pKeyMap[VK_RETURN] = (uint8_t) Key::ENTER;
-		pKeyMap[VK_PAUSE] = (uint8_t) Key::PAUSE;
-		pKeyMap[VK_SCROLL] = (uint8_t) Key::SCROLL;
-		pKeyMap[VK_TAB] = (uint8_t) Key::TAB;
-		pKeyMap[VK_DELETE] = (uint8_t) Key::DEL;
-		pKeyMap[VK_HOME] = (uint8_t) Key::HOME;
-		pKeyMap[VK_END] = (uint8_t) Key::END;
-		pKeyMap[VK_PRIOR] = (uint8_t) Key::PGUP;
-		pKeyMap[VK_NEXT] = (uint8_t) Key::PGDN;
-		pKeyMap[VK_INSERT] = (uint8_t) Key::INS;
-		pKeyMap[VK_SHIFT] = (uint8_t) Key::SHIFT;
-		pKeyMap[VK_CONTROL] = (uint8_t) Key::CTRL;
-		pKeyMap[VK_SPACE] = (uint8_t) Key::SPACE;
+		/*
+		if(pos1.y > pos2.y) { std::swap(pos1.y, pos2.y); std::swap(pos1.x, pos2.x); }
+		if(pos1.y > pos3.y) { std::swap(pos1.y, pos3.y); std::swap(pos1.x, pos3.x); }
+		if(pos2.y > pos3.y) { std::swap(pos2.y, pos3.y); std::swap(pos2.x, pos3.x); }
+		*/
 
-		pKeyMap[VK_NUMPAD0] = (uint8_t) Key::NP0;
-		pKeyMap[VK_NUMPAD1] = (uint8_t) Key::NP1;
-		pKeyMap[VK_NUMPAD2] = (uint8_t) Key::NP2;
-		pKeyMap[VK_NUMPAD3] = (uint8_t) Key::NP3;
-		pKeyMap[VK_NUMPAD4] = (uint8_t) Key::NP4;
-		pKeyMap[VK_NUMPAD5] = (uint8_t) Key::NP5;
-		pKeyMap[VK_NUMPAD6] = (uint8_t) Key::NP6;
-		pKeyMap[VK_NUMPAD7] = (uint8_t) Key::NP7;
-		pKeyMap[VK_NUMPAD8] = (uint8_t) Key::NP8;
-		pKeyMap[VK_NUMPAD9] = (uint8_t) Key::NP9;
+		t1x = t2x = pos1.x; y = pos1.y;
+		dx1 = (int) (pos2.x - pos1.x);
+		if(dx1 < 0) { dx1 = -dx1; signx1 = -1; } else signx1 = 1;
+		dy1 = (int) (pos2.y - pos1.y);
 
-		pKeyMap[VK_MULTIPLY] = (uint8_t) Key::NP_MUL;
-		pKeyMap[VK_ADD] = (uint8_t) Key::NP_ADD;
-		pKeyMap[VK_DIVIDE] = (uint8_t) Key::NP_DIV;
-		pKeyMap[VK_SUBTRACT] = (uint8_t) Key::NP_SUB;
-		pKeyMap[VK_DECIMAL] = (uint8_t) Key::NP_DECIMAL;
+		dx2 = (int) (pos3.x - pos1.x);
+		if(dx2 < 0) { dx2 = -dx2; signx2 = -1; } else signx2 = 1;
+		dy2 = (int) (pos3.y - pos1.y);
+
+		if(dy1 > dx1) { std::swap(dx1, dy1); changed1 = true; }
+		if(dy2 > dx2) { std::swap(dy2, dx2); changed2 = true; }
+
+		e2 = (int) (dx2 >> 1);
+
+		if(pos1.y == pos2.y) goto next;
+		e1 = (int) (dx1 >> 1);
+
+		for(int i = 0; i < dx1;) {
+			t1xp = 0; t2xp = 0;
+			if(t1x < t2x) { minx = t1x; maxx = t2x; } else { minx = t2x; maxx = t1x; }
+
+			while(i < dx1) {
+				i++;
+				e1 += dy1;
+
+				while(e1 >= dx1) {
+					e1 -= dx1;
+
+					if(changed1) t1xp = signx1;
+					else          goto next1;
+				}
+
+				if(changed1) break;
+				else t1x += signx1;
+			}
+
+			next1:
+
+			while(1) {
+				e2 += dy2;
+
+				while(e2 >= dx2) {
+					e2 -= dx2;
+
+					if(changed2) t2xp = signx2;
+					else          goto next2;
+				}
+
+				if(changed2)     break;
+				else              t2x += signx2;
+			}
+
+			next2:
+
+			if(minx > t1x) minx = t1x;
+			if(minx > t2x) minx = t2x;
+			if(maxx < t1x) maxx = t1x;
+			if(maxx < t2x) maxx = t2x;
+
+			drawline(minx, maxx, y);
+
+			if(!changed1) t1x += signx1;
+			t1x += t1xp;
+
+			if(!changed2) t2x += signx2;
+			t2x += t2xp;
+
+			y += 1;
+			if(y == pos2.y) break;
+
+		}
+
+		next:
+
+		dx1 = (int) (pos3.x - pos2.x); if(dx1 < 0) { dx1 = -dx1; signx1 = -1; } else signx1 = 1;
+		dy1 = (int) (pos3.y - pos2.y);
+
+		t1x = pos2.x;
+
+		if(dy1 > dx1) {
+			std::swap(dy1, dx1);
+			changed1 = true;
+		} else changed1 = false;
+
+		e1 = (int) (dx1 >> 1);
+
+		for(int i = 0; i <= dx1; i++) {
+			t1xp = 0; t2xp = 0;
+
+			if(t1x < t2x) { minx = t1x; maxx = t2x; } else { minx = t2x; maxx = t1x; }
+
+			while(i < dx1) {
+				e1 += dy1;
+
+				while(e1 >= dx1) {
+					e1 -= dx1;
+					if(changed1) { t1xp = signx1; break; } else goto next3;
+				}
+
+				if(changed1) break;
+				else   	   	  t1x += signx1;
+				if(i < dx1) i++;
+			}
+
+			next3:
+
+			while(t2x != pos3.x) {
+				e2 += dy2;
+
+				while(e2 >= dx2) {
+					e2 -= dx2;
+					if(changed2) t2xp = signx2;
+					else          goto next4;
+				}
+
+				if(changed2)     break;
+				else              t2x += signx2;
+			}
+
+			next4:
+
+			if(minx > t1x) minx = t1x;
+			if(minx > t2x) minx = t2x;
+			if(maxx < t1x) maxx = t1x;
+			if(maxx < t2x) maxx = t2x;
+
+			drawline(minx, maxx, y);
+
+			if(!changed1) t1x += signx1;
+			t1x += t1xp;
+
+			if(!changed2) t2x += signx2;
+			t2x += t2xp;
+
+			y += 1;
+			if(y > (int32_t)pos3.y) return;
+		}
 	}
 
-	inline void Application::Launch(const vu2d& size, uint8_t scale, const vu2d& position, const std::string& name, pixel::DrawingMode mode, bool fullScreen, bool vsync) {
-		if(scale <= 0 || size.x <= 0 || size.y <= 0) {
-			throw std::runtime_error("Invalid screen proportions.");
+	/*
+		Gouraud shading: colour is an affine function over the triangle, so
+		its change per pixel along x is the same for every row and only the
+		colour at each span start needs evaluating. Edges are walked with
+		exact integer division, covering every pixel on or inside them.
+	*/
+
+	inline void Application::FillTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel1, const Pixel& pixel2, const Pixel& pixel3) {
+		// Coordinates off the top or left edge arrive wrapped around
+		int64_t x[3] = { (int32_t) pos1.x, (int32_t) pos2.x, (int32_t) pos3.x };
+		int64_t y[3] = { (int32_t) pos1.y, (int32_t) pos2.y, (int32_t) pos3.y };
+
+		int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if(area == 0) return;
+
+		int32_t minX = (int32_t) (std::min)({ x[0], x[1], x[2] }), maxX = (int32_t) (std::max)({ x[0], x[1], x[2] });
+		int32_t minY = (int32_t) (std::min)({ y[0], y[1], y[2] }), maxY = (int32_t) (std::max)({ y[0], y[1], y[2] });
+
+		if(pOccluded(minX, minY, maxX, maxY)) return;
+
+		float v0[4] = { (float) pixel1.r, (float) pixel1.g, (float) pixel1.b, (float) pixel1.a };
+		float v1[4] = { (float) pixel2.r, (float) pixel2.g, (float) pixel2.b, (float) pixel2.a };
+		float v2[4] = { (float) pixel3.r, (float) pixel3.g, (float) pixel3.b, (float) pixel3.a };
+
+		float base[4], dx[4], dy[4];
+
+		for(uint32_t k = 0; k < 4; k++) {
+			float c0 = v0[k], c1 = v1[k], c2 = v2[k];
+
+			base[k] = c0;
+			dx[k] = ((c1 - c0) * (y[2] - y[0]) - (c2 - c0) * (y[1] - y[0])) / (float) area;
+			dy[k] = ((c2 - c0) * (x[1] - x[0]) - (c1 - c0) * (x[2] - x[0])) / (float) area;
 		}
 
-		pWindowSize = size * scale;
-		pWindowPos = position;
+		// Sorted top to bottom, the long edge runs from a to c
+		int32_t a = 0, b = 1, c = 2;
+		if(y[a] > y[b]) std::swap(a, b);
+		if(y[b] > y[c]) std::swap(b, c);
+		if(y[a] > y[b]) std::swap(a, b);
 
-		pScreenSize = size;
-		pInvScreenSize = vf2d(1.0f / size.x, 1.0f / size.y);
-		pScale = scale;
+		auto edge = [&] (int32_t i, int32_t j, int64_t row, int64_t& num, int64_t& den) {
+			num = x[i] * (y[j] - y[i]) + (row - y[i]) * (x[j] - x[i]);
+			den = y[j] - y[i];
+		};
 
-		pWindowName = name;
-		pWindowTittle = name + " - FPS: 0";
+		auto floorDiv = [] (int64_t n, int64_t d) { return n / d - ((n % d != 0) && ((n < 0) != (d < 0))); };
+		auto ceilDiv = [] (int64_t n, int64_t d) { return n / d + ((n % d != 0) && ((n < 0) == (d < 0))); };
 
-		pDrawingMode = mode;
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
 
-		pVsync = vsync;
-		pFullScreen = fullScreen;
+		for(int32_t row = (std::max)(minY, lo.y); row <= (std::min)(maxY, hi.y - 1); row++) {
+			int64_t n1, d1, n2, d2;
+			edge(a, c, row, n1, d1);
 
-		pShouldExist = true;
+			// Neither edge can be horizontal here, the triangle having an area
+			if(row < y[b] || y[c] == y[b]) edge(a, b, row, n2, d2);
+			else edge(b, c, row, n2, d2);
 
-		pBuffer = new Pixel[size.prod()];
-		memset(pBuffer, 0x00, size.prod() * sizeof(Pixel));
+			// Compare n1 / d1 with n2 / d2, both denominators being positive
+			if(n1 * d2 > n2 * d1) { std::swap(n1, n2); std::swap(d1, d2); }
 
-		pCreateWindow();
-		pUpdateViewport();
+			int32_t x1 = (int32_t) ceilDiv(n1, d1), x2 = (int32_t) floorDiv(n2, d2);
+			if(x1 > x2) continue;
 
-		std::thread t = std::thread(&Application::EngineThread, this);
+			float from[4], to[4];
 
-		while(pShouldExist) {
-			PeekMessageW(&pMsg, pHwnd, 0, 0, PM_REMOVE);
-			DispatchMessageW(&pMsg);
+			for(uint32_t k = 0; k < 4; k++) {
+				float offset = base[k] + dy[k] * (row - y[0]) - dx[k] * x[0];
+
+				from[k] = offset + dx[k] * x1;
+				to[k] = offset + dx[k] * x2;
+			}
+
+			pGradientSpan(x1, x2, row, from, to);
 		}
+	}
 
-		t.join();
+	inline void Application::PresentTo(Pixel* dst) {
+		UpscaleNearest(pResolveFrame(), pScreenSize, dst, pScreenSize.x * pScale, pScale);
 	}
 
-	inline bool Application::OnCreate() {
-		return true;
+	inline void Application::PresentTo(Pixel* dst, const vu2d& dstSize) {
+		UpscaleFit(pResolveFrame(), pScreenSize, dst, dstSize);
 	}
 
-	inline bool Application::OnUpdate(float et) {
-		return false;
+	inline void Application::SaveFrame(const std::string& filename, ImageFormat format, bool fast) {
+		pEncoder.Save(filename, pResolveFrame(), pScreenSize, format, fast);
 	}
 
-	void Application::pCreateDevice() {
+	inline void Application::StartCapture(const std::string& path, CaptureFormat format, uint32_t fps, uint32_t buffers, ImageFormat imageFormat) {
+		pCapture.Start(path, pScreenSize, format, fps, buffers, imageFormat);
+	}
 
-		pDevideContext = GetDC(pHwnd);
+	inline void Application::StopCapture() {
+		pCapture.Stop();
+	}
 
-		PIXELFORMATDESCRIPTOR pfd = {
-			sizeof(PIXELFORMATDESCRIPTOR), 1,
-			PFD_DRAW_TO_WINDOW | PFD_SUPPORT_OPENGL | PFD_DOUBLEBUFFER,
-			PFD_TYPE_RGBA, 32, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-			PFD_MAIN_PLANE, 0, 0, 0, 0
-		};
+	inline bool Application::Capturing() const {
+		return pCapture.Active();
+	}
 
-		int pf = 0;
-		if(!(pf = ChoosePixelFormat(pDevideContext, &pfd))) {
-			throw std::runtime_error("Failed to obtain the correct pixel format.");
-		}
+	inline pixel::CaptureStats Application::CaptureStats() const {
+		return pCapture.Stats();
+	}
 
-		SetPixelFormat(pDevideContext, pf, &pfd);
+	inline void Application::StartStream(const std::string& name, uint32_t tileSize) {
+		pStream.Start(name, pScreenSize, tileSize);
+	}
 
-		if(!(pRenderContext = wglCreateContext(pDevideContext))) {
-			throw std::runtime_error("Failed to create the rendering context.");
-		}
+	inline void Application::StopStream() {
+		pStream.Stop();
+	}
 
-		wglMakeCurrent(pDevideContext, pRenderContext);
+	inline bool Application::Streaming() const {
+		return pStream.Active();
+	}
 
-		wglSwapInterval = (wglSwapInterval_t*) wglGetProcAddress("wglSwapIntervalEXT");
-		if(wglSwapInterval && !pVsync) wglSwapInterval(0);
+	inline pixel::StreamStats Application::StreamStats() const {
+		return pStream.Stats();
 	}
 
-	inline void Application::pDestroyDevice() {
-		wglDeleteContext(pRenderContext);
+	inline void Application::StartRecording(const std::string& path, bool hashFrames) {
+		pRecorder.Start(path, pScreenSize, hashFrames);
 	}
 
-	inline void Application::Close() {
-		PostMessageW(pHwnd, WM_CLOSE, 0, 0);
+	inline void Application::StopRecording() {
+		pRecorder.Stop();
 	}
 
-	inline void Application::SetName(const std::string& name) {
-		pWindowName = name;
+	inline void Application::StartReplay(const std::string& path, ReplaySpeed speed, bool closeOnEnd) {
+		pPlayer.Start(path, pScreenSize, speed);
+		pCloseOnReplayEnd = closeOnEnd;
+
+		memset(pReplayKeys, 0, sizeof(pReplayKeys));
+		memset(pReplayButtons, 0, sizeof(pReplayButtons));
 	}
 
-	inline void Application::SetDrawingMode(pixel::DrawingMode mode) {
-		pDrawingMode = mode;
+	inline void Application::StopReplay() {
+		pPlayer.Stop();
 	}
 
-	void Application::Update() {
-		pClock2 = std::chrono::system_clock::now();
-		pElapsedTimer = pClock2 - pClock1;
-		pClock1 = pClock2;
-		pElapsedTime = pElapsedTimer.count();
+	inline bool Application::Recording() const {
+		return pRecorder.Active();
+	}
 
-		pFrameTimer += pElapsedTime;
-		pFrameCount++;
+	inline bool Application::Replaying() const {
+		return pPlayer.Active();
+	}
 
-		if(pFrameTimer >= 1.0f) {
-			pFrameRate = pFrameCount;
-			pFrameTimer -= 1.0f;
+	inline pixel::ReplayStats Application::ReplayStats() const {
+		return pPlayer.Stats();
+	}
 
-			pWindowTittle = pWindowName + " - FPS: " + std::to_string(pFrameRate);
-			SetWindowTextA(pHwnd, pWindowTittle.c_str());
+	/*
+		Occlusion lets opaque primitives be drawn front to back. A bitset per
+		row records which pixels are final, every span only writes the runs
+		that are still open, and whole rects, ellipses and sprites are culled
+		when their bounds are already covered. Words and tiles of 64 x 8
+		pixels keep counts of full words so covered rows and tiles are
+		rejected without looking at the bits. Translucent pixels are hidden
+		where something opaque was drawn first but never cover anything
+		themselves, so overlays still belong after EndOcclusion, back to front.
+	*/
+
+	inline void Application::BeginOcclusion() {
+		uint32_t w = pTargetSize.x, h = pTargetSize.y;
+		uint32_t words = (w + 63) / 64;
+		uint32_t tiles = (h + pCoverageTileRows - 1) / pCoverageTileRows;
+
+		pCoverage.active = true;
+		pCoverage.words = words;
+		pCoverage.bits.assign((size_t) words * h, 0);
+		pCoverage.rowFull.assign(h, 0);
+		pCoverage.tileFull.assign((size_t) words * tiles, 0);
+		pCoverage.stats = {};
+
+		// Bits past the right edge and rows past the bottom start out covered
+		if(w % 64) {
+			for(uint32_t y = 0; y < h; y++) pCoverage.bits[(size_t) y * words + words - 1] = ~0ull << (w % 64);
+		}
 
-			pFrameCount = 0;
+		for(uint32_t t = 0; t < tiles; t++) {
+			uint8_t padding = (uint8_t) (t * pCoverageTileRows + pCoverageTileRows - (std::min)(h, t * pCoverageTileRows + pCoverageTileRows));
+			for(uint32_t x = 0; x < words; x++) pCoverage.tileFull[(size_t) t * words + x] = padding;
 		}
+	}
 
-		for(uint32_t i = 0; i < 3; i++) {
+	inline void Application::EndOcclusion() {
+		pCoverage.active = false;
+	}
 
-			pMouseButtons[i].pressed = false;
-			pMouseButtons[i].released = false;
+	inline void Application::EndOcclusion(const Pixel& background) {
+		if(pCoverage.active) {
+			pixel::DrawingMode mode = pDrawingMode;
+			pDrawingMode = DrawingMode::NO_ALPHA;
 
-			if(pMouseButtonsNew[i] != pMouseButtonsOld[i]) {
+			for(int32_t y = 0; y < (int32_t) pTargetSize.y; y++) {
+				if(pCoverage.rowFull[y] == pCoverage.words) continue;
 
-				if(pMouseButtonsNew[i]) {
+				pCoverRuns(y, 0, pTargetSize.x - 1, [&] (int32_t x1, int32_t x2) {
+					pWriteRun(y * pTargetSize.x + x1, x2 - x1 + 1, background);
+				});
+			}
 
-					pMouseButtons[i].pressed = !pMouseButtons[i].held;
-					pMouseButtons[i].held = true;
+			pDrawingMode = mode;
+		}
 
-				} else {
+		EndOcclusion();
+	}
 
-					pMouseButtons[i].released = true;
-					pMouseButtons[i].held = false;
-				}
-			}
+	inline bool Application::Occluding() const {
+		return pCoverage.active;
+	}
 
-			pMouseButtonsOld[i] = pMouseButtonsNew[i];
-		}
+	inline pixel::OcclusionStats Application::OcclusionStats() const {
+		return pCoverage.stats;
+	}
 
-		for(uint32_t i = 0; i < 256; i++) {
+	template<class F> inline void Application::pCoverRuns(int32_t y, int32_t x1, int32_t x2, F&& run) const {
+		const uint64_t* row = pCoverage.bits.data() + (size_t) y * pCoverage.words;
+		int32_t x = x1;
 
-			pKeyboardKeys[i].pressed = false;
-			pKeyboardKeys[i].released = false;
+		// The callback may cover the run it was given, so the words are read again each step
+		while(x <= x2) {
+			int32_t w = x >> 6;
+			uint64_t open = ~row[w] & (~0ull << (x & 63));
 
-			if(pKeyboardKeysNew[i] != pKeyboardKeysOld[i]) {
+			if(!open) {
+				x = (w + 1) << 6;
+				continue;
+			}
 
-				if(pKeyboardKeysNew[i]) {
+			int32_t start = (w << 6) + std::countr_zero(open);
+			if(start > x2) return;
 
-					pKeyboardKeys[i].pressed = !pKeyboardKeys[i].held;
-					pKeyboardKeys[i].held = true;
+			int32_t end = start;
 
-				} else {
+			for(int32_t e = w;; e++) {
+				uint64_t covered = row[e] & (e == w ? ~0ull << (start & 63) : ~0ull);
 
-					pKeyboardKeys[i].released = true;
-					pKeyboardKeys[i].held = false;
+				if(covered) {
+					end = (e << 6) + std::countr_zero(covered);
+					break;
+				}
+
+				if(((e + 1) << 6) > x2) {
+					end = x2 + 1;
+					break;
 				}
 			}
 
-			pKeyboardKeysOld[i] = pKeyboardKeysNew[i];
+			end = (std::min)(end, x2 + 1);
+			run(start, end - 1);
+			x = end;
 		}
+	}
 
-		glClearColor(0, 0, 0, 0);
-		glClear(GL_COLOR_BUFFER_BIT);
-		glClear(GL_DEPTH_BUFFER_BIT);
+	inline void Application::pCover(int32_t y, int32_t x1, int32_t x2) {
+		uint64_t* row = pCoverage.bits.data() + (size_t) y * pCoverage.words;
+		uint8_t* tiles = pCoverage.tileFull.data() + (size_t) (y / pCoverageTileRows) * pCoverage.words;
 
-		pShouldExist = OnUpdate(pElapsedTime);
+		for(int32_t w = x1 >> 6; w <= x2 >> 6; w++) {
+			uint64_t mask = ~0ull;
+			if(w == x1 >> 6) mask &= ~0ull << (x1 & 63);
+			if(w == x2 >> 6) mask &= ~0ull >> (63 - (x2 & 63));
 
-		glViewport(pViewPos.x, pViewPos.y, pViewSize.x, pViewSize.y);
+			if(row[w] != ~0ull && (row[w] | mask) == ~0ull) {
+				pCoverage.rowFull[y]++;
+				tiles[w]++;
+			}
 
-		glBindTexture(GL_TEXTURE_2D, pBufferId);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pScreenSize.x, pScreenSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pBuffer);
+			row[w] |= mask;
+		}
+	}
 
-		glBegin(GL_QUADS);
+	inline bool Application::pOccluded(int32_t x1, int32_t y1, int32_t x2, int32_t y2) {
+		if(!pCoverage.active) return false;
 
-		glColor4ub(255, 255, 255, 255);
+		vi2d min, max;
+		pClipBounds(min, max);
 
-		glTexCoord2f(0.0f, 1.0f);
-		glVertex3f(-1.0f, -1.0f, 0.0f);
-		glTexCoord2f(0.0f, 0.0f);
-		glVertex3f(-1.0f, 1.0f, 0.0f);
-		glTexCoord2f(1.0f, 0.0f);
-		glVertex3f(1.0f, 1.0f, 0.0f);
-		glTexCoord2f(1.0f, 1.0f);
-		glVertex3f(1.0f, -1.0f, 0.0f);
+		x1 = (std::max)(x1, min.x); y1 = (std::max)(y1, min.y);
+		x2 = (std::min)(x2, max.x - 1); y2 = (std::min)(y2, max.y - 1);
 
-		glEnd();
+		if(x1 > x2 || y1 > y2) return false;
 
-		for(auto& s : pSprites) {
-			glBindTexture(GL_TEXTURE_2D, s->pBufferId);
-			glBegin(GL_QUADS);
+		for(int32_t ty = y1 / (int32_t) pCoverageTileRows; ty <= y2 / (int32_t) pCoverageTileRows; ty++) {
+			for(int32_t w = x1 >> 6; w <= x2 >> 6; w++) {
+				if(pCoverage.tileFull[(size_t) ty * pCoverage.words + w] == pCoverageTileRows) continue;
 
-			glColor4ub(s->pTint.r, s->pTint.g, s->pTint.b, s->pTint.a);
-			
-			glTexCoord4f(s->pUv[0].x, s->pUv[0].y, 0.0f, s->pW[0]); 
-			glVertex2f(s->pPos[0].x, s->pPos[0].y);
-			glTexCoord4f(s->pUv[1].x, s->pUv[1].y, 0.0f, s->pW[1]); 
-			glVertex2f(s->pPos[1].x, s->pPos[1].y);
-			glTexCoord4f(s->pUv[2].x, s->pUv[2].y, 0.0f, s->pW[2]); 
-			glVertex2f(s->pPos[2].x, s->pPos[2].y);
-			glTexCoord4f(s->pUv[3].x, s->pUv[3].y, 0.0f, s->pW[3]); 
-			glVertex2f(s->pPos[3].x, s->pPos[3].y);
+				uint64_t mask = ~0ull;
+				if(w == x1 >> 6) mask &= ~0ull << (x1 & 63);
+				if(w == x2 >> 6) mask &= ~0ull >> (63 - (x2 & 63));
 
-			glEnd();
+				int32_t r1 = (std::max)(y1, ty * (int32_t) pCoverageTileRows);
+				int32_t r2 = (std::min)(y2, ty * (int32_t) pCoverageTileRows + (int32_t) pCoverageTileRows - 1);
+
+				for(int32_t y = r1; y <= r2; y++) {
+					if((pCoverage.bits[(size_t) y * pCoverage.words + w] & mask) != mask) return false;
+				}
+			}
+		}
+
+		pCoverage.stats.culled++;
+		return true;
+	}
+
+	inline void Application::pWriteCovered(uint32_t offset, uint32_t count, const Pixel& pixel) {
+		if(pDrawingMode == DrawingMode::MASK && pixel.a != 255) return;
+
+		int32_t y = offset / pTargetSize.x;
+		int32_t x = offset - y * pTargetSize.x;
+
+		if(pCoverage.rowFull[y] == pCoverage.words) {
+			pCoverage.stats.skipped += count;
+			return;
 		}
 
-		pSprites.clear();
+		bool opaque = pDrawingMode == DrawingMode::NO_ALPHA || pixel.a == 255 ||
+			(pTargetFormat == PixelFormat::INDEXED8 && pDrawingMode != DrawingMode::MASK && pixel.a >= 128);
 
-		SwapBuffers(pDevideContext);
+		uint32_t written = 0;
+
+		pCoverRuns(y, x, x + count - 1, [&] (int32_t x1, int32_t x2) {
+			pWriteRun(y * pTargetSize.x + x1, x2 - x1 + 1, pixel);
+			if(opaque) pCover(y, x1, x2);
+			written += x2 - x1 + 1;
+		});
+
+		pCoverage.stats.written += written;
+		pCoverage.stats.skipped += count - written;
 	}
 
-	inline void Application::Draw(const vu2d& pos, const Pixel& pixel) {
-		if((pos.y * pScreenSize.x + pos.x) > pScreenSize.prod()) return;
+	inline void Application::pBlitCovered(const Pixel* src, uint32_t srcStride, int32_t dx, int32_t dy, int32_t w, int32_t h, pixel::DrawingMode mode) {
+		for(int32_t y = 0; y < h; y++, src += srcStride) {
+			int32_t row = dy + y;
+
+			if(pCoverage.rowFull[row] == pCoverage.words) {
+				pCoverage.stats.skipped += w;
+				continue;
+			}
 
-		if(pos.x < 0) return;
-		if(pos.y < 0) return;
-		if(pos.x >= pScreenSize.x) return;
-		if(pos.y >= pScreenSize.y) return;
+			uint32_t written = 0;
 
-		if(pDrawingMode == DrawingMode::FULL_ALPHA) {
-			Pixel d = pBuffer[pos.y * pScreenSize.x + pos.x];
+			pCoverRuns(row, dx, dx + w - 1, [&] (int32_t x1, int32_t x2) {
+				BlitPixels(src + (x1 - dx), srcStride, pTarget + row * pTargetSize.x + x1, pTargetSize.x, x2 - x1 + 1, 1, mode);
+				written += x2 - x1 + 1;
 
-			float a = (float) (pixel.a / 255.0f);
-			float c = 1.0f - a;
+				if(mode == DrawingMode::NO_ALPHA) {
+					pCover(row, x1, x2);
+					return;
+				}
 
-			float r = a * (float) pixel.r + c * (float) d.r;
-			float g = a * (float) pixel.g + c * (float) d.g;
-			float b = a * (float) pixel.b + c * (float) d.b;
+				// Only fully opaque sprite pixels hide what comes after
+				for(int32_t x = x1; x <= x2;) {
+					if(src[x - dx].a != 255) { x++; continue; }
 
-			pBuffer[pos.y * pScreenSize.x + pos.x] = Pixel((uint8_t) r, (uint8_t) g, (uint8_t) b);
+					int32_t e = x;
+					while(e < x2 && src[e + 1 - dx].a == 255) e++;
 
-		} else if(pDrawingMode == DrawingMode::NO_ALPHA) {
-			pBuffer[pos.y * pScreenSize.x + pos.x] = pixel;
+					pCover(row, x, e);
+					x = e + 1;
+				}
+			});
 
-		} else if(pixel.a == 255) {
-			pBuffer[pos.y * pScreenSize.x + pos.x] = pixel;
+			pCoverage.stats.written += written;
+			pCoverage.stats.skipped += w - written;
 		}
 	}
 
-	void Application::DrawLine(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel) {
-		int32_t x, y, dx, dy, dx1, dy1, px, py, xe, ye, i;
-		dx = pos2.x - pos1.x; dy = pos2.y - pos1.y;
+	template<class R, class F> inline void Application::pFloodFill(const vu2d& pos, uint8_t tolerance, R&& read, F&& emit) {
+		int32_t w = pTargetSize.x, h = pTargetSize.y;
+		size_t limit = (std::max)((size_t) h * 4, (size_t) 1024);
 
-		if(dx == 0) {
-			if(pos2.y < pos1.y) for(y = pos2.y; y <= (int32_t) pos1.y; y++) Draw(vu2d(pos2.x, y), pixel);
-			else for(y = pos1.y; y <= (int32_t) pos2.y; y++) Draw(vu2d(pos1.x, y), pixel);
+		// The clip bounds the region like a border of non matching pixels
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
 
-			return;
-		}
+		pFillMask.assign(((size_t) w * h + 63) / 64, 0);
+		pFillStack.reserve(limit);
+		pFillStack.clear();
 
-		if(dy == 0) {
-			if(pos2.x < pos1.x) for(x = pos2.x; x <= (int32_t) pos1.x; x++) Draw(vu2d(x, pos2.y), pixel);
-			for(x = pos1.x; x <= (int32_t) pos2.x; x++) Draw(vu2d(x, pos1.y), pixel);
+		const Pixel target = read(pos.y * w + pos.x);
 
-			return;
-		}
+		auto similar = [&] (size_t i) {
+			Pixel p = read(i);
+			if(p == target) return true;
+			if(!tolerance) return false;
 
-		dx1 = std::abs(dx); dy1 = std::abs(dy);
-		px = 2 * dy1 - dx1;	py = 2 * dx1 - dy1;
+			return std::abs(p.r - target.r) <= tolerance && std::abs(p.g - target.g) <= tolerance &&
+				   std::abs(p.b - target.b) <= tolerance && std::abs(p.a - target.a) <= tolerance;
+		};
 
-		if(dy1 <= dx1) {
-			if(dx >= 0) {
-				x = pos1.x; y = pos1.y; xe = pos2.x;
-			} else {
-				x = pos2.x; y = pos2.y; xe = pos1.x;
-			}
+		auto visited = [&] (size_t i) {
+			return (pFillMask[i >> 6] >> (i & 63)) & 1;
+		};
 
-			Draw(vu2d(x, y), pixel);
+		// First bit in [i, end] that is set (or clear, for skipping filled runs)
+		auto findBit = [&] (size_t i, size_t end, bool set) {
+			while(i <= end) {
+				uint64_t word = pFillMask[i >> 6] >> (i & 63);
 
-			for(i = 0; x < xe; i++) {
+				// The shift brings in zeros, which must not count as clear bits
+				if(!set) word = ~word & (~uint64_t(0) >> (i & 63));
 
-				x = x + 1;
+				if(word) return (std::min)(i + std::countr_zero(word), end + 1);
+				i = (i | 63) + 1;
+			}
 
-				if(px < 0)
-					px = px + 2 * dy1;
-				else {
-					if((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) y = y + 1; else y = y - 1;
-					px = px + 2 * (dy1 - dx1);
-				}
+			return end + 1;
+		};
 
-				Draw(vu2d(x, y), pixel);
+		auto setBits = [&] (size_t i, size_t end) {
+			while(i <= end) {
+				size_t last = (std::min)(i | 63, end);
+				uint64_t bits = ~uint64_t(0) >> (63 - (last - i)) << (i & 63);
+
+				pFillMask[i >> 6] |= bits;
+				i = last + 1;
 			}
+		};
 
-		} else {
+		bool overflow = false;
 
-			if(dy >= 0) {
-				x = pos1.x; y = pos1.y; ye = pos2.y;
-			} else {
-				x = pos2.x; y = pos2.y; ye = pos1.y;
-			}
+		auto push = [&] (int32_t x1, int32_t x2, int32_t y) {
+			if(y < lo.y || y >= hi.y) return;
+			if(pFillStack.size() < limit) pFillStack.push_back({ x1, x2, y });
+			else overflow = true;
+		};
 
-			Draw(vu2d(x, y), pixel);
+		// Grows a run from a matching, unfilled pixel, then marks and emits it
+		auto fill = [&] (int32_t x, int32_t y) {
+			size_t row = (size_t) y * w;
+			int32_t l = x, r = x;
 
-			for(i = 0; y < ye; i++) {
+			while(l > lo.x && !visited(row + l - 1) && similar(row + l - 1)) l--;
+			while(r < hi.x - 1 && similar(row + r + 1)) r++;
 
-				y = y + 1;
+			r = (int32_t) (findBit(row + x, row + r, true) - row) - 1;
+			if(r < l) return x;
 
-				if(py <= 0) {
-					py = py + 2 * dx1;
-				} else {
-					if((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) x = x + 1; else x = x - 1;
-					py = py + 2 * (dx1 - dy1);
+			setBits(row + l, row + r);
+			emit(Span { l, r, y });
+
+			push(l, r, y - 1);
+			push(l, r, y + 1);
+
+			return r;
+		};
+
+		fill(pos.x, pos.y);
+
+		for(;;) {
+			while(!pFillStack.empty()) {
+				Span s = pFillStack.back();
+				pFillStack.pop_back();
+
+				size_t row = (size_t) s.y * w;
+
+				for(int32_t x = s.x1; x <= s.x2; x++) {
+					x = (int32_t) (findBit(row + x, row + s.x2, false) - row);
+					if(x > s.x2) break;
+
+					if(similar(row + x)) x = fill(x, s.y) + 1;
 				}
+			}
 
-				Draw(vu2d(x, y), pixel);
+			if(!overflow) break;
+			overflow = false;
+
+			// The work stack is bounded, so seeds dropped when it was full are
+			// recovered by sweeping for unfilled matches next to filled pixels.
+			for(int32_t y = lo.y; y < hi.y; y++) {
+				for(int32_t x = lo.x; x < hi.x; x++) {
+					size_t i = (size_t) y * w + x;
+
+					if(!visited(i) && ((y > lo.y && visited(i - w)) || (y < hi.y - 1 && visited(i + w))) && similar(i)) {
+						push(x, x, y);
+					}
+				}
 			}
 		}
 	}
 
-	void Application::DrawCircle(const vu2d& pos, uint32_t radius, const Pixel& pixel) {
-		uint32_t x0 = 0;
-		uint32_t y0 = radius;
-		int d = 3 - 2 * radius;
+	template<class F> inline void Application::pFloodFill(const vu2d& pos, uint8_t tolerance, F&& emit) {
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
+
+		if((int32_t) pos.x < lo.x || (int32_t) pos.y < lo.y || (int32_t) pos.x >= hi.x || (int32_t) pos.y >= hi.y) return;
+
+		switch(pTargetFormat) {
+			case PixelFormat::RGBA32:
+				pFloodFill(pos, tolerance, [this] (size_t i) { return pTarget[i]; }, emit);
+				break;
+			case PixelFormat::INDEXED8:
+				pFloodFill(pos, tolerance, [this] (size_t i) { return pPalette[pIndexBuffer[i]]; }, emit);
+				break;
+			case PixelFormat::RGB565:
+				pFloodFill(pos, tolerance, [this] (size_t i) { return UnpackRGB565(p565Buffer[i]); }, emit);
+				break;
+		}
+	}
 
-		if(!radius) return;
+	inline void Application::FloodFill(const vu2d& pos, const Pixel& pixel, uint8_t tolerance) {
+		pFloodFill(pos, tolerance, [&] (const Span& s) {
+			pWriteSpan(s.y * pTargetSize.x + s.x1, s.x2 - s.x1 + 1, pixel);
+		});
+	}
+
+	inline void Application::FloodFillRegion(const vu2d& pos, std::vector<Span>& spans, uint8_t tolerance) {
+		spans.clear();
 
-		while(y0 >= x0) {
-			Draw(vu2d(pos.x + x0, pos.y - y0), pixel);
-			Draw(vu2d(pos.x + y0, pos.y - x0), pixel);
-			Draw(vu2d(pos.x + y0, pos.y + x0), pixel);
-			Draw(vu2d(pos.x + x0, pos.y + y0), pixel);
-			Draw(vu2d(pos.x - x0, pos.y + y0), pixel);
-			Draw(vu2d(pos.x - y0, pos.y + x0), pixel);
-			Draw(vu2d(pos.x - y0, pos.y - x0), pixel);
-			Draw(vu2d(pos.x - x0, pos.y - y0), pixel);
+		pFloodFill(pos, tolerance, [&] (const Span& s) {
+			spans.push_back(s);
+		});
+	}
 
-			if(d < 0) d += 4 * x0++ + 6;
-			else d += 4 * (x0++ - y0--) + 10;
+	inline void Application::FillSpans(const Span* spans, size_t count, const Pixel& pixel) {
+		for(size_t i = 0; i < count; i++) {
+			pDrawSpan(spans[i].x1, spans[i].x2, spans[i].y, pixel);
 		}
 	}
 
-	void Application::FillCircle(const vu2d& pos, uint32_t radius, const Pixel& pixel) {
-		int x0 = 0;
-		int y0 = radius;
-		int d = 3 - 2 * radius;
+	inline void Application::BlitSprite(const vi2d& pos, Sprite* sprite) {
+		BlitPartialSprite(pos, vi2d(0, 0), vi2d(sprite->pSize.x, sprite->pSize.y), sprite);
+	}
 
-		if(!radius) return;
+	inline bool Application::pClipBlit(vi2d& pos, vi2d& spos, vi2d& ssize, const vu2d& size) const {
+		ssize.x = (std::min)(ssize.x, (int32_t) size.x - spos.x);
+		ssize.y = (std::min)(ssize.y, (int32_t) size.y - spos.y);
 
-		auto scanline = [&] (int sx, int ex, int ny) {
-			for(int i = sx; i <= ex; i++)
-				Draw(vu2d(i, ny), pixel);
-		};
+		if(spos.x < 0) { ssize.x += spos.x; pos.x -= spos.x; spos.x = 0; }
+		if(spos.y < 0) { ssize.y += spos.y; pos.y -= spos.y; spos.y = 0; }
 
-		while(y0 >= x0) {
-			scanline(pos.x - x0, pos.x + x0, pos.y - y0);
-			scanline(pos.x - y0, pos.x + y0, pos.y - x0);
-			scanline(pos.x - x0, pos.x + x0, pos.y + y0);
-			scanline(pos.x - y0, pos.x + y0, pos.y + x0);
+		vi2d min, max;
+		pClipBounds(min, max);
 
-			if(d < 0) d += 4 * x0++ + 6;
-			else d += 4 * (x0++ - y0--) + 10;
-		}
+		if(pos.x < min.x) { ssize.x -= min.x - pos.x; spos.x += min.x - pos.x; pos.x = min.x; }
+		if(pos.y < min.y) { ssize.y -= min.y - pos.y; spos.y += min.y - pos.y; pos.y = min.y; }
+
+		ssize.x = (std::min)(ssize.x, max.x - pos.x);
+		ssize.y = (std::min)(ssize.y, max.y - pos.y);
+
+		return ssize.x > 0 && ssize.y > 0;
 	}
 
-	void Application::DrawRect(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel) {
-		DrawLine(vu2d(pos1.x, pos1.y), vu2d(pos1.y, pos2.x), pixel);
-		DrawLine(vu2d(pos1.y, pos2.x), vu2d(pos2.x, pos2.y), pixel);
-		DrawLine(vu2d(pos2.x, pos2.y), vu2d(pos2.y, pos1.x), pixel);
-		DrawLine(vu2d(pos2.y, pos1.x), vu2d(pos1.x, pos1.y), pixel);
-	}
+	inline void Application::BlitPartialSprite(const vi2d& pos, const vi2d& spos, const vi2d& ssize, Sprite* sprite) {
+		if(sprite == pTargetSprite) {
+			throw std::runtime_error("Cannot blit a sprite into itself.");
+		}
+
+		vi2d d = pos, sp = spos, ss = ssize;
+		if(!pClipBlit(d, sp, ss, sprite->pSize)) return;
+
+		int32_t sx = sp.x, sy = sp.y, w = ss.x, h = ss.y;
+		int32_t dx = d.x, dy = d.y;
+
+		bool rle = sprite->HasRle() && pDrawingMode != DrawingMode::NO_ALPHA;
+
+		if(pOccluded(dx, dy, dx + w - 1, dy + h - 1)) return;
+
+		if(pTargetFormat == PixelFormat::RGBA32) {
+			Pixel* dst = pTarget + dy * pTargetSize.x + dx;
+
+			if(pCoverage.active && sprite->pBuffer) pBlitCovered(sprite->pBuffer + sy * sprite->pSize.x + sx, sprite->pSize.x, dx, dy, w, h, pDrawingMode);
+			else if(rle) sprite->pBlitRle(dst, pTargetSize.x, sx, sy, w, h, pDrawingMode);
+			else if(sprite->pBuffer) sprite->pBlitRaw(dst, pTargetSize.x, sx, sy, w, h, pDrawingMode);
+
+			return;
+		}
+
+		if(!sprite->pBuffer) return;
+
+		for(int32_t y = 0; y < h; y++) {
+			const Pixel* src = sprite->pBuffer + (sy + y) * sprite->pSize.x + sx;
+			uint32_t offset = (dy + y) * pTargetSize.x + dx;
 
-	void Application::FillRect(const vu2d& pos1, const vu2d& pos2, const Pixel& pixel) {
-		for(uint32_t x = min(pos1.x, pos2.x); x <= max(pos1.x, pos2.x); x++) {
-			for(uint32_t y = min(pos1.y, pos2.y); y <= max(pos1.y, pos2.y); y++) {
-				Draw(vu2d(x, y), pixel);
+			for(int32_t x = 0; x < w; x++) {
+				if(src[x].a || pDrawingMode == DrawingMode::NO_ALPHA) pWriteSpan(offset + x, 1, src[x]);
 			}
 		}
 	}
 
-	void Application::DrawTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel) {
-		DrawLine(vu2d(pos1.x, pos1.y), vu2d(pos2.x, pos2.y), pixel);
-		DrawLine(vu2d(pos2.x, pos2.y), vu2d(pos3.x, pos3.y), pixel);
-		DrawLine(vu2d(pos3.x, pos3.y), vu2d(pos1.x, pos1.y), pixel);
-	}
+	inline void Application::BlitScaledSprite(const vf2d& pos, Sprite* sprite, const vf2d& scale) {
+		if(sprite == pTargetSprite) {
+			throw std::runtime_error("Cannot blit a sprite into itself.");
+		}
 
-	void Application::FillTriangle(const vu2d& pos1, const vu2d& pos2, const vu2d& pos3, const Pixel& pixel) {
-		auto drawline = [&] (int sx, int ex, int ny) {
-			for(int i = sx; i <= ex; i++)
-				Draw(vu2d(i, ny), pixel);
-		};
+		if(!sprite->pBuffer || scale.x <= 0.0f || scale.y <= 0.0f) return;
 
-		int32_t t1x, t2x, y, minx, maxx, t1xp, t2xp;
-		int32_t signx1, signx2, dx1, dy1, dx2, dy2;
-		int32_t e1, e2;
+		float w = sprite->pSize.x * scale.x, h = sprite->pSize.y * scale.y;
 
-		bool changed1 = false;
-		bool changed2 = false;
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
 
-		/*
-		if(pos1.y > pos2.y) { std::swap(pos1.y, pos2.y); std::swap(pos1.x, pos2.x); }
-		if(pos1.y > pos3.y) { std::swap(pos1.y, pos3.y); std::swap(pos1.x, pos3.x); }
-		if(pos2.y > pos3.y) { std::swap(pos2.y, pos3.y); std::swap(pos2.x, pos3.x); }
-		*/
+		int32_t x1 = (std::max)((int32_t) std::ceil(pos.x - 0.5f), lo.x);
+		int32_t y1 = (std::max)((int32_t) std::ceil(pos.y - 0.5f), lo.y);
+		int32_t x2 = (std::min)((int32_t) std::ceil(pos.x + w - 0.5f), hi.x);
+		int32_t y2 = (std::min)((int32_t) std::ceil(pos.y + h - 0.5f), hi.y);
 
-		t1x = t2x = pos1.x; y = pos1.y;
-		dx1 = (int) (pos2.x - pos1.x);
-		if(dx1 < 0) { dx1 = -dx1; signx1 = -1; } else signx1 = 1;
-		dy1 = (int) (pos2.y - pos1.y);
+		if(x1 >= x2 || y1 >= y2) return;
 
-		dx2 = (int) (pos3.x - pos1.x);
-		if(dx2 < 0) { dx2 = -dx2; signx2 = -1; } else signx2 = 1;
-		dy2 = (int) (pos3.y - pos1.y);
+		SpriteFilter filter = sprite->pFilter;
 
-		if(dy1 > dx1) { std::swap(dx1, dy1); changed1 = true; }
-		if(dy2 > dx2) { std::swap(dy2, dx2); changed2 = true; }
+		// Pick the pair of mip levels bracketing the minification factor, the
+		// fraction between them blends the two bilinear samples.
+		uint32_t level = 0;
+		int32_t levelBlend = 0;
 
-		e2 = (int) (dx2 >> 1);
+		if(filter == SpriteFilter::TRILINEAR) {
+			float lod = std::log2(1.0f / (std::min)(scale.x, scale.y));
 
-		if(pos1.y == pos2.y) goto next;
-		e1 = (int) (dx1 >> 1);
+			if(lod > 0.0f) {
+				level = (uint32_t) lod;
+				levelBlend = (int32_t) ((lod - level) * 128.0f);
+			}
+		}
 
-		for(int i = 0; i < dx1;) {
-			t1xp = 0; t2xp = 0;
-			if(t1x < t2x) { minx = t1x; maxx = t2x; } else { minx = t2x; maxx = t1x; }
+		vu2d size0, size1;
+		const Pixel* data0 = sprite->pLevel(level, size0);
+		const Pixel* data1 = sprite->pLevel(level + 1, size1);
 
-			while(i < dx1) {
-				i++;
-				e1 += dy1;
+		auto texel = [] (float dst, float origin, float scale, uint32_t level) {
+			return ((dst + 0.5f - origin) / scale) / float(1 << level) - 0.5f;
+		};
 
-				while(e1 >= dx1) {
-					e1 -= dx1;
+		int32_t sx0 = (int32_t) (texel((float) x1, pos.x, scale.x, level) * 65536.0f);
+		int32_t sx1 = (int32_t) (texel((float) x1, pos.x, scale.x, level + 1) * 65536.0f);
+		int32_t dx0 = (int32_t) (65536.0f / scale.x / float(1 << level));
+		int32_t dx1 = dx0 / 2;
 
-					if(changed1) t1xp = signx1;
-					else          goto next1;
-				}
+		for(int32_t y = y1; y < y2; y++) {
+			int32_t fy0 = (int32_t) (texel((float) y, pos.y, scale.y, level) * 65536.0f);
+			int32_t fy1 = (int32_t) (texel((float) y, pos.y, scale.y, level + 1) * 65536.0f);
+			int32_t fx0 = sx0, fx1 = sx1;
 
-				if(changed1) break;
-				else t1x += signx1;
-			}
+			uint32_t offset = y * pTargetSize.x;
 
-			next1:
+			for(int32_t x = x1; x < x2; x++, fx0 += dx0, fx1 += dx1) {
+				Pixel p;
 
-			while(1) {
-				e2 += dy2;
+				if(filter == SpriteFilter::NEAREST) {
+					int32_t u = (std::min)((fx0 + 0x8000) >> 16, (int32_t) size0.x - 1);
+					int32_t v = (std::min)((fy0 + 0x8000) >> 16, (int32_t) size0.y - 1);
+					p = data0[(std::max)(v, 0) * size0.x + (std::max)(u, 0)];
 
-				while(e2 >= dx2) {
-					e2 -= dx2;
+				} else {
+					p = sprite->pSampleBilinear(data0, size0, fx0, fy0);
 
-					if(changed2) t2xp = signx2;
-					else          goto next2;
+					if(levelBlend) {
+						Pixel q = sprite->pSampleBilinear(data1, size1, fx1, fy1);
+
+						p = Pixel(p.r + (((q.r - p.r) * levelBlend) >> 7), p.g + (((q.g - p.g) * levelBlend) >> 7),
+								  p.b + (((q.b - p.b) * levelBlend) >> 7), p.a + (((q.a - p.a) * levelBlend) >> 7));
+					}
 				}
 
-				if(changed2)     break;
-				else              t2x += signx2;
-			}
+				if(pTargetFormat == PixelFormat::RGBA32 && !pCoverage.active) {
+					Pixel& d = pTarget[offset + x];
 
-			next2:
+					if(p.a == 255 || pDrawingMode == DrawingMode::NO_ALPHA) d = p;
+					else if(pDrawingMode != DrawingMode::MASK && p.a) d = BlendPixel(d, p, pDrawingMode);
 
-			if(minx > t1x) minx = t1x;
-			if(minx > t2x) minx = t2x;
-			if(maxx < t1x) maxx = t1x;
-			if(maxx < t2x) maxx = t2x;
+				} else if(p.a || pDrawingMode == DrawingMode::NO_ALPHA) {
+					pWriteSpan(offset + x, 1, p);
+				}
+			}
+		}
+	}
 
-			drawline(minx, maxx, y);
+	inline void Application::DrawTileMap(TileMap& map, const vi2d& camera) {
+		for(uint32_t i = 0; i < map.pLayers.size(); i++) {
+			DrawTileMap(map, camera, i);
+		}
+	}
 
-			if(!changed1) t1x += signx1;
-			t1x += t1xp;
+	inline void Application::DrawTileMap(TileMap& map, const vi2d& camera, uint32_t layer) {
+		if(layer >= map.pLayers.size()) return;
 
-			if(!changed2) t2x += signx2;
-			t2x += t2xp;
+		TileMap::Layer& l = map.pLayers[layer];
+		vi2d cp(map.pChunkPixels.x, map.pChunkPixels.y);
 
-			y += 1;
-			if(y == pos2.y) break;
+		auto floordiv = [] (int32_t a, int32_t b) {
+			return a >= 0 ? a / b : -((-a + b - 1) / b);
+		};
 
-		}
+		vi2d lo, hi;
+		pClipBounds(lo, hi);
 
-		next:
+		int32_t cx1 = (std::max)(floordiv(camera.x + lo.x, cp.x), 0);
+		int32_t cy1 = (std::max)(floordiv(camera.y + lo.y, cp.y), 0);
+		int32_t cx2 = (std::min)(floordiv(camera.x + hi.x - 1, cp.x), (int32_t) map.pChunks.x - 1);
+		int32_t cy2 = (std::min)(floordiv(camera.y + hi.y - 1, cp.y), (int32_t) map.pChunks.y - 1);
 
-		dx1 = (int) (pos3.x - pos2.x); if(dx1 < 0) { dx1 = -dx1; signx1 = -1; } else signx1 = 1;
-		dy1 = (int) (pos3.y - pos2.y);
+		// Caches hold a copy of the tileset pixels
+		map.pCheckTileset();
 
-		t1x = pos2.x;
+		for(int32_t cy = cy1; cy <= cy2; cy++) {
+			for(int32_t cx = cx1; cx <= cx2; cx++) {
+				TileMap::Chunk& chunk = l.chunks[cy * map.pChunks.x + cx];
+				if(!chunk.count) continue;
 
-		if(dy1 > dx1) {
-			std::swap(dy1, dx1);
-			changed1 = true;
-		} else changed1 = false;
+				vi2d origin(cx * cp.x - camera.x, cy * cp.y - camera.y);
 
-		e1 = (int) (dx1 >> 1);
+				// Dynamic layers, and compact framebuffers that can't take a raw
+				// pixel copy, draw every visible tile straight from the tileset.
+				if(!l.isStatic || pTargetFormat != PixelFormat::RGBA32) {
+					for(uint32_t ty = 0; ty < TileMap::pChunkTiles; ty++) {
+						for(uint32_t tx = 0; tx < TileMap::pChunkTiles; tx++) {
+							uint16_t tile = chunk.tiles[ty * TileMap::pChunkTiles + tx];
+							if(tile == TileMap::EMPTY_TILE) continue;
 
-		for(int i = 0; i <= dx1; i++) {
-			t1xp = 0; t2xp = 0;
+							vi2d spos((tile % map.pTilesetColumns) * map.pTileSize.x, (tile / map.pTilesetColumns) * map.pTileSize.y);
+							vi2d tpos(origin.x + tx * map.pTileSize.x, origin.y + ty * map.pTileSize.y);
 
-			if(t1x < t2x) { minx = t1x; maxx = t2x; } else { minx = t2x; maxx = t1x; }
+							BlitPartialSprite(tpos, spos, vi2d(map.pTileSize.x, map.pTileSize.y), map.pTileset);
+						}
+					}
 
-			while(i < dx1) {
-				e1 += dy1;
+					continue;
+				}
 
-				while(e1 >= dx1) {
-					e1 -= dx1;
-					if(changed1) { t1xp = signx1; break; } else goto next3;
+				if(chunk.dirty || !chunk.cache) {
+					map.pBuildCache(chunk);
 				}
 
-				if(changed1) break;
-				else   	   	  t1x += signx1;
-				if(i < dx1) i++;
-			}
+				chunk.lastFrame = pStats.frame;
 
-			next3:
+				vi2d spos(0, 0), ssize = cp;
+				if(!pClipBlit(origin, spos, ssize, map.pChunkPixels)) continue;
 
-			while(t2x != pos3.x) {
-				e2 += dy2;
+				const Pixel* src = chunk.cache.get() + spos.y * cp.x + spos.x;
+				pixel::DrawingMode mode = chunk.opaque ? DrawingMode::NO_ALPHA : pDrawingMode;
 
-				while(e2 >= dx2) {
-					e2 -= dx2;
-					if(changed2) t2xp = signx2;
-					else          goto next4;
-				}
+				if(pOccluded(origin.x, origin.y, origin.x + ssize.x - 1, origin.y + ssize.y - 1)) continue;
 
-				if(changed2)     break;
-				else              t2x += signx2;
-			}
+				if(mode != DrawingMode::NO_ALPHA || chunk.opaque) {
+					if(pCoverage.active) pBlitCovered(src, cp.x, origin.x, origin.y, ssize.x, ssize.y, mode);
+					else BlitPixels(src, cp.x, pTarget + origin.y * pTargetSize.x + origin.x, pTargetSize.x, ssize.x, ssize.y, mode);
+					continue;
+				}
 
-			next4:
+				// A raw copy would paint the empty cells over what is below,
+				// so only the runs of filled tiles on each row are copied
+				for(int32_t y = 0; y < ssize.y; y++) {
+					uint16_t filled = chunk.filled[(spos.y + y) / map.pTileSize.y];
+					const Pixel* row = src + y * cp.x;
 
-			if(minx > t1x) minx = t1x;
-			if(minx > t2x) minx = t2x;
-			if(maxx < t1x) maxx = t1x;
-			if(maxx < t2x) maxx = t2x;
+					for(int32_t x = 0; x < ssize.x;) {
+						uint32_t tx = (spos.x + x) / map.pTileSize.x;
+						int32_t end = (std::min)((int32_t) ((tx + 1) * map.pTileSize.x) - spos.x, ssize.x);
 
-			drawline(minx, maxx, y);
+						if(!((filled >> tx) & 1)) {
+							x = end;
+							continue;
+						}
 
-			if(!changed1) t1x += signx1;
-			t1x += t1xp;
+						while(end < ssize.x && ((filled >> ++tx) & 1)) {
+							end = (std::min)(end + (int32_t) map.pTileSize.x, ssize.x);
+						}
 
-			if(!changed2) t2x += signx2;
-			t2x += t2xp;
+						if(pCoverage.active) pBlitCovered(row + x, cp.x, origin.x + x, origin.y + y, end - x, 1, mode);
+						else memcpy(pTarget + (origin.y + y) * pTargetSize.x + origin.x + x, row + x, (end - x) * sizeof(Pixel));
 
-			y += 1;
-			if(y > (int32_t)pos3.y) return;
+						x = end;
+					}
+				}
+			}
 		}
+
+		map.pEvictCaches(pStats.frame);
 	}
-	
+
 	inline void Application::DrawSprite(const vf2d& pos, Sprite* sprite, const vf2d& scale, const Pixel& tint) {
 		vf2d newpos =
 		{
@@ -1427,14 +9032,12 @@ namespace pixel {
 			newpos.y - (2.0f * (float(sprite->pSize.y) * pInvScreenSize.y)) * scale.y
 		};
 
-		sprite->pTint = tint;
+		SpriteDraw* s = pPushSprite(sprite, tint);
 
-		sprite->pPos[0] = { newpos.x, newpos.y };
-		sprite->pPos[1] = { newpos.x, newsize.y };
-		sprite->pPos[2] = { newsize.x, newsize.y };
-		sprite->pPos[3] = { newsize.x, newpos.y };
-		
-		pSprites.push_back(sprite);
+		s->pos[0] = { newpos.x, newpos.y };
+		s->pos[1] = { newpos.x, newsize.y };
+		s->pos[2] = { newsize.x, newsize.y };
+		s->pos[3] = { newsize.x, newpos.y };
 	}
 
 	inline void Application::DrawPartialSprite(const vf2d& pos, const vf2d& spos, const vf2d& ssize, Sprite* sprite, const vf2d& scale, const Pixel& tint) {
@@ -1450,21 +9053,387 @@ namespace pixel {
 			newpos.y - (2.0f * ssize.y * pInvScreenSize.y) * scale.y
 		};
 	
-		sprite->pTint = tint;
+		SpriteDraw* s = pPushSprite(sprite, tint);
 
-		sprite->pPos[0] = { newpos.x, newpos.y };
-		sprite->pPos[1] = { newpos.x, newsize.y };
-		sprite->pPos[2] = { newsize.x, newsize.y };
-		sprite->pPos[3] = { newsize.x, newpos.y };
+		s->pos[0] = { newpos.x, newpos.y };
+		s->pos[1] = { newpos.x, newsize.y };
+		s->pos[2] = { newsize.x, newsize.y };
+		s->pos[3] = { newsize.x, newpos.y };
 
 		vf2d uvtl = spos * sprite->pUvScale;
 		vf2d uvbr = uvtl + (ssize * sprite->pUvScale);
 
-		sprite->pUv[0] = { uvtl.x, uvtl.y }; 
-		sprite->pUv[1] = { uvtl.x, uvbr.y };
-		sprite->pUv[2] = { uvbr.x, uvbr.y }; 
-		sprite->pUv[3] = { uvbr.x, uvtl.y };
+		s->uv[0] = { uvtl.x, uvtl.y }; 
+		s->uv[1] = { uvtl.x, uvbr.y };
+		s->uv[2] = { uvbr.x, uvbr.y }; 
+		s->uv[3] = { uvbr.x, uvtl.y };
+	}
+
+	/*
+		All instances of an animator share one texture, so they go out as a
+		single vertex array draw. Frame rectangles were turned into UVs when
+		the sheet was built, leaving one multiply add per corner here.
+		Instances land at offset + pos * scale, those that end up entirely
+		off screen are dropped.
+	*/
+
+	inline void Application::DrawAnimator(const Animator& animator, const vf2d& offset, const vf2d& scale) {
+		uint32_t count = animator.Size();
+		if(count == 0) return;
+
+		const SpriteSheet& sheet = *animator.pSheet;
+		const SpriteSheet::Frame* frames = sheet.pFrames.data();
+
+		BatchVertex* batch = pFrameArena.Allocate<BatchVertex>((size_t) count * 4);
+		uint32_t quads = 0;
+
+		float sx = 2.0f * pInvScreenSize.x, sy = -2.0f * pInvScreenSize.y;
+		float ox = offset.x * sx - 1.0f, oy = offset.y * sy + 1.0f;
+		float wx = sx * scale.x, wy = sy * scale.y;
+
+		for(uint32_t i = 0; i < count; i++) {
+			const SpriteSheet::Frame& f = frames[animator.pFrame[i]];
+
+			float x1 = animator.pX[i] * wx + ox, y1 = animator.pY[i] * wy + oy;
+			float x2 = x1 + f.size.x * wx, y2 = y1 + f.size.y * wy;
+
+			if(x2 < -1.0f || x1 > 1.0f || y2 > 1.0f || y1 < -1.0f) continue;
+
+			BatchVertex* v = batch + (size_t) quads * 4;
+			Pixel tint = animator.pTint[i];
+
+			v[0] = { x1, y1, f.uv1.x, f.uv1.y, tint };
+			v[1] = { x1, y2, f.uv1.x, f.uv2.y, tint };
+			v[2] = { x2, y2, f.uv2.x, f.uv2.y, tint };
+			v[3] = { x2, y1, f.uv2.x, f.uv1.y, tint };
+
+			quads++;
+		}
+
+		if(quads == 0) return;
+
+		SpriteDraw* s = pPushSprite(sheet.pSprite, White);
+		s->batch = batch;
+		s->quads = quads;
+	}
+
+	/*
+		A Scene keeps its nodes between frames and owns the contents of the
+		framebuffer. Every change marks the node's old and new bounds, and
+		Render only clears and re-rasterizes those regions, clipping each
+		node to them, so the application must not Clear() the screen itself.
+	*/
+
+	inline Scene::Node Scene::AddRect(const vi2d& pos, const vi2d& size, const Pixel& pixel, bool filled, uint32_t radius) {
+		NodeData node;
+		node.kind = NodeKind::RECT;
+		node.pos1 = pos;
+		node.pos2 = pos + size - 1;
+		node.radius = radius;
+		node.filled = filled;
+		node.pixel = pixel;
+		return pAdd(node);
+	}
+
+	inline Scene::Node Scene::AddCircle(const vi2d& centre, uint32_t radius, const Pixel& pixel, bool filled) {
+		NodeData node;
+		node.kind = NodeKind::CIRCLE;
+		node.pos1 = centre;
+		node.pos2 = centre;
+		node.radius = radius;
+		node.filled = filled;
+		node.pixel = pixel;
+		return pAdd(node);
+	}
+
+	inline Scene::Node Scene::AddLine(const vi2d& pos1, const vi2d& pos2, const Pixel& pixel, float width) {
+		NodeData node;
+		node.kind = NodeKind::LINE;
+		node.pos1 = pos1;
+		node.pos2 = pos2;
+		node.width = width;
+		node.pixel = pixel;
+		return pAdd(node);
+	}
+
+	inline Scene::Node Scene::AddSprite(const vi2d& pos, Sprite* sprite) {
+		NodeData node;
+		node.kind = NodeKind::SPRITE;
+		node.pos1 = pos;
+		node.pos2 = pos;
+		node.sprite = sprite;
+		return pAdd(node);
+	}
+
+	inline void Scene::Remove(Node node) {
+		NodeData& n = pNode(node);
+		pMark(n);
+		n.kind = NodeKind::NONE;
+	}
+
+	inline void Scene::Clear() {
+		pNodes.clear();
+		pDirty.clear();
+		pFull = true;
+	}
+
+	inline void Scene::SetPosition(Node node, const vi2d& pos) {
+		NodeData& n = pNode(node);
+		if(n.pos1.x == pos.x && n.pos1.y == pos.y) return;
+
+		pMark(n);
+		n.pos2 += pos - n.pos1;
+		n.pos1 = pos;
+		pMark(n);
+	}
+
+	inline void Scene::SetColour(Node node, const Pixel& pixel) {
+		NodeData& n = pNode(node);
+		if(n.pixel.n == pixel.n) return;
+
+		n.pixel = pixel;
+		pMark(n);
+	}
+
+	inline void Scene::SetVisible(Node node, bool visible) {
+		NodeData& n = pNode(node);
+		if(n.visible == visible) return;
+
+		pMark(n);
+		n.visible = visible;
+		pMark(n);
+	}
+
+	inline void Scene::Touch(Node node) {
+		pMark(pNode(node));
+	}
+
+	inline void Scene::SetBackground(const Pixel& pixel) {
+		if(pBackground.n == pixel.n) return;
+
+		pBackground = pixel;
+		pFull = true;
+	}
+
+	inline void Scene::Invalidate() {
+		pFull = true;
+	}
+
+	inline const SceneStats& Scene::Stats() const {
+		return pStats;
+	}
+
+	inline Scene::Node Scene::pAdd(const NodeData& node) {
+		pNodes.push_back(node);
+		pMark(node);
+		return (Node) (pNodes.size() - 1);
+	}
+
+	inline Scene::NodeData& Scene::pNode(Node node) {
+		if(node >= pNodes.size() || pNodes[node].kind == NodeKind::NONE) {
+			throw std::runtime_error("Invalid scene node.");
+		}
+
+		return pNodes[node];
+	}
+
+	inline Scene::Box Scene::pBounds(const NodeData& node) const {
+		vi2d lo((std::min)(node.pos1.x, node.pos2.x), (std::min)(node.pos1.y, node.pos2.y));
+		vi2d hi((std::max)(node.pos1.x, node.pos2.x) + 1, (std::max)(node.pos1.y, node.pos2.y) + 1);
+
+		switch(node.kind) {
+			case NodeKind::CIRCLE:
+				return { lo - (int32_t) node.radius, hi + (int32_t) node.radius };
+			case NodeKind::LINE:
+			{
+				int32_t pad = node.width > 1.0f ? (int32_t) std::ceil(node.width * 0.5f) + 1 : 0;
+				return { lo - pad, hi + pad };
+			}
+			case NodeKind::SPRITE:
+				return { node.pos1, node.pos1 + vi2d(node.sprite->Size().x, node.sprite->Size().y) };
+			default:
+				return { lo, hi };
+		}
+	}
+
+	inline void Scene::pMark(const NodeData& node) {
+		if(node.kind != NodeKind::NONE && node.visible && !pFull) pDirty.push_back(pBounds(node));
+	}
+
+	inline void Scene::pDraw(Application& app, const NodeData& node) {
+		const vi2d& a = node.pos1;
+		const vi2d& b = node.pos2;
+
+		switch(node.kind) {
+			case NodeKind::RECT:
+			{
+				if(node.radius) {
+					if(node.filled) app.FillRoundedRect(vu2d(a.x, a.y), vu2d(b.x, b.y), node.radius, node.pixel);
+					else app.DrawRoundedRect(vu2d(a.x, a.y), vu2d(b.x, b.y), node.radius, node.pixel);
+					break;
+				}
+
+				int32_t top = (std::max)(a.y, app.pClipMin.y), bottom = (std::min)(b.y, app.pClipMax.y - 1);
+
+				for(int32_t y = top; y <= bottom; y++) {
+					if(node.filled || y == a.y || y == b.y) {
+						app.pDrawSpan(a.x, b.x, y, node.pixel);
+					} else {
+						app.pDrawSpan(a.x, a.x, y, node.pixel);
+						if(b.x != a.x) app.pDrawSpan(b.x, b.x, y, node.pixel);
+					}
+				}
+
+				break;
+			}
+			case NodeKind::CIRCLE:
+				if(node.filled) app.FillEllipse(vu2d(a.x, a.y), vu2d(node.radius, node.radius), node.pixel);
+				else app.DrawEllipse(vu2d(a.x, a.y), vu2d(node.radius, node.radius), node.pixel);
+				break;
+			case NodeKind::LINE:
+				if(node.width > 1.0f) {
+					vf2d points[2] = { vf2d((float) a.x, (float) a.y), vf2d((float) b.x, (float) b.y) };
+					app.DrawLines(points, 2, node.width, node.pixel);
+				} else {
+					vi2d points[2] = { a, b };
+					app.DrawLines(points, 2, node.pixel);
+				}
+				break;
+			case NodeKind::SPRITE:
+				app.BlitSprite(a, node.sprite);
+				break;
+			default:
+				break;
+		}
+	}
+
+	inline void Scene::Render(Application& app) {
+		auto start = std::chrono::steady_clock::now();
+
+		vu2d screen = app.DrawTargetSize();
+
+		if(screen.x != pScreenSize.x || screen.y != pScreenSize.y) {
+			pScreenSize = screen;
+			pFull = true;
+		}
+
+		int64_t screenArea = (int64_t) screen.x * screen.y;
+		int64_t area = 0;
+
+		pRegions.clear();
+
+		if(!pFull) {
+			for(Box b : pDirty) {
+				b.min = vi2d((std::max)(b.min.x, 0), (std::max)(b.min.y, 0));
+				b.max = vi2d((std::min)(b.max.x, (int32_t) screen.x), (std::min)(b.max.y, (int32_t) screen.y));
+
+				if(b.min.x < b.max.x && b.min.y < b.max.y) pRegions.push_back(b);
+			}
+
+			// Overlapping regions are merged so no pixel is rasterized twice
+			for(bool merged = true; merged;) {
+				merged = false;
+
+				for(size_t i = 0; i < pRegions.size(); i++) {
+					for(size_t j = i + 1; j < pRegions.size();) {
+						Box& p = pRegions[i];
+						Box& q = pRegions[j];
+
+						if(p.min.x < q.max.x && q.min.x < p.max.x && p.min.y < q.max.y && q.min.y < p.max.y) {
+							p.min = vi2d((std::min)(p.min.x, q.min.x), (std::min)(p.min.y, q.min.y));
+							p.max = vi2d((std::max)(p.max.x, q.max.x), (std::max)(p.max.y, q.max.y));
+
+							pRegions[j] = pRegions.back();
+							pRegions.pop_back();
+							merged = true;
+						} else {
+							j++;
+						}
+					}
+				}
+			}
+
+			for(const Box& b : pRegions) {
+				area += (int64_t) (b.max.x - b.min.x) * (b.max.y - b.min.y);
+			}
+
+			// Past half the screen one full pass is cheaper than many clipped ones
+			if(area * 2 > screenArea) pFull = true;
+		}
+
+		if(pFull) {
+			pRegions.assign(1, { vi2d(0, 0), vi2d(screen.x, screen.y) });
+			area = screenArea;
+		}
+
+		pDirty.clear();
+		pFull = false;
+
+		pStats.nodes = 0;
+		pStats.regions = (uint32_t) pRegions.size();
+		pStats.redrawn = 0;
+		pStats.pixels = (uint64_t) area;
+
+		pCandidates.clear();
+
+		for(uint32_t i = 0; i < pNodes.size(); i++) {
+			const NodeData& node = pNodes[i];
+			if(node.kind == NodeKind::NONE) continue;
+
+			pStats.nodes++;
+			if(!node.visible) continue;
+
+			Box b = pBounds(node);
+
+			for(const Box& r : pRegions) {
+				if(b.min.x < r.max.x && r.min.x < b.max.x && b.min.y < r.max.y && r.min.y < b.max.y) {
+					pCandidates.push_back(i);
+					break;
+				}
+			}
+		}
+
+		vi2d clipMin = app.pClipMin, clipMax = app.pClipMax;
+		pixel::DrawingMode mode = app.pDrawingMode;
+
+		for(const Box& region : pRegions) {
+			// Regions only narrow the clip rectangle the application has set
+			Box r = region;
+			r.min = vi2d((std::max)(r.min.x, clipMin.x), (std::max)(r.min.y, clipMin.y));
+			r.max = vi2d((std::min)(r.max.x, clipMax.x), (std::min)(r.max.y, clipMax.y));
+
+			if(r.min.x >= r.max.x || r.min.y >= r.max.y) {
+				pDirty.push_back(region);
+				continue;
+			}
+
+			// What the clip cut away stays dirty for the next render
+			if(region.min.y < r.min.y) pDirty.push_back({ region.min, vi2d(region.max.x, r.min.y) });
+			if(r.max.y < region.max.y) pDirty.push_back({ vi2d(region.min.x, r.max.y), region.max });
+			if(region.min.x < r.min.x) pDirty.push_back({ vi2d(region.min.x, r.min.y), vi2d(r.min.x, r.max.y) });
+			if(r.max.x < region.max.x) pDirty.push_back({ vi2d(r.max.x, r.min.y), vi2d(region.max.x, r.max.y) });
+
+			app.pClipMin = r.min;
+			app.pClipMax = r.max;
+
+			app.pDrawingMode = DrawingMode::NO_ALPHA;
+			for(int32_t y = r.min.y; y < r.max.y; y++) app.pDrawSpan(r.min.x, r.max.x - 1, y, pBackground);
+			app.pDrawingMode = mode;
+
+			for(uint32_t i : pCandidates) {
+				const NodeData& node = pNodes[i];
+				Box b = pBounds(node);
+
+				if(b.min.x < r.max.x && r.min.x < b.max.x && b.min.y < r.max.y && r.min.y < b.max.y) {
+					pDraw(app, node);
+					pStats.redrawn++;
+				}
+			}
+		}
+
+		app.pClipMin = clipMin;
+		app.pClipMax = clipMax;
 
-		pSprites.push_back(sprite);
+		pStats.renderTime = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
 	}
 }
@@ -0,0 +1,71 @@
+/*
+
+	Checks that flood filling a uniform region emits
+	exactly one valid span per row, covering every pixel
+	once, so blending fills never touch a pixel twice.
+
+*/
+
+#include <pixel.hpp>
+using namespace pixel;
+
+class FloodFillTest : public Application {
+
+public:
+	bool OnCreate() override {
+		const vu2d size = ScreenSize();
+
+		Clear(Pixel(5, 5, 5, 255));
+
+		std::vector<Span> spans;
+		FloodFillRegion(vu2d(size.x / 2, size.y / 2), spans);
+
+		size_t pixels = 0;
+
+		for(const Span& s : spans) {
+			if(s.x2 < s.x1) {
+				printf("Degenerate span x1=%d x2=%d y=%d.\n", s.x1, s.x2, s.y);
+				pFailed = true;
+			}
+
+			pixels += s.x2 - s.x1 + 1;
+		}
+
+		if(spans.size() != size.y || pixels != size.prod()) {
+			printf("Expected %u spans and %u pixels, got %zu and %zu.\n", size.y, size.prod(), spans.size(), pixels);
+			pFailed = true;
+		}
+
+		// A translucent fill blends every pixel exactly once
+		SetDrawingMode(DrawingMode::FULL_ALPHA);
+		Clear(Black);
+		FloodFill(vu2d(0, 0), Pixel(255, 255, 255, 128));
+
+		const Pixel expected = BlendPixel(Black, Pixel(255, 255, 255, 128));
+		PresentTo(pFrame.data());
+
+		for(uint32_t y = 0; y < size.y; y++) {
+			for(uint32_t x = 0; x < size.x; x++) {
+				if(pFrame[y * size.x + x] != expected) {
+					printf("Pixel (%u, %u) was blended more than once.\n", x, y);
+					pFailed = true;
+					return false;
+				}
+			}
+		}
+
+		return false;
+	}
+
+public:
+	std::vector<Pixel> pFrame = std::vector<Pixel>(200 * 4);
+	bool pFailed = false;
+};
+
+int main() {
+	FloodFillTest test;
+	test.Launch(vu2d(200, 4), 1, vu2d(100, 100), "Flood fill test");
+
+	printf(test.pFailed ? "FAILED\n" : "PASSED\n");
+	return test.pFailed ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+/*
+
+	Checks that a Gouraud shaded triangle reaching off
+	the top and left of the screen covers exactly the
+	pixels on or inside its edges, with the colour of
+	each one interpolated from its corners.
+
+*/
+
+#include <pixel.hpp>
+using namespace pixel;
+
+class GouraudTest : public Application {
+
+public:
+	bool OnCreate() override {
+		const vu2d size = ScreenSize();
+
+		// Negative coordinates wrap around in a vu2d
+		const int32_t x[3] = { -20, 60, 10 };
+		const int32_t y[3] = { -5, 10, 40 };
+		const Pixel colors[3] = { Pixel(255, 0, 0, 255), Pixel(0, 255, 0, 255), Pixel(0, 0, 255, 255) };
+
+		Clear(Black);
+		FillTriangle(vu2d(x[0], y[0]), vu2d(x[1], y[1]), vu2d(x[2], y[2]), colors[0], colors[1], colors[2]);
+		PresentTo(pFrame.data());
+
+		const int64_t area = (int64_t) (x[1] - x[0]) * (y[2] - y[0]) - (int64_t) (x[2] - x[0]) * (y[1] - y[0]);
+		uint32_t covered = 0;
+
+		for(int32_t py = 0; py < (int32_t) size.y; py++) {
+			for(int32_t px = 0; px < (int32_t) size.x; px++) {
+				int64_t w[3];
+
+				for(uint32_t i = 0; i < 3; i++) {
+					uint32_t j = (i + 1) % 3, k = (i + 2) % 3;
+					w[i] = (int64_t) (x[k] - x[j]) * (py - y[j]) - (int64_t) (y[k] - y[j]) * (px - x[j]);
+				}
+
+				bool inside = area > 0 ? (w[0] >= 0 && w[1] >= 0 && w[2] >= 0) : (w[0] <= 0 && w[1] <= 0 && w[2] <= 0);
+				const Pixel& got = pFrame[py * size.x + px];
+
+				if(!inside) {
+					if(got != Black) {
+						printf("Pixel (%d, %d) is outside the triangle but was drawn.\n", px, py);
+						pFailed = true;
+						return false;
+					}
+
+					continue;
+				}
+
+				covered++;
+
+				float expected[3] = {};
+
+				for(uint32_t i = 0; i < 3; i++) {
+					float weight = (float) w[i] / (float) area;
+
+					expected[0] += colors[i].r * weight;
+					expected[1] += colors[i].g * weight;
+					expected[2] += colors[i].b * weight;
+				}
+
+				const uint8_t channels[3] = { got.r, got.g, got.b };
+
+				for(uint32_t c = 0; c < 3; c++) {
+					if(std::abs(channels[c] - expected[c]) > 2.0f) {
+						printf("Pixel (%d, %d) channel %u is %u, expected %.1f.\n", px, py, c, channels[c], expected[c]);
+						pFailed = true;
+						return false;
+					}
+				}
+			}
+		}
+
+		if(covered == 0) {
+			printf("Nothing was drawn.\n");
+			pFailed = true;
+		}
+
+		return false;
+	}
+
+public:
+	std::vector<Pixel> pFrame = std::vector<Pixel>(64 * 32);
+	bool pFailed = false;
+};
+
+int main() {
+	GouraudTest test;
+	test.Launch(vu2d(64, 32), 1, vu2d(100, 100), "Gouraud test");
+
+	printf(test.pFailed ? "FAILED\n" : "PASSED\n");
+	return test.pFailed ? 1 : 0;
+}